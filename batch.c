@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "huff.h"
+
+/**
+ * Threads take the buffers of a batch BATCH_GRAIN at a time, so that they
+ * seldom contend for the lock, while batches of a few hundred small buffers
+ * still spread over every thread.
+ */
+#define BATCH_GRAIN 16
+
+/**
+ * Shared state of a running batch. Buffers [next, num_buffers) have not
+ * been taken by any thread yet.
+ */
+typedef struct batch_state {
+    const huff_ctx* ctx;
+    huff_buffer* buffers;
+    size_t num_buffers;
+    size_t next;
+    int failed; // Indicator for whether any buffer failed to compress
+    pthread_mutex_t lock;
+} BATCH_STATE;
+
+/**
+ * What one thread of a batch keeps from one buffer to the next: a copy of the
+ * options of the batch with an encoder and buffers of its own, and the state
+ * of the last buffer it compressed, whose index and carry buffer are reused.
+ */
+typedef struct batch_worker {
+    huff_ctx ctx;
+    COMPRESS_STATE state;
+    uint32_t table[2 * 256];
+} BATCH_WORKER;
+
+void* batch_main(void* arg);
+BATCH_WORKER* new_batch_worker(const huff_ctx* ctx);
+void free_batch_worker(BATCH_WORKER* worker);
+int compress_buffer(BATCH_WORKER* worker, huff_buffer* buffer);
+
+/**
+ * Compress each of the num_buffers buffers at buffers on its own with the
+ * options of ctx, on up to ctx->num_threads threads, the calling thread being
+ * one of them. Every buffer is compressed as compress_stream() would, so the
+ * output does not depend on the number of threads.
+ *
+ * Return 0 if every buffer is compressed without error. Otherwise, return -1.
+ */
+int compress_batch(huff_ctx* ctx, huff_buffer* buffers, size_t num_buffers) {
+    BATCH_STATE state = {.ctx = ctx, .buffers = buffers, .num_buffers = num_buffers};
+    size_t max_threads = (num_buffers + BATCH_GRAIN - 1) / BATCH_GRAIN;
+    int num_threads = ((size_t) ctx->num_threads < max_threads) ? ctx->num_threads : (int) max_threads;
+    pthread_t threads[MAX_THREADS];
+    int num_started = 0;
+
+    pthread_mutex_init(&state.lock, NULL);
+
+    // A thread that cannot be started leaves its buffers to the others
+    for (; num_started < num_threads - 1; num_started++) {
+        if (pthread_create(threads + num_started, NULL, batch_main, &state) != 0)
+            break;
+    }
+
+    batch_main(&state);
+
+    for (int i = 0; i < num_started; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&state.lock);
+
+    return state.failed ? -1 : 0;
+}
+
+/**
+ * Body of a thread of a batch: compress the buffers it takes until none are
+ * left. A thread that cannot allocate its worker fails the buffers it takes.
+ */
+void* batch_main(void* arg) {
+    BATCH_STATE* state = arg;
+    BATCH_WORKER* worker = new_batch_worker(state->ctx);
+    int failed = 0;
+
+    while (1) {
+        pthread_mutex_lock(&state->lock);
+        size_t first = state->next;
+        size_t end = (state->num_buffers - first < BATCH_GRAIN) ? state->num_buffers : first + BATCH_GRAIN;
+        state->next = end;
+        pthread_mutex_unlock(&state->lock);
+
+        if (first == end)
+            break;
+
+        for (size_t i = first; i < end; i++) {
+            if (worker == NULL || compress_buffer(worker, state->buffers + i) == -1) {
+                state->buffers[i].len = -1;
+                failed = 1;
+            }
+        }
+    }
+
+    free_batch_worker(worker);
+
+    if (failed) {
+        pthread_mutex_lock(&state->lock);
+        state->failed = 1;
+        pthread_mutex_unlock(&state->lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * Allocate the worker of one thread of a batch compressed with the options of
+ * ctx, whose table it shares.
+ *
+ * Return the worker, or NULL if out of memory.
+ */
+BATCH_WORKER* new_batch_worker(const huff_ctx* ctx) {
+    BATCH_WORKER* worker = malloc(sizeof(BATCH_WORKER));
+
+    if (worker == NULL)
+        return NULL;
+
+    worker->ctx = *ctx;
+    worker->ctx.num_threads = 1;
+    worker->ctx.stats_out = NULL;
+    worker->ctx.enc = malloc(sizeof(ENCODER));
+    worker->ctx.dec = NULL;
+    worker->ctx.input = NULL;
+    worker->ctx.output = NULL;
+    worker->ctx.input_size = 0;
+    worker->ctx.output_size = 0;
+
+    if (worker->ctx.enc == NULL || init_compress_state(&worker->ctx, &worker->state) == -1) {
+        free(worker->ctx.enc);
+        free(worker);
+        return NULL;
+    }
+
+    if (!ctx->dynamic &&
+        ctx_reserve(&worker->ctx, ctx->block_size, COMPRESS_BLOCK_BOUND(ctx->block_size)) == -1) {
+        free_batch_worker(worker);
+        return NULL;
+    }
+
+    init_encoder(worker->ctx.enc, &worker->state);
+
+    return worker;
+}
+
+/**
+ * Free worker and everything it owns, but not the table it shares.
+ */
+void free_batch_worker(BATCH_WORKER* worker) {
+    if (worker == NULL)
+        return;
+
+    free(worker->state.index.lengths);
+    free(worker->state.carry);
+    free(worker->ctx.enc);
+    free(worker->ctx.input);
+    free(worker->ctx.output);
+    free(worker);
+}
+
+/**
+ * Compress buffer with worker and store the size of its compressed data in
+ * buffer->len. The state of worker is set back to the start of a stream by
+ * resetting only what the last buffer changed, and the encoder forgets its
+ * code, whose number would otherwise match the first block of the buffer.
+ *
+ * Return 0 if the buffer is compressed without error. Otherwise, return -1.
+ */
+int compress_buffer(BATCH_WORKER* worker, huff_buffer* buffer) {
+    COMPRESS_STATE* state = &worker->state;
+    SOURCE source = {.data = buffer->src, .len = buffer->n};
+    SINK sink = {.data = buffer->dst, .capacity = buffer->capacity};
+    JOB job = {.input = worker->ctx.input, .output = worker->ctx.output, .table = (unsigned char*) worker->table};
+    int ret;
+
+    if (worker->ctx.dynamic) {
+        if (compress_dynamic(&worker->ctx, &source, &sink) == -1)
+            return -1;
+
+        buffer->len = sink.len;
+        return 0;
+    }
+
+    // compress_message() returns 1 if the buffer is not to be a message
+    ret = compress_message(&worker->ctx, &source, &sink);
+    if (ret != 1) {
+        buffer->len = sink.len;
+        return ret;
+    }
+
+    state->source = &source;
+    state->sink = &sink;
+    state->carry_len = 0;
+    state->num_blocks = 0;
+    state->table_id = -1;
+    state->static_excess = 0;
+    state->index.num_blocks = 0;
+    worker->ctx.enc->table_id = -1;
+
+    ret = write_file_header(state);
+
+    // Run the stages of the pipeline one after another on this thread
+    while (ret == 0) {
+        ret = read_block_job(&job, state);
+        if (ret != 0)
+            break;
+
+        if (compress_block_job(&job, worker->ctx.enc) == -1 || write_job(&job, state) == -1)
+            ret = -1;
+    }
+
+    // read_block_job() returns 1 at the end of the input
+    if (ret == -1 || compress_finish(state) == -1)
+        return -1;
+
+    buffer->len = sink.len;
+
+    return 0;
+}
@@ -0,0 +1,651 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "huff.h"
+
+/**
+ * Throughput benchmark of compression and decompression through libhuff.
+ * For every corpus and every block size from 1024 up to the first one that
+ * holds the whole corpus, the corpus is compressed and decompressed as a
+ * whole to measure MB/s and the compression ratio, and one block at a time to
+ * measure percentiles of the latency of a single block. Results are printed
+ * as CSV or JSON, one record per corpus and block size.
+ *
+ * With -D, the dynamic format is measured. Its data is not split into
+ * blocks, so the latency of a block is instead the time to push it through
+ * a stream that continues from the blocks before it and flush it out, and to
+ * push that output through a stream decompressing it.
+ *
+ * With -H, the implementations of the histogram of a block are measured
+ * instead, in MB/s, and checked to agree.
+ *
+ * The synthetic corpora are generated from a fixed seed, so every run
+ * measures the same data. Files named on the command line are measured after
+ * them.
+ *
+ * Usage: bench/huff_bench [-n BYTES] [-r REPEATS] [-o csv|json] [-a] [-f] [-C]
+ *                         [-L MAXLEN] [-s STREAMS] [-D] [-H] [FILE...]
+ */
+
+#define DEFAULT_CORPUS_SIZE (4 << 20)
+#define DEFAULT_REPEATS 3
+
+/**
+ * A corpus to measure: name and the len bytes at data.
+ */
+typedef struct corpus {
+    const char* name;
+    unsigned char* data;
+    size_t len;
+} CORPUS;
+
+/**
+ * The measurements of one corpus at one block size. Latencies are in
+ * microseconds; the percentiles are p50, p90, p99, and the maximum.
+ */
+typedef struct result {
+    double ratio;
+    double compress_mbps;
+    double decompress_mbps;
+    double compress_latency[4];
+    double decompress_latency[4];
+} RESULT;
+
+int measure(huff_ctx* ctx, const CORPUS* corpus, int block_size, int repeats, int dynamic, RESULT* result);
+int measure_stream_latency(huff_ctx* ctx, const CORPUS* corpus, int block_size, RESULT* result);
+int measure_histograms(const CORPUS* corpus, int block_size, int repeats, int json, int first);
+void percentiles(double* samples, size_t n, double* out);
+int compare_doubles(const void* a, const void* b);
+void print_result(const CORPUS* corpus, int block_size, const RESULT* result, int json, int first);
+void generate_uniform(unsigned char* data, size_t len);
+void generate_zipf(unsigned char* data, size_t len);
+void generate_text(unsigned char* data, size_t len);
+void generate_runs(unsigned char* data, size_t len);
+void generate_single(unsigned char* data, size_t len);
+uint32_t next_random(void);
+unsigned char* read_file(const char* path, size_t* len);
+double seconds(void);
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ULL;
+
+int main(int argc, char** argv) {
+    size_t corpus_size = DEFAULT_CORPUS_SIZE;
+    int repeats = DEFAULT_REPEATS;
+    int json = 0;
+    int histograms = 0;
+    int dynamic = 0;
+    huff_ctx* ctx = huff_ctx_new();
+    int i = 1;
+
+    if (ctx == NULL)
+        return EXIT_FAILURE;
+
+    // Options precede the files
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-a") == 0) {
+            huff_set_adaptive(ctx, 1);
+        } else if (strcmp(argv[i], "-f") == 0) {
+            huff_set_framed(ctx, 1);
+        } else if (strcmp(argv[i], "-C") == 0) {
+            huff_set_canonical(ctx, 1);
+            huff_set_framed(ctx, 1);
+        } else if (strcmp(argv[i], "-D") == 0) {
+            huff_set_dynamic(ctx, 1);
+            dynamic = 1;
+        } else if (strcmp(argv[i], "-H") == 0) {
+            histograms = 1;
+        } else if (i + 1 == argc) {
+            break;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            corpus_size = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-r") == 0) {
+            repeats = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            json = strcmp(argv[++i], "json") == 0;
+        } else if (strcmp(argv[i], "-L") == 0) {
+            if (huff_set_max_code_length(ctx, atoi(argv[++i])) == -1)
+                break;
+            huff_set_framed(ctx, 1);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            if (huff_set_streams(ctx, atoi(argv[++i])) == -1)
+                break;
+            huff_set_framed(ctx, 1);
+        } else {
+            break;
+        }
+    }
+
+    if (i < argc && argv[i][0] == '-') {
+        fprintf(stderr,
+                "Usage: %s [-n BYTES] [-r REPEATS] [-o csv|json] [-a] [-f] [-C] [-L MAXLEN] [-s STREAMS] [-D] [-H]\n"
+                "       [FILE...]\n",
+                argv[0]);
+        huff_ctx_free(ctx);
+        return EXIT_FAILURE;
+    }
+
+    if (corpus_size == 0 || repeats <= 0) {
+        huff_ctx_free(ctx);
+        return EXIT_FAILURE;
+    }
+
+    const char* names[] = {"uniform", "zipf", "text", "runs", "single"};
+    void (*generators[])(unsigned char*, size_t) = {
+        generate_uniform, generate_zipf, generate_text, generate_runs, generate_single
+    };
+    int num_synthetic = sizeof(names) / sizeof(names[0]);
+    int num_corpora = num_synthetic + (argc - i);
+    CORPUS* corpora = calloc(num_corpora, sizeof(CORPUS));
+    int ret = EXIT_SUCCESS;
+
+    if (corpora == NULL) {
+        huff_ctx_free(ctx);
+        return EXIT_FAILURE;
+    }
+
+    for (int c = 0; c < num_corpora && ret == EXIT_SUCCESS; c++) {
+        if (c < num_synthetic) {
+            corpora[c].name = names[c];
+            corpora[c].len = corpus_size;
+            corpora[c].data = malloc(corpus_size);
+            if (corpora[c].data != NULL)
+                generators[c](corpora[c].data, corpus_size);
+        } else {
+            corpora[c].name = argv[i + c - num_synthetic];
+            corpora[c].data = read_file(corpora[c].name, &corpora[c].len);
+        }
+
+        if (corpora[c].data == NULL) {
+            fprintf(stderr, "%s: cannot load corpus\n", corpora[c].name);
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    if (ret == EXIT_SUCCESS) {
+        if (json)
+            printf("[\n");
+        else if (histograms)
+            printf("corpus,bytes,block_size,implementation,mbps\n");
+        else
+            printf("corpus,bytes,block_size,ratio,compress_mbps,decompress_mbps,"
+                   "compress_p50_us,compress_p90_us,compress_p99_us,compress_max_us,"
+                   "decompress_p50_us,decompress_p90_us,decompress_p99_us,decompress_max_us\n");
+
+        for (int c = 0; c < num_corpora && ret == EXIT_SUCCESS; c++) {
+            // Stop at the first block size that holds the whole corpus
+            for (int block_size = HUFF_MIN_BLOCK_SIZE; block_size <= HUFF_MAX_BLOCK_SIZE; block_size *= 2) {
+                RESULT result;
+
+                if (block_size > HUFF_MIN_BLOCK_SIZE && (size_t) block_size / 2 >= corpora[c].len)
+                    break;
+
+                if (histograms) {
+                    if (measure_histograms(corpora + c, block_size, repeats, json,
+                                           c == 0 && block_size == HUFF_MIN_BLOCK_SIZE) == -1) {
+                        fprintf(stderr, "%s: histograms differ\n", corpora[c].name);
+                        ret = EXIT_FAILURE;
+                        break;
+                    }
+                    continue;
+                }
+
+                if (measure(ctx, corpora + c, block_size, repeats, dynamic, &result) == -1) {
+                    fprintf(stderr, "%s: round trip failed with blocks of %d bytes\n", corpora[c].name,
+                            block_size);
+                    ret = EXIT_FAILURE;
+                    break;
+                }
+
+                print_result(corpora + c, block_size, &result, json, c == 0 && block_size == HUFF_MIN_BLOCK_SIZE);
+                fflush(stdout);
+            }
+        }
+
+        if (json)
+            printf("\n]\n");
+    }
+
+    for (int c = 0; c < num_corpora; c++)
+        free(corpora[c].data);
+    free(corpora);
+    huff_ctx_free(ctx);
+
+    return ret;
+}
+
+/**
+ * Measure corpus with blocks of block_size bytes and the other options of
+ * ctx. Throughput is the best of repeats runs over the whole corpus. The
+ * latency of a block is the time to compress or decompress it on its own, or
+ * if dynamic is nonzero, as measure_stream_latency() measures it.
+ *
+ * Return 0 if every run decompresses back to the corpus. Otherwise, return -1.
+ */
+int measure(huff_ctx* ctx, const CORPUS* corpus, int block_size, int repeats, int dynamic, RESULT* result) {
+    size_t num_blocks = (corpus->len + block_size - 1) / block_size;
+    size_t capacity;
+    unsigned char* compressed;
+    unsigned char* decompressed;
+    double* samples;
+    long compressed_len = 0;
+    int ret = 0;
+
+    huff_set_block_size(ctx, block_size);
+    capacity = huff_compress_bound(ctx, corpus->len);
+    compressed = malloc(capacity);
+    decompressed = malloc(corpus->len + 1);
+    samples = malloc((num_blocks + 1) * sizeof(double));
+
+    if (compressed == NULL || decompressed == NULL || samples == NULL)
+        ret = -1;
+
+    // Throughput over the whole corpus
+    double best_compress = 0, best_decompress = 0;
+    for (int r = 0; r < repeats && ret == 0; r++) {
+        double start = seconds();
+        compressed_len = huff_compress(ctx, corpus->data, corpus->len, compressed, capacity);
+        double compress_time = seconds() - start;
+
+        start = seconds();
+        long decompressed_len = huff_decompress(ctx, compressed, compressed_len, decompressed, corpus->len + 1);
+        double decompress_time = seconds() - start;
+
+        if (compressed_len == -1 || decompressed_len != (long) corpus->len ||
+            memcmp(decompressed, corpus->data, corpus->len) != 0) {
+            ret = -1;
+            break;
+        }
+
+        if (r == 0 || compress_time < best_compress)
+            best_compress = compress_time;
+        if (r == 0 || decompress_time < best_decompress)
+            best_decompress = decompress_time;
+    }
+
+    if (ret == 0) {
+        result->ratio = (double) compressed_len / corpus->len;
+        result->compress_mbps = corpus->len / best_compress / 1e6;
+        result->decompress_mbps = corpus->len / best_decompress / 1e6;
+    }
+
+    if (dynamic && ret == 0)
+        ret = measure_stream_latency(ctx, corpus, block_size, result);
+
+    // Latency of single blocks, compressed into and decompressed from the
+    // start of the buffers
+    for (int pass = 0; pass < 2 && ret == 0 && !dynamic; pass++) {
+        for (size_t b = 0; b < num_blocks; b++) {
+            size_t offset = b * block_size;
+            size_t len = (corpus->len - offset < (size_t) block_size) ? corpus->len - offset : (size_t) block_size;
+
+            double start = seconds();
+            long block_len = huff_compress(ctx, corpus->data + offset, len, compressed, capacity);
+            double compress_time = seconds() - start;
+
+            start = seconds();
+            long decompressed_len = huff_decompress(ctx, compressed, block_len, decompressed, len);
+            double decompress_time = seconds() - start;
+
+            if (block_len == -1 || decompressed_len != (long) len) {
+                ret = -1;
+                break;
+            }
+
+            samples[b] = ((pass == 0) ? compress_time : decompress_time) * 1e6;
+        }
+
+        if (ret == 0)
+            percentiles(samples, num_blocks, (pass == 0) ? result->compress_latency : result->decompress_latency);
+    }
+
+    free(compressed);
+    free(decompressed);
+    free(samples);
+
+    return ret;
+}
+
+/**
+ * Measure the latency of blocks of block_size bytes of corpus in a stream
+ * compressed with ctx: the time to push each block through one stream with
+ * HUFF_FLUSH, and to push the output of that through one decompressing
+ * stream, which must hand out the block in full.
+ *
+ * Return 0 if every block decompresses back to the corpus. Otherwise, return
+ * -1.
+ */
+int measure_stream_latency(huff_ctx* ctx, const CORPUS* corpus, int block_size, RESULT* result) {
+    size_t num_blocks = (corpus->len + block_size - 1) / block_size;
+    size_t capacity = huff_compress_bound(ctx, block_size);
+    unsigned char* compressed = malloc(capacity);
+    unsigned char* decompressed = malloc(block_size);
+    double* compress_samples = malloc((num_blocks + 1) * sizeof(double));
+    double* decompress_samples = malloc((num_blocks + 1) * sizeof(double));
+    huff_ctx* decompress_ctx = huff_ctx_new();
+    huff_stream compress_strm, decompress_strm;
+    int ret = 0;
+
+    memset(&compress_strm, 0, sizeof(compress_strm));
+    memset(&decompress_strm, 0, sizeof(decompress_strm));
+
+    if (compressed == NULL || decompressed == NULL || compress_samples == NULL || decompress_samples == NULL ||
+        decompress_ctx == NULL || huff_compress_begin(ctx, &compress_strm) == -1 ||
+        huff_decompress_begin(decompress_ctx, &decompress_strm) == -1)
+        ret = -1;
+
+    for (size_t b = 0; b < num_blocks && ret == 0; b++) {
+        size_t offset = b * block_size;
+        size_t len = (corpus->len - offset < (size_t) block_size) ? corpus->len - offset : (size_t) block_size;
+
+        // The output has room for all of a flushed block, so one push does
+        double start = seconds();
+        compress_strm.next_in = corpus->data + offset;
+        compress_strm.avail_in = len;
+        compress_strm.next_out = compressed;
+        compress_strm.avail_out = capacity;
+        int compress_ret = huff_compress_push(&compress_strm, HUFF_FLUSH);
+        double compress_time = seconds() - start;
+
+        start = seconds();
+        decompress_strm.next_in = compressed;
+        decompress_strm.avail_in = capacity - compress_strm.avail_out;
+        decompress_strm.next_out = decompressed;
+        decompress_strm.avail_out = block_size;
+        int decompress_ret = 0;
+        while (decompress_ret == 0 && decompress_strm.avail_in > 0)
+            decompress_ret = huff_decompress_push(&decompress_strm, HUFF_RUN);
+        double decompress_time = seconds() - start;
+
+        if (compress_ret == -1 || compress_strm.avail_in > 0 || decompress_ret == -1 ||
+            block_size - decompress_strm.avail_out != len || memcmp(decompressed, corpus->data + offset, len) != 0) {
+            ret = -1;
+            break;
+        }
+
+        compress_samples[b] = compress_time * 1e6;
+        decompress_samples[b] = decompress_time * 1e6;
+    }
+
+    if (ret == 0) {
+        percentiles(compress_samples, num_blocks, result->compress_latency);
+        percentiles(decompress_samples, num_blocks, result->decompress_latency);
+    }
+
+    huff_stream_end(&compress_strm);
+    huff_stream_end(&decompress_strm);
+    huff_ctx_free(decompress_ctx);
+    free(compressed);
+    free(decompressed);
+    free(compress_samples);
+    free(decompress_samples);
+
+    return ret;
+}
+
+/**
+ * Measure the histogram implementations on corpus split into blocks of
+ * block_size bytes, taking the best of repeats runs, and print one record
+ * per implementation. histogram_simd() is only measured if the CPU supports
+ * it, and histogram() is the one it dispatches to.
+ *
+ * Return 0 if every implementation counts the same as histogram_simple().
+ * Otherwise, return -1.
+ */
+int measure_histograms(const CORPUS* corpus, int block_size, int repeats, int json, int first) {
+    const char* names[] = {"simple", "scalar", "simd", "dispatch"};
+    HISTOGRAM_FUNC functions[] = {histogram_simple, histogram_scalar, histogram_simd, histogram};
+    uint32_t expected[256], counts[256];
+
+    for (int f = 0; f < 4; f++) {
+        if (functions[f] == histogram_simd && !histogram_simd_supported())
+            continue;
+
+        double best = 0;
+        for (int r = 0; r < repeats; r++) {
+            double start = seconds();
+            for (size_t offset = 0; offset < corpus->len; offset += block_size) {
+                size_t len = (corpus->len - offset < (size_t) block_size) ? corpus->len - offset : (size_t) block_size;
+
+                functions[f](corpus->data + offset, len, counts);
+
+                // Check the counts of the first block outside the timing
+                if (offset == 0 && r == 0) {
+                    double pause = seconds();
+                    histogram_simple(corpus->data, len, expected);
+                    if (memcmp(counts, expected, sizeof(counts)) != 0)
+                        return -1;
+                    start += seconds() - pause;
+                }
+            }
+            double time = seconds() - start;
+
+            if (r == 0 || time < best)
+                best = time;
+        }
+
+        if (json)
+            printf("%s  {\"corpus\": \"%s\", \"bytes\": %zu, \"block_size\": %d, \"implementation\": \"%s\", "
+                   "\"mbps\": %.1f}", (first && f == 0) ? "" : ",\n", corpus->name, corpus->len, block_size,
+                   names[f], corpus->len / best / 1e6);
+        else
+            printf("%s,%zu,%d,%s,%.1f\n", corpus->name, corpus->len, block_size, names[f], corpus->len / best / 1e6);
+    }
+
+    return 0;
+}
+
+/**
+ * Sort the n samples and store their 50th, 90th, and 99th percentiles and
+ * their maximum in out.
+ */
+void percentiles(double* samples, size_t n, double* out) {
+    const double ranks[] = {0.50, 0.90, 0.99};
+
+    qsort(samples, n, sizeof(double), compare_doubles);
+
+    for (int i = 0; i < 3; i++)
+        out[i] = samples[(size_t) (ranks[i] * (n - 1))];
+    out[3] = samples[n - 1];
+}
+
+/**
+ * Compare two doubles for qsort().
+ */
+int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Print the result of measuring corpus at block_size as a CSV line or a JSON
+ * object, the first of which needs no separator.
+ */
+void print_result(const CORPUS* corpus, int block_size, const RESULT* result, int json, int first) {
+    const double* c = result->compress_latency;
+    const double* d = result->decompress_latency;
+
+    if (!json) {
+        printf("%s,%zu,%d,%.4f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", corpus->name, corpus->len,
+               block_size, result->ratio, result->compress_mbps, result->decompress_mbps, c[0], c[1], c[2], c[3],
+               d[0], d[1], d[2], d[3]);
+        return;
+    }
+
+    printf("%s  {\"corpus\": \"", first ? "" : ",\n");
+    for (const char* ptr = corpus->name; *ptr != '\0'; ptr++) {
+        if (*ptr == '"' || *ptr == '\\')
+            putchar('\\');
+        putchar(*ptr);
+    }
+    printf("\", \"bytes\": %zu, \"block_size\": %d, \"ratio\": %.4f, "
+           "\"compress_mbps\": %.1f, \"decompress_mbps\": %.1f, "
+           "\"compress_latency_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}, "
+           "\"decompress_latency_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}}",
+           corpus->len, block_size, result->ratio, result->compress_mbps, result->decompress_mbps,
+           c[0], c[1], c[2], c[3], d[0], d[1], d[2], d[3]);
+}
+
+/**
+ * Fill data with uniformly random bytes.
+ */
+void generate_uniform(unsigned char* data, size_t len) {
+    for (size_t i = 0; i < len; i++)
+        data[i] = next_random();
+}
+
+/**
+ * Fill data with bytes drawn from a Zipf distribution over the 256 byte
+ * values: the byte of rank k occurs in proportion to 1 / k.
+ */
+void generate_zipf(unsigned char* data, size_t len) {
+    double cumulative[256];
+    double total = 0;
+
+    for (int k = 0; k < 256; k++) {
+        total += 1.0 / (k + 1);
+        cumulative[k] = total;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        double u = (next_random() / 4294967296.0) * total;
+        int low = 0, high = 255;
+
+        // Find the first rank whose cumulative weight exceeds u
+        while (low < high) {
+            int mid = (low + high) / 2;
+            if (cumulative[mid] > u)
+                high = mid;
+            else
+                low = mid + 1;
+        }
+
+        // Scatter the ranks over the byte values
+        data[i] = (low * 167 + 13) & 0xFF;
+    }
+}
+
+/**
+ * Fill data with text-like bytes: lines of words from a small vocabulary,
+ * chosen with Zipf-like frequencies, separated by spaces and punctuation.
+ */
+void generate_text(unsigned char* data, size_t len) {
+    static const char* words[] = {
+        "the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was", "with", "be", "by",
+        "on", "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had",
+        "they", "you", "were", "their", "one", "all", "we", "can", "her", "has", "there", "been", "if",
+        "more", "when", "will", "would", "who", "so", "no", "Huffman", "block", "symbol", "compression",
+        "frequency", "tree", "code", "length", "decoder", "stream", "table", "Byte", "Data"
+    };
+    int num_words = sizeof(words) / sizeof(words[0]);
+    size_t pos = 0;
+    int line_len = 0;
+
+    while (pos < len) {
+        // Lower indices are more likely, roughly in proportion to 1 / rank
+        uint32_t r = next_random();
+        int index = (int) ((double) num_words / (1 + (r % (8 * num_words)) / 8.0)) - 1;
+        const char* word = words[index % num_words];
+
+        for (const char* ptr = word; *ptr != '\0' && pos < len; ptr++)
+            data[pos++] = *ptr;
+        line_len += strlen(word) + 1;
+
+        if (pos < len) {
+            r = next_random() % 16;
+            data[pos++] = (r == 0) ? ',' : (r == 1) ? '.' : ' ';
+        }
+
+        if (line_len > 72 && pos < len) {
+            data[pos++] = '\n';
+            line_len = 0;
+        }
+    }
+}
+
+/**
+ * Fill data with runs of 1 to 64 copies of bytes from a set of 8 values.
+ */
+void generate_runs(unsigned char* data, size_t len) {
+    size_t pos = 0;
+
+    while (pos < len) {
+        unsigned char value = 'A' + next_random() % 8;
+        size_t run = 1 + next_random() % 64;
+
+        while (run-- > 0 && pos < len)
+            data[pos++] = value;
+    }
+}
+
+/**
+ * Fill data with a single byte value.
+ */
+void generate_single(unsigned char* data, size_t len) {
+    memset(data, 'a', len);
+}
+
+/**
+ * Return the next number of a 64-bit xorshift generator with a fixed seed,
+ * so that the corpora are the same on every platform.
+ */
+uint32_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+
+    return random_state >> 32;
+}
+
+/**
+ * Read the whole file at path into memory and store its size in len.
+ *
+ * Return the contents, or NULL if the file cannot be read or is empty.
+ */
+unsigned char* read_file(const char* path, size_t* len) {
+    FILE* file = fopen(path, "rb");
+    unsigned char* data = NULL;
+    size_t capacity = 0;
+
+    *len = 0;
+    if (file == NULL)
+        return NULL;
+
+    while (1) {
+        if (*len == capacity) {
+            capacity = (capacity == 0) ? (1 << 20) : 2 * capacity;
+            unsigned char* grown = realloc(data, capacity);
+            if (grown == NULL) {
+                free(data);
+                fclose(file);
+                return NULL;
+            }
+            data = grown;
+        }
+
+        size_t n = fread(data + *len, 1, capacity - *len, file);
+        if (n == 0)
+            break;
+        *len += n;
+    }
+
+    if (ferror(file) || *len == 0) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    return data;
+}
+
+/**
+ * Return the time of a monotonic clock in seconds.
+ */
+double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
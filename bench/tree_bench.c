@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "huff.h"
+
+/**
+ * Microbenchmark of Huffman tree construction. For a few kinds of block
+ * histograms, the time to build one tree with build_huffman_tree() is compared
+ * against the quadratic construction compress_block() used before, and the
+ * descriptions of the two trees are checked to be identical.
+ *
+ * Usage: bench/tree_bench [ITERATIONS]
+ */
+
+#define DEFAULT_ITERATIONS 20000
+
+void build_huffman_tree_quadratic(ENCODER* enc, const uint32_t* weights, int num_leaves);
+int make_leaves(ENCODER* enc, const int* counts, uint32_t* weights);
+double seconds(void);
+
+int main(int argc, char** argv) {
+    int iterations = (argc > 1) ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+    const char* names[] = {"uniform-256", "text-like", "zipf", "few-4"};
+    int counts[4][256] = {{0}};
+    uint32_t weights[MAX_SYMBOLS];
+    ENCODER* enc = malloc(sizeof(ENCODER));
+    unsigned char before[COMPRESS_BLOCK_BOUND(0)], after[COMPRESS_BLOCK_BOUND(0)];
+
+    if (enc == NULL || iterations <= 0)
+        return EXIT_FAILURE;
+
+    // Histograms of 65536-byte blocks
+    srand(1);
+    for (int i = 0; i < MAX_ORIGINAL_BLOCK_SIZE; i++) {
+        counts[0][rand() % 256]++;
+        counts[1][32 + rand() % 16 * (rand() % 6)]++;
+        counts[2][(int) (255.0 / (1 + rand() % 4096))]++;
+        counts[3][rand() % 4]++;
+    }
+
+    printf("histogram,leaves,quadratic_ns_per_block,heap_ns_per_block,speedup\n");
+    for (int h = 0; h < 4; h++) {
+        int num_leaves = make_leaves(enc, counts[h], weights);
+        build_huffman_tree_quadratic(enc, weights, num_leaves);
+        size_t before_len = output_description(enc, before);
+
+        make_leaves(enc, counts[h], weights);
+        build_huffman_tree(enc, weights, num_leaves);
+        size_t after_len = output_description(enc, after);
+
+        if (before_len != after_len || memcmp(before, after, before_len) != 0) {
+            fprintf(stderr, "%s: trees differ\n", names[h]);
+            return EXIT_FAILURE;
+        }
+
+        double start = seconds();
+        for (int i = 0; i < iterations; i++) {
+            make_leaves(enc, counts[h], weights);
+            build_huffman_tree_quadratic(enc, weights, num_leaves);
+        }
+        double quadratic = (seconds() - start) / iterations * 1e9;
+
+        start = seconds();
+        for (int i = 0; i < iterations; i++) {
+            make_leaves(enc, counts[h], weights);
+            build_huffman_tree(enc, weights, num_leaves);
+        }
+        double heap = (seconds() - start) / iterations * 1e9;
+
+        printf("%s,%d,%.0f,%.0f,%.2f\n", names[h], num_leaves, quadratic, heap, quadratic / heap);
+    }
+
+    free(enc);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Set up the leaves of enc for the symbols with nonzero counts, in order of
+ * symbol value, followed by the end block symbol, and store their weights in
+ * weights.
+ *
+ * Return the number of leaves.
+ */
+int make_leaves(ENCODER* enc, const int* counts, uint32_t* weights) {
+    int num_leaves = 0;
+
+    for (int symbol = 0; symbol < MAX_SYMBOLS; symbol++) {
+        if (symbol < 256 && counts[symbol] == 0)
+            continue;
+
+        enc->tree.symbol[num_leaves] = symbol;
+        weights[num_leaves] = (symbol < 256) ? counts[symbol] : 0;
+        num_leaves++;
+    }
+
+    return num_leaves;
+}
+
+/**
+ * The tree construction of compress_block() before build_huffman_tree():
+ * rescan the nodes without a parent for the two minimums on every merge and
+ * shift the array left to close the gap.
+ */
+void build_huffman_tree_quadratic(ENCODER* enc, const uint32_t* weights, int num_leaves) {
+    TREE* tree = &enc->tree;
+    uint32_t weight[MAX_NODES];
+
+    tree->num_nodes = 2 * num_leaves - 1;
+    for (int i = 0; i < num_leaves; i++) {
+        tree->child[i][0] = 0;
+        tree->child[i][1] = 0;
+        weight[i] = weights[i];
+    }
+
+    for (int low = num_leaves, high = tree->num_nodes; low > 1; low--, high -= 2) {
+        uint32_t min_1 = UINT32_MAX, min_2 = UINT32_MAX;
+        int min_index_1 = -1, min_index_2 = -1;
+
+        // Select two minimum-weight nodes
+        for (int i = 0; i < low; i++) {
+            if (weight[i] < min_1) {
+                min_2 = min_1;
+                min_index_2 = min_index_1;
+                min_1 = weight[i];
+                min_index_1 = i;
+            } else if (weight[i] < min_2) {
+                min_2 = weight[i];
+                min_index_2 = i;
+            }
+        }
+
+        // Move two selected minimum-weight nodes to high-end of tree, the
+        // second first since the first may be moved over it
+        int moved[2] = {min_index_1, min_index_2};
+        for (int k = 1; k >= 0; k--) {
+            memcpy(tree->child[high - 2 + k], tree->child[moved[k]], sizeof(tree->child[0]));
+            tree->symbol[high - 2 + k] = tree->symbol[moved[k]];
+            weight[high - 2 + k] = weight[moved[k]];
+        }
+
+        int min_index = (min_index_1 < min_index_2) ? min_index_1 : min_index_2;
+
+        // Construct parent node at min_index
+        tree->child[min_index][0] = high - 2;
+        tree->child[min_index][1] = high - 1;
+        tree->symbol[min_index] = -1;
+        weight[min_index] = min_1 + min_2;
+
+        // Shift low-end of tree to the left to maintain contiguity
+        for (int i = (min_index_1 > min_index_2) ? min_index_1 : min_index_2; i < low - 1; i++) {
+            memcpy(tree->child[i], tree->child[i + 1], sizeof(tree->child[0]));
+            tree->symbol[i] = tree->symbol[i + 1];
+            weight[i] = weight[i + 1];
+        }
+    }
+}
+
+/**
+ * Return the time of a monotonic clock in seconds.
+ */
+double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "huff.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_CRC32C_HW 1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HAVE_CRC32C_HW 1
+#else
+#define HAVE_CRC32C_HW 0
+#endif
+
+/**
+ * CRC32C uses the Castagnoli polynomial, bit-reversed here since the bits of
+ * each byte are taken least significant first. Without CRC instructions, the
+ * CRC is computed eight bytes at a time with slicing-by-8: crc_tables[k]
+ * holds the CRC of each byte followed by k zero bytes, so the CRC of eight
+ * bytes is the exclusive or of eight independent lookups.
+ */
+#define CRC32C_POLY 0x82F63B78
+
+void init_crc_tables(void);
+void select_crc32c(void);
+
+typedef uint32_t (*CRC32C_FUNC)(uint32_t crc, const unsigned char* data, size_t n);
+
+static uint32_t crc_tables[8][256];
+static CRC32C_FUNC crc32c_impl = crc32c_sw;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Return the CRC32C of the n bytes at data appended to bytes whose CRC32C is
+ * crc, which is 0 for no bytes, with the fastest implementation the CPU
+ * supports.
+ */
+uint32_t crc32c(uint32_t crc, const void* data, size_t n) {
+    pthread_once(&crc32c_once, select_crc32c);
+
+    return ~crc32c_impl(~crc, data, n);
+}
+
+/**
+ * Choose the implementation used by crc32c().
+ */
+void select_crc32c(void) {
+    init_crc_tables();
+
+    if (crc32c_hw_supported())
+        crc32c_impl = crc32c_hw;
+}
+
+/**
+ * Fill crc_tables for crc32c_sw().
+ */
+void init_crc_tables(void) {
+    for (int byte = 0; byte < 256; byte++) {
+        uint32_t crc = byte;
+
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc_tables[0][byte] = crc;
+    }
+
+    for (int k = 1; k < 8; k++) {
+        for (int byte = 0; byte < 256; byte++)
+            crc_tables[k][byte] = (crc_tables[k - 1][byte] >> 8) ^ crc_tables[0][crc_tables[k - 1][byte] & 0xFF];
+    }
+}
+
+/**
+ * Update the unfinished CRC crc, which crc32c() inverts before and after,
+ * with the n bytes at data using slicing-by-8. The tables must have been built
+ * by select_crc32c().
+ */
+uint32_t crc32c_sw(uint32_t crc, const unsigned char* data, size_t n) {
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint32_t low = crc ^ ((uint32_t) data[i] | (uint32_t) data[i + 1] << 8 | (uint32_t) data[i + 2] << 16 |
+                              (uint32_t) data[i + 3] << 24);
+
+        crc = crc_tables[7][low & 0xFF] ^ crc_tables[6][(low >> 8) & 0xFF] ^ crc_tables[5][(low >> 16) & 0xFF] ^
+              crc_tables[4][low >> 24] ^ crc_tables[3][data[i + 4]] ^ crc_tables[2][data[i + 5]] ^
+              crc_tables[1][data[i + 6]] ^ crc_tables[0][data[i + 7]];
+    }
+
+    for (; i < n; i++)
+        crc = (crc >> 8) ^ crc_tables[0][(crc ^ data[i]) & 0xFF];
+
+    return crc;
+}
+
+#if HAVE_CRC32C_HW && defined(__ARM_FEATURE_CRC32)
+
+/**
+ * Return 1 if the CPU supports crc32c_hw(). Otherwise, return 0. The CRC
+ * instructions are part of the target this was built for.
+ */
+int crc32c_hw_supported(void) {
+    return 1;
+}
+
+/**
+ * Update the unfinished CRC crc with the n bytes at data like crc32c_sw(),
+ * with the CRC32C instructions of ARMv8, eight bytes at a time.
+ */
+uint32_t crc32c_hw(uint32_t crc, const unsigned char* data, size_t n) {
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        crc = __crc32cd(crc, word);
+    }
+
+    for (; i < n; i++)
+        crc = __crc32cb(crc, data[i]);
+
+    return crc;
+}
+
+#elif HAVE_CRC32C_HW
+
+/**
+ * Return 1 if the CPU supports crc32c_hw(). Otherwise, return 0.
+ */
+int crc32c_hw_supported(void) {
+    __builtin_cpu_init();
+
+    return __builtin_cpu_supports("sse4.2") != 0;
+}
+
+/**
+ * Update the unfinished CRC crc with the n bytes at data like crc32c_sw(),
+ * with the CRC32 instruction of SSE4.2, eight bytes at a time where the
+ * instruction takes them.
+ */
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(uint32_t crc, const unsigned char* data, size_t n) {
+    size_t i = 0;
+
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+#endif
+
+    for (; i + 4 <= n; i += 4) {
+        uint32_t word;
+        memcpy(&word, data + i, 4);
+        crc = _mm_crc32_u32(crc, word);
+    }
+
+    for (; i < n; i++)
+        crc = _mm_crc32_u8(crc, data[i]);
+
+    return crc;
+}
+
+#else
+
+/**
+ * Return 1 if the CPU supports crc32c_hw(). Otherwise, return 0.
+ */
+int crc32c_hw_supported(void) {
+    return 0;
+}
+
+/**
+ * Without CRC instructions on this platform, update crc with crc32c_sw().
+ */
+uint32_t crc32c_hw(uint32_t crc, const unsigned char* data, size_t n) {
+    return crc32c_sw(crc, data, n);
+}
+
+#endif
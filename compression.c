@@ -1,245 +1,933 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
 #include "huff.h"
 
-void output_description(void);
-void postorder_seq(NODE* root, char* buffer, int* bit_num);
-void output_symbols(NODE* root);
-void set_parents(NODE* root);
+/**
+ * An entry of the heap used by build_huffman_tree() packs the weight of a
+ * node, the position of its leftmost leaf (key), and its number in the tree
+ * into one integer, so that entries order by weight, then by key.
+ */
+#define HEAP_ENTRY(weight, key, index) ((uint64_t) (weight) << 20 | (uint64_t) (key) << 10 | (index))
+#define HEAP_WEIGHT(entry) ((entry) >> 20)
+#define HEAP_KEY(entry) ((int) ((entry) >> 10) & 0x3FF)
+#define HEAP_INDEX(entry) ((int) (entry) & 0x3FF)
+
+/**
+ * Adaptive blocks grow by segments of SPLIT_SEGMENT_SIZE bytes. A segment
+ * starts a new block when coding it with its own code, at the cost of
+ * SPLIT_BLOCK_BITS more bits for the frame and padding of another block, is
+ * estimated to take less than coding it along with the block. Estimates charge
+ * HEADER_BITS_PER_SYMBOL bits of block header for each symbol that occurs.
+ */
+#define SPLIT_SEGMENT_SIZE 4096
+#define SPLIT_BLOCK_BITS 128
+#define HEADER_BITS_PER_SYMBOL 6
+
+/**
+ * A stream is encoded by several threads only if each of them gets a chunk of
+ * at least ENCODE_CHUNK_SIZE symbols, so that encoding the chunk outweighs
+ * starting the thread and counting the symbols of the chunk beforehand.
+ */
+#define ENCODE_CHUNK_SIZE (256 * 1024)
+
+/**
+ * Bits written to output, most significant bit first. Up to 32 bits not yet
+ * written are held in the low bits of bits.
+ */
+typedef struct bit_writer {
+    unsigned char* output;
+    size_t len; // Number of bytes written to output
+    uint64_t bits;
+    int count; // Number of bits in bits not yet written
+} BIT_WRITER;
+
+/**
+ * One chunk of a stream encoded by encode_stream_parallel(): its symbols, the
+ * number of bits they take, and where those bits start in the stream. The
+ * bits of the last incomplete byte of a chunk other than the last are kept
+ * in tail, since the next chunk writes the rest of that byte.
+ */
+typedef struct encode_chunk {
+    const CODE_ENTRY* code_table;
+    const unsigned char* symbols;
+    size_t num_symbols;
+    int end_block; // Indicator for whether the end block symbol follows the chunk
+    int last; // Indicator for whether the chunk ends the stream
+    uint64_t num_bits;
+    uint64_t offset; // Bit offset of the chunk in the stream
+    unsigned char* output; // Start of the stream
+    unsigned char tail;
+} ENCODE_CHUNK;
+
+void heap_push(uint64_t* heap, int* heap_size, uint64_t entry);
+uint64_t heap_pop(uint64_t* heap, int* heap_size);
+void package_merge(const int* weights, int num_leaves, int max_length, int* lengths);
+void build_canonical_tree(ENCODER* enc, const short* symbols, const int* lengths, int num_leaves);
+size_t postorder_seq(const TREE* tree, unsigned char* output);
+size_t output_symbols(const TREE* tree, unsigned char* output);
+void assign_codes(ENCODER* enc);
+size_t output_header(ENCODER* enc, unsigned char* output);
+size_t encode_symbols(const CODE_ENTRY* code_table, int num_streams, int num_threads, const unsigned char* block,
+                      int num_symbols, unsigned char* output);
+size_t encode_stream(const CODE_ENTRY* code_table, const unsigned char* symbols, size_t num_symbols, int end_block,
+                     unsigned char* output);
+size_t encode_stream_parallel(const CODE_ENTRY* code_table, const unsigned char* symbols, size_t num_symbols,
+                              int end_block, int num_threads, unsigned char* output);
+size_t encode_bits(const CODE_ENTRY* code_table, const unsigned char* symbols, size_t num_symbols, int end_block,
+                   int skip, unsigned char* output, unsigned char* tail);
+void run_chunks(void* (*func)(void*), ENCODE_CHUNK* chunks, int num_chunks);
+void* count_chunk_bits(void* arg);
+void* encode_chunk(void* arg);
+void put_bits(BIT_WRITER* writer, uint32_t value, int num_bits);
+int read_block(SOURCE* source, unsigned char* block, int block_size);
+int find_block_end(const unsigned char* block, int num_symbols);
+double estimate_block_bits(const uint32_t* counts, int num_symbols);
+double estimate_header_bits(const uint32_t* counts);
+void choose_block_type(COMPRESS_STATE* state, JOB* job);
+int longest_code(const ENCODER* enc);
+void* new_encoder(void* arg);
 
 /**
- * Read data from standard input, compress the data, and write the compressed
- * data to standard output.
+ * Read data from source, compress the data, and write the compressed data to
+ * sink, using the options of ctx.
+ *
+ * If ctx->num_threads is greater than one, blocks are read ahead and
+ * compressed by that many threads. If ctx->pipelined is nonzero, blocks are
+ * also read on a thread of their own, even with one compressing thread, so
+ * that reading, compressing, and writing overlap. The compressed blocks are
+ * still written in the order of the input, so the output is the same as when
+ * compressing serially. Otherwise, blocks are compressed on the calling
+ * thread with the encoder and buffers of ctx.
+ *
+ * Data in memory that holds fewer blocks than there are threads would leave
+ * threads without a block, so the threads are shared out among the blocks
+ * instead, and each block is encoded on its share of them. Data in memory
+ * that is a single block is compressed on the calling thread, with only its
+ * encoding spread over the threads.
+ *
+ * If ctx->dynamic is nonzero, the data is compressed to the dynamic format
+ * instead, which has no blocks.
+ *
+ * Data in memory compressed with a table may instead become a message (see
+ * compress_message()).
  *
  * Return 0 if compressing succeeds without error. Otherwise, return -1.
  */
-int compress(void) {
-    int ret;
+int compress_stream(huff_ctx* ctx, SOURCE* source, SINK* sink) {
+    COMPRESS_STATE state;
+    PIPELINE pipeline = {
+        .arg = &state,
+        .read_job = read_block_job,
+        .new_worker = new_encoder,
+        .process_job = compress_block_job,
+        .write_job = write_job,
+        .input_size = ctx->block_size,
+        .output_size = COMPRESS_BLOCK_BOUND(ctx->block_size),
+        .table_size = 2 * 256 * sizeof(uint32_t),
+        .reader_thread = ctx->pipelined
+    };
+    int num_threads = ctx->num_threads; // Threads compressing blocks
+    int ret = 0;
 
-    while (!feof(stdin)) {
-        ret = compress_block();
+    if (ctx->dynamic)
+        return compress_dynamic(ctx, source, sink);
 
-        // Return -1 if error with compression
-        if (ret == -1)
-            return -1;
+    // compress_message() returns 1 if the data is not to be a message
+    ret = compress_message(ctx, source, sink);
+    if (ret != 1)
+        return (sink_flush(sink) == -1) ? -1 : ret;
+    ret = 0;
+
+    if (compress_begin(ctx, &state, source, sink) == -1)
+        return -1;
+    stats_begin(&state.report, ctx, 1);
+
+    // Adaptive blocks may be shorter, so their number is only a lower bound
+    if (source->type == SOURCE_MEMORY && num_threads > 1) {
+        size_t num_blocks = (source->len - source->pos + state.block_size - 1) / state.block_size;
+
+        if (num_blocks < (size_t) num_threads) {
+            num_threads = (num_blocks > 1) ? (int) num_blocks : 1;
+            state.encode_threads = ctx->num_threads / num_threads;
+        }
+    }
+
+    if (num_threads > 1 || ctx->pipelined) {
+        ret = run_pipeline(&pipeline, num_threads);
+    } else if (ctx_reserve(ctx, pipeline.input_size, pipeline.output_size) == -1) {
+        ret = -1;
+    } else {
+        uint32_t table[2 * 256];
+        JOB job = {.input = ctx->input, .output = ctx->output, .table = (unsigned char*) table};
+
+        init_encoder(ctx->enc, &state);
+
+        // Run the stages of the pipeline one after another on this thread
+        while (ret == 0) {
+            ret = read_block_job(&job, &state);
+            if (ret != 0)
+                break;
+
+            if (compress_block_job(&job, ctx->enc) == -1 || write_job(&job, &state) == -1)
+                ret = -1;
+        }
+
+        // read_block_job() returns 1 at the end of the input
+        if (ret == 1)
+            ret = 0;
+    }
+
+    if (ret == 0 && compress_finish(&state) == -1)
+        ret = -1;
+    if (ret == 0)
+        stats_end(&state.report);
+
+    free(state.index.lengths);
+    free(state.carry);
+
+    if (sink_flush(sink) == -1)
+        return -1;
+
+    return ret;
+}
+
+/**
+ * Compress the data of source, which is in memory, to sink as a message if
+ * ctx has a table and the data is short enough to make a single block, and
+ * the message is estimated to be smaller than the framed stream would be.
+ * The framed stream is estimated to take the bits of the cheapest type of its
+ * block, as choose_block_type() estimates them, and the 45 bytes around the
+ * block. A message has neither checksums nor streams, so it is not used if
+ * ctx asks for them. The symbols are encoded on up to ctx->num_threads
+ * threads.
+ *
+ * Return 0 if the message is written without error, 1 if the data is not to
+ * be a message, which leaves source and sink as they were. Otherwise, return
+ * -1.
+ */
+int compress_message(huff_ctx* ctx, SOURCE* source, SINK* sink) {
+    const STATIC_TABLE* table = ctx->table;
+    BLOCK_STATS block_stats = {.type = BLOCK_STATIC};
+    BLOCK_STATS* stats = (ctx->stats_out != NULL) ? &block_stats : NULL;
+    uint32_t counts[256];
+    uint64_t static_bits;
+
+    if (source->type != SOURCE_MEMORY || table == NULL || table->lengths[256] == 0 || ctx->checksums ||
+        ctx->num_streams > 1)
+        return 1;
+
+    const unsigned char* data = source->data + source->pos;
+    size_t n = source->len - source->pos;
+
+    if (n == 0 || n > (size_t) ctx->block_size)
+        return 1;
+
+    uint64_t start = TIMER_START(stats);
+    histogram(data, n, counts);
+    static_bits = table->code_table[256].length;
+
+    // A symbol without a code in the table keeps the data from being a message
+    for (int symbol = 0; symbol < 256; symbol++) {
+        if (counts[symbol] != 0 && table->lengths[symbol] == 0)
+            return 1;
+        static_bits += (uint64_t) counts[symbol] * table->lengths[symbol];
+    }
+
+    double block_bits = entropy_bits(counts, n) + estimate_header_bits(counts);
+    if (block_bits > 8.0 * n)
+        block_bits = 8.0 * n;
+    if (block_bits > static_bits)
+        block_bits = static_bits;
 
-        // Reset num_nodes
-        num_nodes = 0;
+    size_t compressed_len = (static_bits + 7) / 8;
+    unsigned char header[MESSAGE_MAX_HEADER_SIZE];
+    size_t header_len = put_message_header(header, table->id, n, compressed_len);
+    size_t framed_len = FILE_HEADER_SIZE + 2 * FRAME_HEADER_SIZE + 1 + 4 + TRAILER_SIZE;
 
-        // Reset current_block array
-        for (int i = 0; i < MAX_BLOCK_SIZE; i++)
-            current_block[i] = 0;
+    if (8.0 * (header_len + compressed_len) >= block_bits + 8.0 * framed_len)
+        return 1;
+    TIMER_STOP(stats, TIMER_HISTOGRAM, start);
 
-        // Reset nodes array
-        NODE empty_node = {.left = NULL, .right = NULL, .parent = NULL, .weight = 0, .symbol = 0};
-        for (int i = 0; i < 2 * MAX_SYMBOLS - 1; i++)
-            nodes[i] = empty_node;
+    if (ctx_reserve(ctx, 0, compressed_len) == -1)
+        return -1;
+
+    start = TIMER_START(stats);
+    if (encode_symbols(table->code_table, 1, ctx->num_threads, data, n, ctx->output) != compressed_len)
+        return -1;
+    TIMER_STOP(stats, TIMER_ENCODE, start);
+
+    start = TIMER_START(stats);
+    if (sink_write(sink, header, header_len) == -1 || sink_write(sink, ctx->output, compressed_len) == -1)
+        return -1;
+    TIMER_STOP(stats, TIMER_IO, start);
+
+    source->pos += n;
+
+    if (stats != NULL) {
+        STATS_REPORT report;
 
-        // Reset node_for_symbol array
-        for (int i = 0; i < MAX_SYMBOLS; i++)
-            node_for_symbol[i] = NULL;
+        stats_begin(&report, ctx, 1);
+        stats->max_length = table->dec.max_length;
+        stats_symbols(stats, counts, n);
+        stats_block(&report, stats, n, header_len + compressed_len);
+        stats_end(&report);
     }
 
-    fflush(stdout);
+    return 0;
+}
+
+/**
+ * Set up state to compress data from source to sink with the options of ctx,
+ * and write the file header of the framed format to sink. The index and carry
+ * buffer of state are freed by the caller.
+ *
+ * Return 0 if the header is written without error. Otherwise, return -1.
+ */
+int compress_begin(huff_ctx* ctx, COMPRESS_STATE* state, SOURCE* source, SINK* sink) {
+    if (init_compress_state(ctx, state) == -1)
+        return -1;
+
+    state->source = source;
+    state->sink = sink;
+
+    if (write_file_header(state) == -1) {
+        free(state->carry);
+        state->carry = NULL;
+        return -1;
+    }
 
     return 0;
 }
 
 /**
- * Read one block of data from standard input, compress the data, and output
- * the compressed data to standard output.
+ * Set up state with the options of ctx, with no source or sink yet, and
+ * allocate its carry buffer if blocks are adaptive.
  *
- * Typically, the specified block size is read. The only time compress_block()
- * reads less than the specified block size is when EOF is reached before being
- * able to read a full-sized block. The specified block size is logged in the
- * 16 most significant bits of the global_options variable.
+ * Return 0 if the carry buffer is allocated or not needed. Otherwise, return
+ * -1.
+ */
+int init_compress_state(huff_ctx* ctx, COMPRESS_STATE* state) {
+    *state = (COMPRESS_STATE) {
+        .block_size = ctx->block_size,
+        .framed = ctx_framed(ctx),
+        .max_code_length = ctx->max_code_length,
+        .canonical = ctx_framed(ctx) && ctx->canonical,
+        .num_streams = ctx_framed(ctx) ? ctx->num_streams : 1,
+        .adaptive = ctx->adaptive,
+        .checksums = ctx_framed(ctx) && ctx->checksums,
+        .encode_threads = 1,
+        .static_table = ctx->table,
+        .table_id = -1
+    };
+
+    if (state->adaptive) {
+        state->carry = malloc(state->block_size);
+        if (state->carry == NULL)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Write the file header of the framed format to the sink of state, which only
+ * has the ID of a table if there is one, or nothing in the original format.
  *
- * Return 0 if the block is compressed without error. Otherwise, return -1;
+ * Return 0 if the header is written without error. Otherwise, return -1.
  */
-int compress_block(void) {
-    int block_size = ((global_options >> 16) & 0xffff) + 1;
-    int num_symbols = 0; // Current number of symbols in current_block
-    int num_leaves = 0; // Current number of leaves in nodes array
+int write_file_header(const COMPRESS_STATE* state) {
+    if (!state->framed)
+        return 0;
 
-    // Read a block of input data; record the symbols in the current block and
-    // the number of times a symbol occurs in the input
-    for (int i = 0; i < block_size; i++) {
-        int symbol_val = fgetc(stdin);
+    int has_table = (state->static_table != NULL);
+    unsigned char header[FILE_HEADER_SIZE] = {FRAME_MAGIC[0], FRAME_MAGIC[1], FRAME_MAGIC[2],
+                                              has_table ? FRAME_VERSION : FRAME_VERSION_WITHOUT_TABLE,
+                                              state->max_code_length,
+                                              state->canonical ? HEADER_CANONICAL : HEADER_TREE,
+                                              state->num_streams,
+                                              state->checksums ? FRAME_FLAG_CHECKSUMS : 0};
+    put_u32(header + 8, state->block_size);
+    if (has_table)
+        put_u32(header + FILE_HEADER_V4_SIZE, state->static_table->id);
 
-        if (symbol_val == EOF) {
-            // Return -1 if error indicator associated with stdin is set
-            if (ferror(stdin))
-                return -1;
+    return sink_write(state->sink, header, has_table ? FILE_HEADER_SIZE : FILE_HEADER_V4_SIZE);
+}
 
-            // Return -1 if block of data is empty
-            if (i == 0)
-                return 0;
+/**
+ * Write the end of the compressed data to the sink of state once every block
+ * is written: the index of the framed format, or nothing in the original
+ * format.
+ *
+ * Return 0 if the index is written without error. Otherwise, return -1.
+ */
+int compress_finish(COMPRESS_STATE* state) {
+    return state->framed ? write_index(&state->index, state->sink) : 0;
+}
 
-            // End of file is reached and block has data in it
-            break;
-        }
+/**
+ * Read one block of data from source into block.
+ *
+ * Typically, the specified block size is read. The only time read_block()
+ * reads less than the specified block size is when the end of the source is
+ * reached before being able to read a full-sized block.
+ *
+ * Return the number of bytes read, which is 0 if there is nothing left to
+ * compress, or -1 if reading from source fails.
+ */
+int read_block(SOURCE* source, unsigned char* block, int block_size) {
+    int num_symbols = source_read(source, block, block_size);
 
-        // Read byte from standard input and insert into current_block
-        current_block[num_symbols] = symbol_val;
-        num_symbols++;
-
-        // Add new byte or update frequency of byte in histogram
-        if (node_for_symbol[symbol_val] == NULL) {
-            node_for_symbol[symbol_val] = nodes + num_leaves;
-            nodes[num_leaves].parent = NULL;
-            nodes[num_leaves].left = NULL;
-            nodes[num_leaves].right = NULL;
-            nodes[num_leaves].weight = 1;
-            nodes[num_leaves].symbol = symbol_val;
-            num_leaves++;
-        } else {
-            node_for_symbol[symbol_val]->weight++;
-        }
+    if (source_error(source))
+        return -1;
+
+    return num_symbols;
+}
+
+/**
+ * Compress the num_symbols symbols of block into output using the Huffman
+ * tree and code table of enc, starting with the header that describes them.
+ * This is how blocks of the original format are compressed; blocks of the
+ * framed format get their type and code from read_block_job() instead. output
+ * must have room for COMPRESS_BLOCK_BOUND(num_symbols) bytes.
+ *
+ * Return the number of bytes written to output.
+ */
+size_t compress_block(ENCODER* enc, const unsigned char* block, int num_symbols, unsigned char* output) {
+    BLOCK_STATS* stats = enc->stats;
+    uint32_t counts[256];
+
+    // Record the number of times a symbol occurs in the block
+    uint64_t start = TIMER_START(stats);
+    histogram(block, num_symbols, counts);
+    TIMER_STOP(stats, TIMER_HISTOGRAM, start);
+
+    start = TIMER_START(stats);
+    build_code(enc, counts);
+    TIMER_STOP(stats, TIMER_TREE, start);
+
+    start = TIMER_START(stats);
+    size_t output_len = output_header(enc, output);
+    size_t header_len = output_len;
+    output_len += encode_symbols(enc->code_table, enc->num_streams, enc->encode_threads, block, num_symbols,
+                                 output + output_len);
+    TIMER_STOP(stats, TIMER_ENCODE, start);
+
+    if (stats != NULL) {
+        stats->type = BLOCK_HUFFMAN;
+        stats->header_len = header_len;
+        stats->max_length = longest_code(enc);
+        stats_symbols(stats, counts, num_symbols);
+    }
+
+    return output_len;
+}
+
+/**
+ * Return the length of the longest code of enc, counting the end block code.
+ */
+int longest_code(const ENCODER* enc) {
+    int max_length = 0;
+
+    for (int symbol = 0; symbol < MAX_SYMBOLS; symbol++) {
+        if (enc->leaf_for_symbol[symbol] >= 0 && enc->code_table[symbol].length > max_length)
+            max_length = enc->code_table[symbol].length;
+    }
+
+    return max_length;
+}
+
+/**
+ * Build in enc the Huffman tree and code table of the symbols counted in
+ * counts and the end block symbol. No code is longer than
+ * enc->max_code_length bits if that is nonzero, or MAX_CODE_BITS bits. If
+ * enc->canonical is nonzero, the codes are the canonical codes of their
+ * lengths.
+ */
+void build_code(ENCODER* enc, const uint32_t* counts) {
+    TREE* tree = &enc->tree;
+    uint32_t weights[MAX_SYMBOLS]; // Weight of each leaf
+    int num_leaves = 0; // Current number of leaves in the tree
+
+    // Add a leaf for every symbol that occurs, in order of symbol value
+    for (int symbol_val = 0; symbol_val < 256; symbol_val++) {
+        enc->leaf_for_symbol[symbol_val] = -1;
+        if (counts[symbol_val] == 0)
+            continue;
+
+        tree->symbol[num_leaves] = symbol_val;
+        weights[num_leaves] = counts[symbol_val];
+        num_leaves++;
     }
 
     // Add end block "symbol"
-    node_for_symbol[256] = nodes + num_leaves;
-    nodes[num_leaves].parent = NULL;
-    nodes[num_leaves].left = NULL;
-    nodes[num_leaves].right = NULL;
-    nodes[num_leaves].weight = 0;
-    nodes[num_leaves].symbol = 256;
+    tree->symbol[num_leaves] = 256;
+    weights[num_leaves] = 0;
     num_leaves++;
 
-    num_nodes = 2 * num_leaves - 1; // Total number of nodes in Huffman tree
-
-    // Algorithm to build Huffman tree
-    for (int low = num_leaves, high = num_nodes; low > 1; low--, high -= 2) {
-        NODE *min_node_1 = NULL, *min_node_2 = NULL;
-        int min_1 = INT_MAX, min_2 = INT_MAX;
-        int min_index_1 = -1, min_index_2 = -1;
-
-        // Select two minimum-weight nodes
-        for (int i = 0; i < low; i++) {
-            if ((nodes + i)->weight < min_1) {
-                min_node_2 = min_node_1;
-                min_2 = min_1;
-                min_index_2 = min_index_1;
-                min_node_1 = nodes + i;
-                min_1 = (nodes + i)->weight;
-                min_index_1 = i;
-            } else if ((nodes + i)->weight < min_2) {
-                min_node_2 = nodes + i;
-                min_2 = (nodes + i)->weight;
-                min_index_2 = i;
-            }
+    // Build the Huffman tree over the leaves
+    build_huffman_tree(enc, weights, num_leaves);
+
+    // Derive the code of every symbol in the block from the Huffman tree
+    assign_codes(enc);
+
+    // Replace the tree if any code is longer than the limit, or than
+    // MAX_CODE_BITS if there is none
+    int max_length = (enc->max_code_length != 0) ? enc->max_code_length : MAX_CODE_BITS;
+    for (int i = num_leaves - 1; i < tree->num_nodes; i++) {
+        if (enc->code_table[tree->symbol[i]].length > max_length) {
+            limit_code_lengths(enc, weights, num_leaves, max_length);
+            assign_codes(enc);
+            break;
         }
+    }
 
-        // Move two selected minimum-weight nodes to high-end of array
-        nodes[high - 1] = *min_node_2;
-        nodes[high - 2] = *min_node_1;
+    if (enc->canonical)
+        assign_canonical_codes(enc);
+}
 
-        int min_index; // Leftmost position of the two minimum-weight nodes
-        min_index = (min_index_1 < min_index_2) ? min_index_1 : min_index_2;
+/**
+ * Write the header of a block coded with the code of enc to output: the
+ * description of the Huffman tree, or only the code lengths if
+ * enc->canonical is nonzero.
+ *
+ * Return the number of bytes written to output.
+ */
+size_t output_header(ENCODER* enc, unsigned char* output) {
+    return enc->canonical ? output_code_lengths(enc, output) : output_description(enc, output);
+}
 
-        // Construct parent node at nodes[minIndex]
-        nodes[min_index].parent = NULL;
-        nodes[min_index].left = nodes + high - 2;
-        nodes[min_index].right = nodes + high - 1;
-        nodes[min_index].weight = (nodes + high - 2)->weight + (nodes + high - 1)->weight;
-        nodes[min_index].symbol = -1;
+/**
+ * Encode the num_symbols symbols of block with code_table into output, as one
+ * stream ended by the end block symbol, or if num_streams is greater than
+ * one, as that many streams after a jump table. Each stream is encoded on up
+ * to num_threads threads.
+ *
+ * Return the number of bytes written to output.
+ */
+size_t encode_symbols(const CODE_ENTRY* code_table, int num_streams, int num_threads, const unsigned char* block,
+                      int num_symbols, unsigned char* output) {
+    if (num_streams == 1)
+        return encode_stream_parallel(code_table, block, num_symbols, 1, num_threads, output);
+
+    // Output each stream after the jump table of the lengths of all but the
+    // last stream
+    int segment = num_symbols / num_streams;
+    size_t output_len = 4 * (num_streams - 1);
+
+    for (int k = 0; k < num_streams; k++) {
+        int len = (k < num_streams - 1) ? segment : num_symbols - k * segment;
+        size_t stream_len = encode_stream_parallel(code_table, block + k * segment, len, 0, num_threads,
+                                                   output + output_len);
 
-        // Shift low-end of array to the left to maintain contiguity
-        for (int i = (min_index_1 > min_index_2) ? min_index_1 : min_index_2; i < low - 1; i++)
-            nodes[i] = nodes[i + 1];
+        if (k < num_streams - 1)
+            put_u32(output + 4 * k, stream_len);
+        output_len += stream_len;
     }
 
-    // Output the description of the Huffman tree
-    output_description();
+    return output_len;
+}
 
-    // Set parent pointer for each non-root node in Huffman tree
-    set_parents(nodes);
+/**
+ * Encode the num_symbols symbols with code_table into output, followed by the
+ * end block symbol if end_block is nonzero, and pad the bitstream to a whole
+ * byte.
+ *
+ * Return the number of bytes written to output.
+ */
+size_t encode_stream(const CODE_ENTRY* code_table, const unsigned char* symbols, size_t num_symbols, int end_block,
+                     unsigned char* output) {
+    return encode_bits(code_table, symbols, num_symbols, end_block, 0, output, NULL);
+}
 
-    // Install pointers to leaf nodes
-    for (int i = 0; i < num_nodes; i++) {
-        if ((nodes + i)->left == NULL && (nodes + i)->right == NULL)
-            node_for_symbol[(nodes + i)->symbol] = nodes + i;
+/**
+ * Encode the num_symbols symbols with code_table into output like
+ * encode_stream(), except on up to num_threads threads if the stream is long
+ * enough to give each of them ENCODE_CHUNK_SIZE symbols.
+ *
+ * The bit at which the code of each chunk of the symbols starts depends on the
+ * codes of every symbol before it. The threads therefore first count the bits
+ * of their chunks from their histograms, and the prefix sums of those counts
+ * give the offset of each chunk. Each thread then encodes its chunk straight
+ * into its place in output, starting partway into the byte where the previous
+ * chunk ends. That byte is written by the later chunk, with the bits of the
+ * earlier one merged into it afterward, so the stream is identical to the one
+ * encode_stream() writes.
+ *
+ * Return the number of bytes written to output.
+ */
+size_t encode_stream_parallel(const CODE_ENTRY* code_table, const unsigned char* symbols, size_t num_symbols,
+                              int end_block, int num_threads, unsigned char* output) {
+    ENCODE_CHUNK chunks[MAX_THREADS];
+    size_t max_chunks = num_symbols / ENCODE_CHUNK_SIZE;
+    int num_chunks = ((size_t) num_threads < max_chunks) ? num_threads : (int) max_chunks;
+
+    if (num_chunks <= 1)
+        return encode_stream(code_table, symbols, num_symbols, end_block, output);
+
+    for (int k = 0; k < num_chunks; k++) {
+        size_t start = num_symbols * k / num_chunks;
+        size_t end = num_symbols * (k + 1) / num_chunks;
+
+        chunks[k] = (ENCODE_CHUNK) {
+            .code_table = code_table,
+            .symbols = symbols + start,
+            .num_symbols = end - start,
+            .end_block = (k == num_chunks - 1) && end_block,
+            .last = (k == num_chunks - 1),
+            .output = output
+        };
+    }
+
+    run_chunks(count_chunk_bits, chunks, num_chunks);
+
+    uint64_t num_bits = 0;
+    for (int k = 0; k < num_chunks; k++) {
+        chunks[k].offset = num_bits;
+        num_bits += chunks[k].num_bits;
     }
 
-    // Output encoded bit sequence
-    char buffer = 0; // Buffer to use in outputting bit sequence
-    int bit_num = 7; // Counter to track bit position in buffer
-    for (int i = 0; i < num_symbols; i++) {
-        // Acquire leaf corresponding to symbol at current_block[i]
-        NODE* leaf = node_for_symbol[current_block[i]];
-        NODE* child_ptr = leaf;
-        NODE* parent_ptr = child_ptr->parent;
+    run_chunks(encode_chunk, chunks, num_chunks);
 
-        // Store directions using "weight" field
-        while (parent_ptr != NULL) {
-            parent_ptr->weight = (parent_ptr->left == child_ptr) ? 0 : 1;
-            parent_ptr = parent_ptr->parent;
-            child_ptr = child_ptr->parent;
+    // Merge the bits of each chunk that end partway into a byte with the bits
+    // of the next chunk in that byte
+    for (int k = 1; k < num_chunks; k++) {
+        if (chunks[k].offset % 8 != 0)
+            output[chunks[k].offset / 8] |= chunks[k - 1].tail;
+    }
+
+    return (num_bits + 7) / 8;
+}
+
+/**
+ * Run func on each of the num_chunks chunks at chunks, one thread per chunk,
+ * the first on the calling thread. A chunk whose thread cannot be started is
+ * run on the calling thread as well.
+ */
+void run_chunks(void* (*func)(void*), ENCODE_CHUNK* chunks, int num_chunks) {
+    pthread_t threads[MAX_THREADS];
+    int started[MAX_THREADS];
+
+    for (int k = 1; k < num_chunks; k++)
+        started[k] = (pthread_create(threads + k, NULL, func, chunks + k) == 0);
+
+    func(chunks);
+
+    for (int k = 1; k < num_chunks; k++) {
+        if (started[k])
+            pthread_join(threads[k], NULL);
+        else
+            func(chunks + k);
+    }
+}
+
+/**
+ * Store in the ENCODE_CHUNK that arg points to the number of bits its
+ * symbols take, counted from their histogram.
+ */
+void* count_chunk_bits(void* arg) {
+    ENCODE_CHUNK* chunk = arg;
+    uint32_t counts[256];
+
+    histogram(chunk->symbols, chunk->num_symbols, counts);
+
+    chunk->num_bits = chunk->end_block ? chunk->code_table[256].length : 0;
+    for (int symbol = 0; symbol < 256; symbol++)
+        chunk->num_bits += (uint64_t) counts[symbol] * chunk->code_table[symbol].length;
+
+    return NULL;
+}
+
+/**
+ * Encode the ENCODE_CHUNK that arg points to at its offset in the stream.
+ */
+void* encode_chunk(void* arg) {
+    ENCODE_CHUNK* chunk = arg;
+
+    encode_bits(chunk->code_table, chunk->symbols, chunk->num_symbols, chunk->end_block, chunk->offset % 8,
+                chunk->output + chunk->offset / 8, chunk->last ? NULL : &chunk->tail);
+
+    return NULL;
+}
+
+/**
+ * Encode the num_symbols symbols with code_table into output, followed by the
+ * end block symbol if end_block is nonzero, starting skip bits into the first
+ * byte, whose first skip bits are 0. If tail is NULL, the bitstream is padded
+ * to a whole byte. Otherwise, an incomplete last byte is stored in tail,
+ * padded likewise, instead of being written.
+ *
+ * Return the number of bytes written to output.
+ */
+size_t encode_bits(const CODE_ENTRY* code_table, const unsigned char* symbols, size_t num_symbols, int end_block,
+                   int skip, unsigned char* output, unsigned char* tail) {
+    size_t output_len = 0;
+
+    // Output encoded bit sequence. Codes are accumulated in the low bits of
+    // bits and written out 32 bits at a time, most significant bit first.
+    uint64_t bits = 0;
+    int count = skip; // Number of bits in bits not yet written
+    for (size_t i = 0; i < num_symbols + (end_block != 0); i++) {
+        // The "end block" symbol follows the symbols of the block
+        CODE_ENTRY entry = code_table[(i < num_symbols) ? symbols[i] : 256];
+
+        bits = (bits << entry.length) | entry.code;
+        count += entry.length;
+
+        if (count >= 32) {
+            count -= 32;
+            uint32_t word = bits >> count;
+            output[output_len++] = word >> 24;
+            output[output_len++] = word >> 16;
+            output[output_len++] = word >> 8;
+            output[output_len++] = word;
         }
+    }
 
-        // Output code for the corresponding symbol
-        NODE* ptr = nodes;
-        while (ptr != leaf) {
-            if (ptr->weight == 1) {
-                buffer |= 1 << bit_num;
-                ptr = ptr->right;
-            } else {
-                ptr = ptr->left;
-            }
+    for (; count >= 8; count -= 8)
+        output[output_len++] = bits >> (count - 8);
+
+    // Additional padding if encoded sequence length is not multiple of 8 bits
+    if (count > 0) {
+        if (tail != NULL)
+            *tail = bits << (8 - count);
+        else
+            output[output_len++] = bits << (8 - count);
+    }
+
+    return output_len;
+}
+
+/**
+ * Build the Huffman tree over the num_leaves leaves at the front of
+ * enc->tree, the weight of each being the one at the same index of weights.
+ * The leaves are moved to the high end of the tree and the internal nodes are
+ * created below them, the root last at node 0.
+ *
+ * The two minimum-weight nodes are taken from a binary heap, so building the
+ * tree takes O(n log n) time for n leaves. Of two nodes with equal weights,
+ * the one whose leftmost leaf was added first is taken first and becomes the
+ * left child, so the tree is the same as the one built by rescanning the
+ * nodes for the two minimums before every merge.
+ */
+void build_huffman_tree(ENCODER* enc, const uint32_t* weights, int num_leaves) {
+    TREE* tree = &enc->tree;
+    uint64_t heap[MAX_SYMBOLS]; // HEAP_ENTRY of each node without a parent
+    int heap_size = 0;
+
+    tree->num_nodes = 2 * num_leaves - 1; // Total number of nodes in Huffman tree
+
+    // Move the leaves to the high end of the tree
+    memmove(tree->symbol + num_leaves - 1, tree->symbol, num_leaves * sizeof(tree->symbol[0]));
+    for (int i = 0; i < num_leaves; i++) {
+        tree->child[num_leaves - 1 + i][0] = 0;
+        tree->child[num_leaves - 1 + i][1] = 0;
+        heap_push(heap, &heap_size, HEAP_ENTRY(weights[i], i, num_leaves - 1 + i));
+    }
+
+    // Merge the two minimum-weight nodes until only the root is left
+    for (int next = num_leaves - 2; next >= 0; next--) {
+        uint64_t left = heap_pop(heap, &heap_size);
+        uint64_t right = heap_pop(heap, &heap_size);
+
+        tree->child[next][0] = HEAP_INDEX(left);
+        tree->child[next][1] = HEAP_INDEX(right);
+        tree->symbol[next] = -1;
+
+        // The leftmost leaf of the new node is the leftmost of its children
+        int key = (HEAP_KEY(left) < HEAP_KEY(right)) ? HEAP_KEY(left) : HEAP_KEY(right);
+        heap_push(heap, &heap_size, HEAP_ENTRY(HEAP_WEIGHT(left) + HEAP_WEIGHT(right), key, next));
+    }
+}
+
+/**
+ * Replace the Huffman tree built by build_huffman_tree() over num_leaves
+ * leaves of the given weights with a tree whose codes are no longer than
+ * max_length bits. The code lengths are the optimal ones within the limit,
+ * found by package_merge(), and the tree is the canonical tree for those
+ * lengths.
+ */
+void limit_code_lengths(ENCODER* enc, const uint32_t* leaf_weights, int num_leaves, int max_length) {
+    const short* leaf_symbols = enc->tree.symbol + num_leaves - 1;
+    short symbols[MAX_SYMBOLS];
+    int weights[MAX_SYMBOLS];
+    int lengths[MAX_SYMBOLS];
+
+    // Order the leaves by weight, keeping the order of leaves of equal weight
+    for (int i = 0; i < num_leaves; i++) {
+        int j = i;
+        while (j > 0 && (uint32_t) weights[j - 1] > leaf_weights[i]) {
+            symbols[j] = symbols[j - 1];
+            weights[j] = weights[j - 1];
+            j--;
+        }
+        symbols[j] = leaf_symbols[i];
+        weights[j] = leaf_weights[i];
+    }
+
+    package_merge(weights, num_leaves, max_length, lengths);
+    build_canonical_tree(enc, symbols, lengths, num_leaves);
+}
+
+/**
+ * Compute optimal code lengths of at most max_length bits for num_leaves
+ * symbols with the given weights, which are in nondecreasing order, and store
+ * them in lengths. 2^max_length must be at least num_leaves.
+ *
+ * The package-merge algorithm keeps a list per code length, from max_length
+ * up to 1. The list of a length merges the leaves with packages, the sums of
+ * consecutive pairs of items of the list below it, in order of weight. The
+ * 2 * num_leaves - 2 smallest items of the list of length 1 select the
+ * codes: each leaf selected in a list gets one bit longer, and each package
+ * selected selects its pair in the list below. Since the lists are sorted,
+ * the leaves selected in a list are always the lightest ones.
+ */
+void package_merge(const int* weights, int num_leaves, int max_length, int* lengths) {
+    unsigned char is_package[MAX_CODE_BITS][2 * MAX_SYMBOLS];
+    uint64_t items[2][2 * MAX_SYMBOLS]; // Weights of the current and previous lists
+    int prev_len = 0;
 
-            if (bit_num == 0) {
-                fputc(buffer & 0xFF, stdout);
-                bit_num = 7;
-                buffer = 0;
+    // Build the lists from the longest code length to the shortest
+    for (int level = max_length - 1; level >= 0; level--) {
+        uint64_t* cur = items[level % 2];
+        const uint64_t* prev = items[(level + 1) % 2];
+        int num_packages = prev_len / 2;
+        int len = 0;
+
+        for (int i = 0, p = 0; i < num_leaves || p < num_packages; len++) {
+            uint64_t package = (p < num_packages) ? prev[2 * p] + prev[2 * p + 1] : UINT64_MAX;
+
+            if (i < num_leaves && (uint64_t) weights[i] <= package) {
+                cur[len] = weights[i++];
+                is_package[level][len] = 0;
             } else {
-                bit_num--;
+                cur[len] = package;
+                is_package[level][len] = 1;
+                p++;
             }
         }
+
+        prev_len = len;
     }
 
-    // Output code for "end block" symbol
-    NODE* leaf = node_for_symbol[256];
-    NODE* child_ptr = leaf;
-    NODE* parent_ptr = child_ptr->parent;
-    while (parent_ptr != NULL) {
-        parent_ptr->weight = (parent_ptr->left == child_ptr) ? 0 : 1;
+    for (int i = 0; i < num_leaves; i++)
+        lengths[i] = 0;
+
+    // Follow the selected items from the shortest code length to the longest
+    int num_selected = 2 * num_leaves - 2;
+    for (int level = 0; level < max_length && num_selected > 0; level++) {
+        int num_packages = 0;
+
+        for (int i = 0; i < num_selected; i++)
+            num_packages += is_package[level][i];
+
+        for (int i = 0; i < num_selected - num_packages; i++)
+            lengths[i]++;
 
-        parent_ptr = parent_ptr->parent;
-        child_ptr = child_ptr->parent;
+        num_selected = 2 * num_packages;
     }
-    NODE* ptr = nodes;
-    while (ptr != leaf) {
-        if (ptr->weight == 1) {
-            buffer |= 1 << bit_num;
-            ptr = ptr->right;
-        } else {
-            ptr = ptr->left;
+}
+
+/**
+ * Build in enc the canonical Huffman tree of the num_leaves leaves with the
+ * given symbols and code lengths. Codes are assigned in order of
+ * length, then of symbol value, each code being the previous one plus one,
+ * extended with zeroes to its length. The code lengths must describe a
+ * complete code, as those from package_merge() do.
+ */
+void build_canonical_tree(ENCODER* enc, const short* symbols, const int* lengths, int num_leaves) {
+    TREE* tree = &enc->tree;
+    int order[MAX_SYMBOLS];
+    int next = 1; // Index of the next unused node
+
+    // Order the leaves by code length, then by symbol value
+    for (int i = 0; i < num_leaves; i++) {
+        int j = i;
+        while (j > 0 && (lengths[order[j - 1]] > lengths[i] ||
+                         (lengths[order[j - 1]] == lengths[i] && symbols[order[j - 1]] > symbols[i]))) {
+            order[j] = order[j - 1];
+            j--;
         }
+        order[j] = i;
+    }
 
-        if (bit_num == 0) {
-            fputc(buffer & 0xFF, stdout);
-            bit_num = 7;
-            buffer = 0;
-        } else {
-            bit_num--;
+    tree->child[0][0] = 0;
+    tree->child[0][1] = 0;
+    tree->symbol[0] = -1;
+
+    // Insert the code of each leaf, creating the nodes along its path. Since
+    // the root is no node's child, a child of 0 is one not created yet.
+    uint32_t code = 0;
+    for (int k = 0; k < num_leaves; k++) {
+        int i = order[k];
+        int node = 0;
+
+        if (k > 0)
+            code = (code + 1) << (lengths[i] - lengths[order[k - 1]]);
+
+        for (int bit = lengths[i] - 1; bit >= 0; bit--) {
+            uint16_t* child = &tree->child[node][(code >> bit) & 1];
+
+            if (*child == 0) {
+                *child = next++;
+                tree->child[*child][0] = 0;
+                tree->child[*child][1] = 0;
+                tree->symbol[*child] = -1;
+            }
+
+            node = *child;
         }
+
+        tree->symbol[node] = symbols[i];
     }
 
-    // Additional padding if encoded sequence length is not multiple of 8 bits
-    if (bit_num != 7)
-        fputc(buffer & 0xFF, stdout);
+    tree->num_nodes = next;
+}
 
-    // Return -1 if error indicator associated with stdout is set
-    if (ferror(stdout))
-        return -1;
+/**
+ * Add entry to the binary min-heap of heap_size entries.
+ */
+void heap_push(uint64_t* heap, int* heap_size, uint64_t entry) {
+    int i = (*heap_size)++;
 
-    return 0;
+    // Sift the new entry up past every parent that is larger
+    while (i > 0 && entry < heap[(i - 1) / 2]) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = entry;
 }
 
 /**
- * Output a description of the Huffman tree used to compress the current block
- * to standard output.
+ * Remove the smallest entry from the binary min-heap and return it.
+ */
+uint64_t heap_pop(uint64_t* heap, int* heap_size) {
+    uint64_t top = heap[0];
+    uint64_t last = heap[--(*heap_size)];
+    int i = 0;
+
+    // Sift the last entry down from the top past every smaller child
+    while (2 * i + 1 < *heap_size) {
+        int child = 2 * i + 1;
+        if (child + 1 < *heap_size && heap[child + 1] < heap[child])
+            child++;
+
+        if (last <= heap[child])
+            break;
+
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+
+    return top;
+}
+
+/**
+ * Write a description of the Huffman tree in enc to output.
  *
  * The first two bytes of the description is the number of nodes. The following
  * set of byte(s) represents a postorder traversal of the Huffman tree, where 0
@@ -247,85 +935,540 @@ int compress_block(void) {
  * zeroes may be necessary to include). The last set of bytes specify the
  * symbol values of the leaf nodes from the left of the tree to the right of
  * the tree.
+ *
+ * Return the number of bytes written to output.
  */
-void output_description(void) {
+size_t output_description(ENCODER* enc, unsigned char* output) {
+    size_t len = 0;
+
     // Output number of nodes as a two-byte sequence
-    fputc((num_nodes & 0xFF00) >> 8, stdout);
-    fputc(num_nodes & 0xFF, stdout);
+    output[len++] = (enc->tree.num_nodes & 0xFF00) >> 8;
+    output[len++] = enc->tree.num_nodes & 0xFF;
 
     // Output bit sequence through postorder traversal
-    char buffer = 0; // Buffer to use in outputting bit sequence
-    int bit_num = 7; // Counter to track bit position in buffer
-    postorder_seq(nodes, &buffer, &bit_num);
-
-    // Additional padding if sequence length is not multiple of 8 bits
-    if (bit_num != 7)
-        fputc(buffer & 0xFF, stdout);
+    len += postorder_seq(&enc->tree, output + len);
 
     // Output the symbol values at the leaves from left to right
-    output_symbols(nodes);
+    len += output_symbols(&enc->tree, output + len);
+
+    return len;
+}
+
+/**
+ * Write the code lengths of the symbols of the block in enc to output, the
+ * header of a block in the canonical header mode. A length of 0 stands for a
+ * symbol that does not occur.
+ *
+ * The first byte is the length of the longest code. The lengths that follow
+ * are stored less one, in as few bits as hold the longest length less one,
+ * most significant bit first. The length of the end block symbol comes
+ * first. Then a 16-bit mask tells which of the 16 groups of 16 byte values
+ * have symbols occurring in the block, and each such group is given by a
+ * 16-bit mask of its symbols that occur followed by their lengths, in order
+ * of symbol value. The header is padded with zeroes to a whole byte.
+ *
+ * Return the number of bytes written to output.
+ */
+size_t output_code_lengths(ENCODER* enc, unsigned char* output) {
+    BIT_WRITER writer = {.output = output};
+    int max_length = 0;
+    int width = 0; // Number of bits in each stored length
+    int group_mask = 0;
+
+    for (int i = 0; i < MAX_SYMBOLS; i++) {
+        if (enc->leaf_for_symbol[i] >= 0 && enc->code_table[i].length > max_length)
+            max_length = enc->code_table[i].length;
+
+        if (i < 256 && enc->leaf_for_symbol[i] >= 0)
+            group_mask |= 0x8000 >> (i / 16);
+    }
+
+    while ((1 << width) < max_length)
+        width++;
+
+    output[writer.len++] = max_length;
+    put_bits(&writer, enc->code_table[256].length - 1, width);
+    put_bits(&writer, group_mask, 16);
+
+    for (int group = 0; group < 16; group++) {
+        if (!(group_mask & (0x8000 >> group)))
+            continue;
+
+        int symbol_mask = 0;
+        for (int i = 0; i < 16; i++) {
+            if (enc->leaf_for_symbol[16 * group + i] >= 0)
+                symbol_mask |= 0x8000 >> i;
+        }
+        put_bits(&writer, symbol_mask, 16);
+
+        for (int i = 16 * group; i < 16 * group + 16; i++) {
+            if (enc->leaf_for_symbol[i] >= 0)
+                put_bits(&writer, enc->code_table[i].length - 1, width);
+        }
+    }
+
+    // Additional padding if the lengths do not end on a byte
+    if (writer.count > 0)
+        output[writer.len++] = writer.bits << (8 - writer.count);
+
+    return writer.len;
+}
+
+/**
+ * Add the num_bits least significant bits of value to the bits written by
+ * writer, writing out every whole byte.
+ */
+void put_bits(BIT_WRITER* writer, uint32_t value, int num_bits) {
+    writer->bits = (writer->bits << num_bits) | value;
+    writer->count += num_bits;
+
+    while (writer->count >= 8) {
+        writer->count -= 8;
+        writer->output[writer->len++] = writer->bits >> writer->count;
+    }
 }
 
 /**
  * Output a sequence of num_nodes bits through a postorder traversal of the
  * Huffman tree in which each 0 bit denotes a leaf and each 1 bit denotes an
- * internal node.
+ * internal node, padded with zeroes to a whole byte.
+ *
+ * The postorder is the reverse of the order that visits each node before its
+ * right subtree and then its left subtree, so the nodes are visited in that
+ * order with a stack and their bits are placed from the last one back.
+ *
+ * Return the number of bytes written to output.
  */
-void postorder_seq(NODE* root, char* buffer, int* bit_num) {
-    if (root->left != NULL)
-        postorder_seq(root->left, buffer, bit_num);
+size_t postorder_seq(const TREE* tree, unsigned char* output) {
+    size_t len = (tree->num_nodes + 7) / 8;
+    uint16_t stack[MAX_SYMBOLS]; // Roots of the subtrees left to visit
+    int top = 0;
 
-    if (root->right != NULL)
-        postorder_seq(root->right, buffer, bit_num);
+    memset(output, 0, len);
 
-    // Set bit to 1 if internal node
-    if (!(root->left == NULL && root->right == NULL))
-        *buffer |= 1 << *bit_num;
+    stack[top++] = 0;
+    for (int i = tree->num_nodes - 1; top > 0; i--) {
+        int node = stack[--top];
 
-    if (*bit_num == 0) {
-        fputc(*buffer & 0xFF, stdout);
-        *bit_num = 7;
-        *buffer = 0;
-    } else {
-        (*bit_num)--;
+        // Set bit to 1 if internal node
+        if (!IS_LEAF(tree, node)) {
+            output[i / 8] |= 0x80 >> (i % 8);
+            stack[top++] = tree->child[node][0];
+            stack[top++] = tree->child[node][1];
+        }
     }
+
+    return len;
 }
 
 /**
  * Output symbol values at the leaves from left to right of the Huffman tree.
+ *
+ * Return the number of bytes written to output.
  */
-void output_symbols(NODE* root) {
-    if (root->left != NULL)
-        output_symbols(root->left);
-
-    if (root->right != NULL)
-        output_symbols(root->right);
-
-    // Output symbol value at leaf node
-    if (root->left == NULL && root->right == NULL) {
-        if (root->symbol == 256) {
-            fputc(0xFF, stdout);
-            fputc(0, stdout);
-        } else if (root->symbol == 255) {
-            fputc(0xFF, stdout);
-            fputc(1, stdout);
+size_t output_symbols(const TREE* tree, unsigned char* output) {
+    uint16_t stack[MAX_SYMBOLS]; // Roots of the subtrees left to visit
+    int top = 0;
+    size_t len = 0;
+
+    stack[top++] = 0;
+    while (top > 0) {
+        int node = stack[--top];
+
+        if (!IS_LEAF(tree, node)) {
+            stack[top++] = tree->child[node][1];
+            stack[top++] = tree->child[node][0];
+            continue;
+        }
+
+        // Output symbol value at leaf node
+        if (tree->symbol[node] == 256) {
+            output[len++] = 0xFF;
+            output[len++] = 0;
+        } else if (tree->symbol[node] == 255) {
+            output[len++] = 0xFF;
+            output[len++] = 1;
         } else {
-            fputc(root->symbol & 0xFF, stdout);
+            output[len++] = tree->symbol[node] & 0xFF;
         }
     }
+
+    return len;
 }
 
 /**
- * Set the parent pointers for each non-root node in the Huffman tree.
+ * Record in the code table of enc the code of each leaf of the Huffman tree
+ * and in leaf_for_symbol the leaf of each symbol. The nodes are visited in
+ * order of number, so the path to every node is known by the time it is
+ * visited, from that of its parent.
  */
-void set_parents(NODE* root) {
-    if (root->left != NULL) {
-        root->left->parent = root;
-        set_parents(root->left);
+void assign_codes(ENCODER* enc) {
+    const TREE* tree = &enc->tree;
+    CODE_ENTRY paths[MAX_NODES]; // Path from the root to each node
+
+    paths[0] = (CODE_ENTRY) {.code = 0, .length = 0};
+    for (int node = 0; node < tree->num_nodes; node++) {
+        CODE_ENTRY path = paths[node];
+
+        if (IS_LEAF(tree, node)) {
+            enc->code_table[tree->symbol[node]] = path;
+            enc->leaf_for_symbol[tree->symbol[node]] = node;
+            continue;
+        }
+
+        paths[tree->child[node][0]] = (CODE_ENTRY) {.code = path.code << 1, .length = path.length + 1};
+        paths[tree->child[node][1]] = (CODE_ENTRY) {.code = (path.code << 1) | 1, .length = path.length + 1};
     }
+}
 
-    if (root->right != NULL) {
-        root->right->parent = root;
-        set_parents(root->right);
+/**
+ * Replace the codes in the code table of enc with the canonical codes of the
+ * same lengths. The codes of each length are consecutive numbers in order of
+ * symbol value, and follow the codes of the next shorter length, extended
+ * with zeroes to their length.
+ */
+void assign_canonical_codes(ENCODER* enc) {
+    int count[MAX_CODE_BITS + 1] = {0}; // Number of codes of each length
+    uint32_t next_code[MAX_CODE_BITS + 1];
+
+    for (int i = 0; i < MAX_SYMBOLS; i++) {
+        if (enc->leaf_for_symbol[i] >= 0)
+            count[enc->code_table[i].length]++;
+    }
+
+    next_code[1] = 0;
+    for (int length = 2; length <= MAX_CODE_BITS; length++)
+        next_code[length] = (next_code[length - 1] + count[length - 1]) << 1;
+
+    for (int i = 0; i < MAX_SYMBOLS; i++) {
+        if (enc->leaf_for_symbol[i] >= 0)
+            enc->code_table[i].code = next_code[enc->code_table[i].length]++;
     }
 }
+
+/**
+ * Pipeline stage run on the calling thread: read the next block of input into
+ * the job. arg points to the COMPRESS_STATE of compress_stream(). An adaptive
+ * block starts with the bytes carried over from the previous one and ends
+ * where find_block_end() finds. The type of a framed block is chosen here, in
+ * the order of the blocks, by choose_block_type().
+ *
+ * Return 0 if a block is read, 1 if there is nothing left to compress, or -1
+ * if reading fails.
+ */
+int read_block_job(JOB* job, void* arg) {
+    COMPRESS_STATE* state = arg;
+    BLOCK_STATS* stats = stats_job(&state->report, job);
+    int carry_len = state->carry_len;
+
+    if (carry_len > 0)
+        memcpy(job->input, state->carry, carry_len);
+
+    uint64_t start = TIMER_START(stats);
+    int num_symbols = read_block(state->source, job->input + carry_len, state->block_size - carry_len);
+    TIMER_STOP(stats, TIMER_IO, start);
+    if (num_symbols == -1)
+        return -1;
+
+    num_symbols += carry_len;
+    if (num_symbols == 0)
+        return 1;
+
+    if (state->adaptive) {
+        start = TIMER_START(stats);
+        int len = find_block_end(job->input, num_symbols);
+        TIMER_STOP(stats, TIMER_HISTOGRAM, start);
+
+        state->carry_len = num_symbols - len;
+        memcpy(state->carry, job->input + len, state->carry_len);
+        num_symbols = len;
+    }
+
+    job->input_len = num_symbols;
+
+    if (state->framed)
+        choose_block_type(state, job);
+
+    return 0;
+}
+
+/**
+ * Choose the type of the framed block held by job. The block repeats the last
+ * new code if the bits that code is estimated to take for the symbols of the
+ * block, their cross entropy, are no more than the estimate for a new code
+ * with its header. If there is a static table, the block uses its code
+ * instead if the bits that code takes, which are known exactly, are no more
+ * than either estimate. The bits static blocks take beyond the entropy of
+ * their symbols add up, though, and once they exceed the header of a new code,
+ * which later blocks could repeat, the block gets a new code instead. A block
+ * for which every estimate reaches the size of the block is stored.
+ * Otherwise, the block gets a new code, which later blocks may repeat.
+ * job->table receives the histogram the code is built from, followed by the
+ * histogram of the block. If blocks have checksums, the checksum of the block
+ * is stored in job->checksum.
+ */
+void choose_block_type(COMPRESS_STATE* state, JOB* job) {
+    BLOCK_STATS* stats = job->stats;
+    uint32_t counts[256];
+    int num_symbols = job->input_len;
+    double repeat_bits = HUGE_VAL;
+    double static_bits = HUGE_VAL;
+
+    // Take the checksum of the block in the same pass as its histogram
+    uint64_t start = TIMER_START(stats);
+    if (state->checksums)
+        job->checksum = histogram_crc32c(job->input, num_symbols, counts);
+    else
+        histogram(job->input, num_symbols, counts);
+    double fitted_bits = entropy_bits(counts, num_symbols);
+    double header_bits = estimate_header_bits(counts);
+    double new_bits = fitted_bits + header_bits;
+
+    if (state->table_id >= 0) {
+        repeat_bits = 0;
+        for (int symbol = 0; symbol < 256; symbol++) {
+            if (counts[symbol] != 0)
+                repeat_bits += counts[symbol] * state->symbol_bits[symbol];
+        }
+    }
+
+    // A symbol without a code in the table keeps the block from using it
+    if (state->static_table != NULL) {
+        const unsigned char* lengths = state->static_table->lengths;
+
+        static_bits = 0;
+        for (int symbol = 0; symbol < 256; symbol++) {
+            if (counts[symbol] != 0)
+                static_bits += (lengths[symbol] != 0) ? (double) counts[symbol] * lengths[symbol] : HUGE_VAL;
+        }
+    }
+
+    if (new_bits >= 8.0 * num_symbols && repeat_bits >= 8.0 * num_symbols && static_bits >= 8.0 * num_symbols) {
+        job->type = BLOCK_STORED;
+    } else if (static_bits <= repeat_bits && static_bits <= new_bits &&
+               state->static_excess + static_bits - fitted_bits <= header_bits) {
+        job->type = BLOCK_STATIC;
+        state->static_excess += static_bits - fitted_bits;
+    } else if (repeat_bits <= new_bits) {
+        job->type = BLOCK_REPEAT;
+        job->table_id = state->table_id;
+        memcpy(job->table, state->table_counts, sizeof(counts));
+    } else {
+        job->type = BLOCK_HUFFMAN;
+        job->table_id = state->num_blocks;
+        memcpy(job->table, counts, sizeof(counts));
+
+        // Symbols missing from the block have no code to repeat
+        state->table_id = state->num_blocks;
+        state->static_excess = 0;
+        memcpy(state->table_counts, counts, sizeof(counts));
+        for (int symbol = 0; symbol < 256; symbol++)
+            state->symbol_bits[symbol] = (counts[symbol] != 0) ? log2((double) num_symbols / counts[symbol]) : HUGE_VAL;
+    }
+
+    memcpy(job->table + sizeof(counts), counts, sizeof(counts));
+    job->table_len = 2 * sizeof(counts);
+    state->num_blocks++;
+    TIMER_STOP(stats, TIMER_HISTOGRAM, start);
+
+    if (stats != NULL)
+        stats_symbols(stats, counts, num_symbols);
+}
+
+/**
+ * Return the length of the block that starts at block and holds up to
+ * num_symbols symbols, growing it one segment at a time until the next
+ * segment is estimated to take fewer bits in a block of its own.
+ */
+int find_block_end(const unsigned char* block, int num_symbols) {
+    uint32_t counts[256], segment[256], merged[256];
+    int len = (num_symbols < SPLIT_SEGMENT_SIZE) ? num_symbols : SPLIT_SEGMENT_SIZE;
+
+    histogram(block, len, counts);
+    double block_bits = estimate_block_bits(counts, len);
+
+    while (len < num_symbols) {
+        int segment_len = (num_symbols - len < SPLIT_SEGMENT_SIZE) ? num_symbols - len : SPLIT_SEGMENT_SIZE;
+
+        histogram(block + len, segment_len, segment);
+        for (int symbol = 0; symbol < 256; symbol++)
+            merged[symbol] = counts[symbol] + segment[symbol];
+
+        // End the block if the segment is better off on its own
+        double merged_bits = estimate_block_bits(merged, len + segment_len);
+        if (merged_bits > block_bits + estimate_block_bits(segment, segment_len) + SPLIT_BLOCK_BITS)
+            break;
+
+        memcpy(counts, merged, sizeof(counts));
+        block_bits = merged_bits;
+        len += segment_len;
+    }
+
+    return len;
+}
+
+/**
+ * Return an estimate of the number of bits taken by a Huffman-coded block of
+ * num_symbols symbols counted in counts: their entropy, plus the estimate of
+ * estimate_header_bits().
+ */
+double estimate_block_bits(const uint32_t* counts, int num_symbols) {
+    return entropy_bits(counts, num_symbols) + estimate_header_bits(counts);
+}
+
+/**
+ * Return an estimate of the number of bits taken by the header of a block
+ * whose symbols are counted in counts: HEADER_BITS_PER_SYMBOL bits for every
+ * symbol that occurs.
+ */
+double estimate_header_bits(const uint32_t* counts) {
+    int num_leaves = 0;
+
+    for (int symbol = 0; symbol < 256; symbol++)
+        num_leaves += (counts[symbol] != 0);
+
+    return HEADER_BITS_PER_SYMBOL * num_leaves;
+}
+
+/**
+ * Pipeline stage run on a worker thread: compress the block held by the job
+ * with the worker's own encoder. A framed block starts with the type chosen by
+ * read_block_job(), and is coded with the code built from the first histogram
+ * in job->table unless the encoder already holds it, or with the code of the
+ * static table, which every encoder shares. It ends with job->checksum if
+ * blocks have checksums.
+ *
+ * Return 0.
+ */
+int compress_block_job(JOB* job, void* worker) {
+    ENCODER* enc = worker;
+    BLOCK_STATS* stats = job->stats;
+    const unsigned char* block = job->input;
+    int num_symbols = job->input_len;
+    unsigned char* output = job->output;
+
+    enc->stats = stats;
+    if (!enc->block_types) {
+        job->output_len = compress_block(enc, block, num_symbols, output);
+        return 0;
+    }
+
+    output[0] = job->type;
+    job->output_len = 1;
+
+    const CODE_ENTRY* code_table = (job->type == BLOCK_STATIC) ? enc->static_table->code_table : enc->code_table;
+
+    if ((job->type == BLOCK_HUFFMAN || job->type == BLOCK_REPEAT) && enc->table_id != job->table_id) {
+        uint64_t start = TIMER_START(stats);
+        build_code(enc, (const uint32_t*) job->table);
+        enc->table_id = job->table_id;
+        TIMER_STOP(stats, TIMER_TREE, start);
+    }
+
+    // Store a repeat or static block that its code would not make smaller,
+    // which also keeps the block within COMPRESS_BLOCK_BOUND(). A block with a
+    // new code is kept even then, since later blocks may repeat its code.
+    if (job->type == BLOCK_REPEAT || job->type == BLOCK_STATIC) {
+        const uint32_t* counts = (const uint32_t*) job->table + 256;
+        uint64_t num_bits = 0;
+
+        for (int symbol = 0; symbol < 256; symbol++)
+            num_bits += (uint64_t) counts[symbol] * code_table[symbol].length;
+
+        // Each stream adds up to 5 bytes of padding, jump table, or end block code
+        if (num_bits / 8 + 5 * enc->num_streams >= (uint64_t) num_symbols)
+            job->type = BLOCK_STORED;
+    }
+
+    uint64_t start = TIMER_START(stats);
+    if (job->type == BLOCK_HUFFMAN)
+        job->output_len += output_header(enc, output + 1);
+    size_t header_len = job->output_len - 1;
+
+    if (job->type != BLOCK_STORED) {
+        job->output_len += encode_symbols(code_table, enc->num_streams, enc->encode_threads, block, num_symbols,
+                                          output + job->output_len);
+    } else {
+        output[0] = BLOCK_STORED;
+        memcpy(output + 1, block, num_symbols);
+        job->output_len += num_symbols;
+    }
+
+    if (enc->checksums) {
+        put_u32(output + job->output_len, job->checksum);
+        job->output_len += CHECKSUM_SIZE;
+    }
+    TIMER_STOP(stats, TIMER_ENCODE, start);
+
+    if (stats != NULL) {
+        stats->type = job->type;
+        stats->header_len = header_len;
+        stats->max_length = (job->type == BLOCK_STATIC) ? enc->static_table->dec.max_length
+                            : (job->type != BLOCK_STORED) ? longest_code(enc) : 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Allocate the encoder used by one thread, set up for the COMPRESS_STATE that
+ * arg points to.
+ */
+void* new_encoder(void* arg) {
+    ENCODER* enc = malloc(sizeof(ENCODER));
+
+    if (enc != NULL)
+        init_encoder(enc, arg);
+
+    return enc;
+}
+
+/**
+ * Give enc the code length limit, header mode, number of streams, threads per
+ * block, format, checksums, and static table of state, holding no code yet.
+ */
+void init_encoder(ENCODER* enc, const COMPRESS_STATE* state) {
+    enc->max_code_length = state->max_code_length;
+    enc->canonical = state->canonical;
+    enc->num_streams = state->num_streams;
+    enc->encode_threads = state->encode_threads;
+    enc->block_types = state->framed;
+    enc->checksums = state->checksums;
+    enc->static_table = state->static_table;
+    enc->table_id = -1;
+    enc->stats = NULL;
+}
+
+/**
+ * Pipeline stage run on the calling thread: write the output of the job to
+ * the sink. In the framed format, the output is preceded by a frame header
+ * and its lengths are added to the index.
+ *
+ * Return 0 if the output is written without error. Otherwise, return -1.
+ */
+int write_job(JOB* job, void* arg) {
+    COMPRESS_STATE* state = arg;
+    BLOCK_STATS* stats = job->stats;
+    uint64_t start = TIMER_START(stats);
+
+    if (state->framed) {
+        unsigned char header[FRAME_HEADER_SIZE];
+        put_u32(header, job->output_len);
+        put_u32(header + 4, job->input_len);
+
+        if (sink_write(state->sink, header, FRAME_HEADER_SIZE) == -1)
+            return -1;
+
+        if (index_add(&state->index, job->output_len, job->input_len) == -1)
+            return -1;
+    }
+
+    if (sink_write(state->sink, job->output, job->output_len) == -1)
+        return -1;
+    TIMER_STOP(stats, TIMER_IO, start);
+
+    if (stats != NULL)
+        stats_block(&state->report, stats, job->input_len, job->output_len);
+
+    return 0;
+}
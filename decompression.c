@@ -1,213 +1,1411 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include "huff.h"
 
-void label_leaves(NODE* root);
+/**
+ * Compressed data that is not in memory is read in bulk into a buffer that
+ * can hold two of the largest compressed blocks, so that a whole block is
+ * always available to decompress_block() unless the input ends. The buffer
+ * starts out sized for the blocks of the original format and grows once the
+ * file header of a framed stream gives a larger block size.
+ */
+#define INPUT_BUFFER_SIZE(block_size) (2 * COMPRESS_BLOCK_BOUND(block_size))
+
+/**
+ * decode_symbol() is the body of every decoding loop, so it is inlined even
+ * where the compiler would not choose to.
+ */
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
 
 /**
- * Read compressed data from standard input, decompress that data, and write
- * the decompressed data to standard output. Assume the input data is
- * constructed from compress().
+ * A bitstream being decoded: the len bytes at input, of which those before
+ * pos have been loaded into a bit reservoir of up to 64 bits, aligned to the
+ * most significant bit, count bits of which are input not yet decoded.
+ */
+typedef struct bit_stream {
+    const unsigned char* input;
+    size_t len;
+    size_t pos;
+    uint64_t bits;
+    int count;
+} BIT_STREAM;
+
+int decompress_original(huff_ctx* ctx, DECOMPRESS_STATE* state);
+int read_block_header(DECODER* dec, const unsigned char* input, size_t input_len, size_t* pos);
+int decode_block(const DECODER* dec, int num_streams, const unsigned char* input, size_t input_len, size_t pos,
+                 size_t* consumed, unsigned char* output, size_t output_cap, size_t* output_len);
+static ALWAYS_INLINE int decode_symbol(const DECODER* dec, BIT_STREAM* stream);
+static ALWAYS_INLINE uint64_t load_u64(const unsigned char* ptr);
+int decode_streams(const DECODER* dec, int num_streams, const unsigned char* input, size_t input_len,
+                   unsigned char* output, size_t num_symbols);
+int decompress_framed(huff_ctx* ctx, DECOMPRESS_STATE* state);
+int decompress_frame(DECODER* dec, JOB* job, const unsigned char* input, size_t input_len);
+int label_leaves(TREE* tree, const unsigned char* input, size_t input_len, size_t* pos);
+int tree_depth(const TREE* tree);
+int get_bits(const unsigned char* input, size_t input_len, size_t* pos, uint32_t* buffer, int* count,
+             int num_bits);
+void build_decode_table(DECODER* dec);
+int reserve_input(DECOMPRESS_STATE* state, size_t size);
+void* new_decoder(void* arg);
+int write_output_job(JOB* job, void* arg);
+void stats_output(BLOCK_STATS* stats, const unsigned char* output, size_t output_len);
+
+/**
+ * Read compressed data from source, decompress that data, and write the
+ * decompressed data to sink. Assume the input data is constructed from
+ * compress_stream(), in the original, the framed, or the dynamic format, or
+ * as a message.
+ *
+ * If ctx->ranged is nonzero, only the range of the decompressed data given
+ * by ctx is written. A framed stream held in memory is then decompressed by
+ * decompress_range() from the first block of the range to the last; any
+ * other data is decompressed from its start and the range cut out of it.
  *
  * Return 0 if decompression succeeds without error. Otherwise, return -1.
  */
-int decompress(void) {
+int decompress_stream(huff_ctx* ctx, SOURCE* source, SINK* sink) {
+    DECOMPRESS_STATE state = {
+        .source = source,
+        .sink = sink,
+        .bad_block = -1,
+        .static_table = ctx->table,
+        .ranged = ctx->ranged,
+        .skip = ctx->range_offset,
+        .remaining = ctx->range_len,
+        .end_block = -1
+    };
     int ret;
 
-    while (!feof(stdin)) {
-        ret = decompress_block();
+    if (source->type != SOURCE_MEMORY) {
+        if (reserve_input(&state, INPUT_BUFFER_SIZE(MAX_ORIGINAL_BLOCK_SIZE)) == -1)
+            return -1;
+
+        // Start with what has arrived, so that a stream in the dynamic
+        // format is decoded without waiting for a buffer of it
+        state.len = source_read_some(source, state.buffer, state.buffer_size);
+        state.eof = (state.len == 0);
+    } else {
+        state.data = source->data + source->pos;
+        state.len = source->len - source->pos;
+        state.eof = 1;
+    }
+
+    // The dynamic format has no blocks to collect statistics of
+    if (state.len == 0 || state.data[0] != DYNAMIC_MAGIC[0])
+        stats_begin(&state.report, ctx, 0);
+
+    // Tell the formats apart by the first byte; empty input is left empty
+    if (fill_input(&state, 1) == 0)
+        ret = source_error(source) ? -1 : 0;
+    else if (state.data[state.pos] == FRAME_MAGIC[0] && state.ranged && source->type == SOURCE_MEMORY)
+        ret = decompress_range(ctx, &state);
+    else if (state.data[state.pos] == FRAME_MAGIC[0])
+        ret = decompress_framed(ctx, &state);
+    else if (state.data[state.pos] == DYNAMIC_MAGIC[0])
+        ret = decompress_dynamic(ctx, &state);
+    else if (state.data[state.pos] == MESSAGE_MAGIC)
+        ret = decompress_message(ctx, &state);
+    else
+        ret = decompress_original(ctx, &state);
+
+    // Count the compressed data used in place as read
+    if (source->type == SOURCE_MEMORY)
+        source->pos += state.pos;
+
+    if (ret == 0)
+        stats_end(&state.report);
+    ctx->bad_block = state.bad_block;
+
+    free(state.buffer);
+    free(state.index.lengths);
+
+    if (sink_flush(sink) == -1)
+        return -1;
+
+    return ret;
+}
+
+/**
+ * Decompress a stream in the original format, a bare sequence of blocks.
+ * Since the end of a block is only known once it is decoded, blocks are
+ * decompressed serially with the decoder of ctx.
+ *
+ * Return 0 if decompression succeeds without error. Otherwise, return -1.
+ */
+int decompress_original(huff_ctx* ctx, DECOMPRESS_STATE* state) {
+    if (ctx_reserve(ctx, 0, MAX_ORIGINAL_BLOCK_SIZE) == -1)
+        return -1;
+
+    state->num_streams = 1;
+    init_decoder(ctx->dec, state);
 
-        // Return -1 if error with decompression
-        if (ret == -1)
+    while (1) {
+        BLOCK_STATS block_stats = {0};
+        BLOCK_STATS* stats = (state->report.out != NULL) ? &block_stats : NULL;
+
+        uint64_t start = TIMER_START(stats);
+        size_t avail = fill_input(state, COMPRESS_BLOCK_BOUND(MAX_ORIGINAL_BLOCK_SIZE));
+        TIMER_STOP(stats, TIMER_IO, start);
+
+        // Stop if there is nothing left to decompress
+        if (avail == 0)
+            return source_error(state->source) ? -1 : 0;
+
+        size_t consumed, output_len;
+        ctx->dec->stats = stats;
+        if (decompress_block(ctx->dec, state->data + state->pos, avail, &consumed,
+                             ctx->output, MAX_ORIGINAL_BLOCK_SIZE, &output_len) == -1) {
+            state->bad_block = state->num_written;
+            return -1;
+        }
+        ctx->dec->stats = NULL;
+        state->pos += consumed;
+
+        start = TIMER_START(stats);
+        if (write_range(state, ctx->output, output_len) == -1)
             return -1;
+        TIMER_STOP(stats, TIMER_IO, start);
+        state->num_written++;
 
-        // Reset num_nodes
-        num_nodes = 0;
+        if (stats != NULL) {
+            stats_output(stats, ctx->output, output_len);
+            stats_block(&state->report, stats, output_len, consumed);
+        }
+    }
+}
+
+/**
+ * Decompress a stream in the framed format. The index at the end of the
+ * stream is checked against the frame headers.
+ *
+ * Return 0 if decompression succeeds without error. Otherwise, return -1.
+ */
+int decompress_framed(huff_ctx* ctx, DECOMPRESS_STATE* state) {
+    if (read_file_header(state) == -1 || run_frames(ctx, state) == -1)
+        return -1;
+
+    return read_index(state);
+}
+
+/**
+ * Decompress a message, which must have been compressed with the table of
+ * state. Nothing may follow the message, as nothing may follow the trailer of
+ * a framed stream.
+ *
+ * Return 0 if decompression succeeds without error. Otherwise, return -1.
+ */
+int decompress_message(huff_ctx* ctx, DECOMPRESS_STATE* state) {
+    BLOCK_STATS block_stats = {.type = BLOCK_STATIC};
+    BLOCK_STATS* stats = (state->report.out != NULL) ? &block_stats : NULL;
+    MESSAGE_HEADER header;
+
+    size_t avail = fill_input(state, MESSAGE_MAX_HEADER_SIZE);
+    int header_len = read_message_header(state->data + state->pos, avail, &header);
+    if (header_len <= 0 || state->static_table == NULL || header.table_id != state->static_table->id)
+        return -1;
+
+    block_stats.max_length = state->static_table->dec.max_length;
+
+    size_t len = header_len + header.compressed_len;
+    if ((state->buffer != NULL && reserve_input(state, len + 1) == -1) || fill_input(state, len + 1) != len ||
+        ctx_reserve(ctx, 0, header.uncompressed_len) == -1)
+        return -1;
+
+    uint64_t start = TIMER_START(stats);
+    if (decode_message(&state->static_table->dec, &header, state->data + state->pos + header_len,
+                       ctx->output) == -1) {
+        state->bad_block = 0;
+        return -1;
+    }
+    TIMER_STOP(stats, TIMER_DECODE, start);
+    state->pos += len;
 
-        // Reset nodes array
-        NODE empty_node = {.left = NULL, .right = NULL, .parent = NULL, .weight = 0, .symbol = 0};
-        for (int i = 0; i < 2 * MAX_SYMBOLS - 1; i++)
-            nodes[i] = empty_node;
+    if (write_range(state, ctx->output, header.uncompressed_len) == -1)
+        return -1;
 
-        // Reset node_for_symbol array
-        for (int i = 0; i < MAX_SYMBOLS; i++)
-            node_for_symbol[i] = NULL;
+    if (stats != NULL) {
+        stats_output(stats, ctx->output, header.uncompressed_len);
+        stats_block(&state->report, stats, header.uncompressed_len, len);
     }
 
-    fflush(stdout);
+    return 0;
+}
+
+/**
+ * Decode the symbols of the message whose header is header from the
+ * compressed symbols at input into output, which has room for all of them
+ * with the decode table of dec.
+ *
+ * Return 0 if the symbols fill exactly the lengths of header. Otherwise,
+ * return -1.
+ */
+int decode_message(const DECODER* dec, const MESSAGE_HEADER* header, const unsigned char* input,
+                   unsigned char* output) {
+    size_t consumed, output_len;
+
+    if (decode_block(dec, 1, input, header->compressed_len, 0, &consumed, output, header->uncompressed_len,
+                     &output_len) == -1 ||
+        consumed != header->compressed_len || output_len != header->uncompressed_len)
+        return -1;
 
     return 0;
 }
 
 /**
- * Read one block of compressed data from standard input, decompress that
- * data, and write the decompressed data to standard output.
+ * Decompress the blocks of a framed stream whose file header has been read,
+ * up to the end of the blocks or state->end_block. The frame headers give
+ * the lengths of every block up front, so if ctx->num_threads is greater
+ * than one, blocks are handed to that many threads without being decoded
+ * first. If ctx->pipelined is nonzero, frames are also read on a thread of
+ * their own, so that reading, decompressing, and writing overlap.
  *
- * Return 0 if the block decompresses without error. Otherwise, return -1.
+ * Return 0 if decompression succeeds without error. Otherwise, return -1.
  */
-int decompress_block(void) {
-    int ret = reconstruct_huffman_tree(); // Reconstruct Huffman tree from description
+int run_frames(huff_ctx* ctx, DECOMPRESS_STATE* state) {
+    PIPELINE pipeline = {
+        .arg = state,
+        .read_job = read_frame_job,
+        .new_worker = new_decoder,
+        .process_job = decompress_block_job,
+        .write_job = write_output_job,
+        .table_size = MAX_HEADER_SIZE,
+        .reader_thread = ctx->pipelined
+    };
+    int ret = 0;
+
+    // Make room for the largest block, in the input buffer if there is one
+    pipeline.input_size = COMPRESS_BLOCK_BOUND(state->block_size);
+    pipeline.output_size = state->block_size;
+    if (state->buffer != NULL && reserve_input(state, INPUT_BUFFER_SIZE(state->block_size)) == -1)
+        return -1;
+
+    if (ctx->num_threads > 1 || ctx->pipelined) {
+        ret = run_pipeline(&pipeline, ctx->num_threads);
+    } else if (ctx_reserve(ctx, pipeline.input_size, pipeline.output_size) == -1) {
+        ret = -1;
+    } else {
+        unsigned char table[MAX_HEADER_SIZE];
+        JOB job = {.input = ctx->input, .output = ctx->output, .table = table};
 
-    // Return 0 if EOF is encountered / if nothing left to decompress
-    if (ret == 1)
+        init_decoder(ctx->dec, state);
+
+        // Run the stages of the pipeline one after another on this thread
+        while (ret == 0) {
+            ret = read_frame_job(&job, state);
+            if (ret != 0)
+                break;
+
+            if (decompress_block_job(&job, ctx->dec) == -1 || write_output_job(&job, state) == -1)
+                ret = -1;
+        }
+
+        // read_frame_job() returns 1 at the end of the blocks
+        if (ret == 1)
+            ret = 0;
+    }
+
+    return ret;
+}
+
+/**
+ * Return the size of the file header of the framed format that starts with
+ * the FILE_HEADER_V1_SIZE bytes at header, which is shorter before version 5,
+ * or 0 if they do not start a file header of a known version.
+ */
+size_t file_header_size(const unsigned char* header) {
+    int version = header[3];
+
+    if (memcmp(header, FRAME_MAGIC, 3) != 0 || version < 1 || version > FRAME_VERSION)
         return 0;
 
-    // Return -1 if error with decompression
+    return (version == 1) ? FILE_HEADER_V1_SIZE : (version == 2) ? FILE_HEADER_V2_SIZE
+           : (version <= 4) ? FILE_HEADER_V4_SIZE : FILE_HEADER_SIZE;
+}
+
+/**
+ * Read the file header of a framed stream into state: the block size and the
+ * options the blocks were compressed with. A stream compressed with a static
+ * table is decoded with state->static_table, which must be the same table; a
+ * stream without one has no static blocks, so state->static_table is cleared.
+ *
+ * Return 0 if the header is valid. Otherwise, return -1.
+ */
+int read_file_header(DECOMPRESS_STATE* state) {
+    if (fill_input(state, FILE_HEADER_V1_SIZE) < FILE_HEADER_V1_SIZE)
+        return -1;
+
+    const unsigned char* header = state->data + state->pos;
+    size_t header_size = file_header_size(header);
+
+    if (header_size == 0 || fill_input(state, header_size) < header_size)
+        return -1;
+
+    header = state->data + state->pos;
+    int version = header[3];
+    state->num_streams = 1;
+    state->block_size = MAX_ORIGINAL_BLOCK_SIZE;
+    state->block_types = (version >= 4);
+    state->table_id = -1;
+
+    if (version >= 2) {
+        state->max_code_length = header[4];
+        state->canonical = (header[5] == HEADER_CANONICAL);
+        state->num_streams = (header[6] == 0) ? 1 : header[6];
+
+        int flags = (version >= 4) ? FRAME_FLAG_CHECKSUMS : 0;
+        state->checksums = (header[7] & FRAME_FLAG_CHECKSUMS) != 0;
+
+        // Return -1 if the limit is out of range, the header mode is unknown,
+        // there are too many streams, or an unknown flag is set
+        if ((state->max_code_length != 0 &&
+             (state->max_code_length < MIN_CODE_LENGTH || state->max_code_length > MAX_CODE_LENGTH)) ||
+            header[5] > HEADER_CANONICAL || state->num_streams > MAX_STREAMS || (header[7] & ~flags) != 0)
+            return -1;
+    }
+
+    if (version >= 3) {
+        uint32_t block_size = get_u32(header + 8);
+
+        // Return -1 if the block size is out of range
+        if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE)
+            return -1;
+        state->block_size = block_size;
+    }
+
+    if (version >= 5) {
+        // Return -1 unless the stream was compressed with the table held
+        if (state->static_table == NULL || get_u32(header + FILE_HEADER_V4_SIZE) != state->static_table->id)
+            return -1;
+    } else {
+        state->static_table = NULL;
+    }
+
+    state->pos += header_size;
+
+    return 0;
+}
+
+/**
+ * Read the index and trailer that follow the blocks of a framed stream and
+ * check that they match the frame headers and end the input.
+ *
+ * Return 0 if the index is valid. Otherwise, return -1.
+ */
+int read_index(DECOMPRESS_STATE* state) {
+    for (size_t i = 0; i < 2 * state->index.num_blocks; i++) {
+        if (fill_input(state, 4) < 4 || get_u32(state->data + state->pos) != state->index.lengths[i])
+            return -1;
+        state->pos += 4;
+    }
+
+    if (fill_input(state, TRAILER_SIZE + 1) != TRAILER_SIZE ||
+        get_u32(state->data + state->pos) != state->index.num_blocks ||
+        memcmp(state->data + state->pos + 4, FRAME_INDEX_MAGIC, 4) != 0)
+        return -1;
+    state->pos += TRAILER_SIZE;
+
+    return 0;
+}
+
+/**
+ * Decompress one block of compressed data held in input into output. At
+ * most output_cap symbols are written to output. The number of bytes of input
+ * making up the block is stored in consumed and the number of symbols written
+ * is stored in output_len.
+ *
+ * Return 0 if the block decompresses without error. Otherwise, return -1.
+ */
+int decompress_block(DECODER* dec, const unsigned char* input, size_t input_len, size_t* consumed,
+                     unsigned char* output, size_t output_cap, size_t* output_len) {
+    BLOCK_STATS* stats = dec->stats;
+    size_t pos = 0; // Position of the next unread byte in input
+
+    uint64_t start = TIMER_START(stats);
+    int ret = read_block_header(dec, input, input_len, &pos);
+    TIMER_STOP(stats, TIMER_TREE, start);
     if (ret == -1)
         return -1;
 
-    int buffer = fgetc(stdin); // Buffer to hold bytes
-    if (buffer == EOF)
+    if (stats != NULL) {
+        stats->type = BLOCK_HUFFMAN;
+        stats->header_len = pos;
+        stats->max_length = (dec->table_bits != 0) ? dec->max_length : 0;
+    }
+
+    // A tree consisting of only the end block symbol still occupies one byte
+    if (dec->table_bits == 0) {
+        if (pos == input_len)
+            return -1;
+
+        *consumed = pos + 1;
+        *output_len = 0;
+        return 0;
+    }
+
+    start = TIMER_START(stats);
+    ret = decode_block(dec, dec->num_streams, input, input_len, pos, consumed, output, output_cap, output_len);
+    TIMER_STOP(stats, TIMER_DECODE, start);
+
+    return ret;
+}
+
+/**
+ * Read the header of a block from input, starting at *pos, and build the
+ * decode table of dec for its code. *pos is advanced past the header. A tree
+ * consisting of only the end block symbol has no decode table, which is told
+ * by dec->table_bits being 0.
+ *
+ * If dec->max_code_length is nonzero, a block with a longer code is rejected.
+ *
+ * Return 0 if the header describes a code without error. Otherwise, return
+ * -1.
+ */
+int read_block_header(DECODER* dec, const unsigned char* input, size_t input_len, size_t* pos) {
+    // Build the decode table from the code lengths
+    if (dec->canonical)
+        return read_code_lengths(dec, input, input_len, pos);
+
+    // Reconstruct Huffman tree from description
+    if (reconstruct_huffman_tree(dec, input, input_len, pos) == -1)
         return -1;
-    int bit_num = 7; // Counter to track bit position
-    int end_block = 0; // Indicator for whether end block is reached
-
-    while (!end_block) {
-        // Traverse Huffman tree until leaf is reached
-        NODE* ptr = nodes;
-        while (!(ptr->left == NULL && ptr->right == NULL)) {
-            if (buffer & (1 << bit_num))
-                ptr = ptr->right;
-            else
-                ptr = ptr->left;
-
-            // If ptr is at internal node, update buffer/bit_num accordingly
-            if (!(ptr->left == NULL && ptr->right == NULL)) {
-                if (bit_num == 0) {
-                    buffer = fgetc(stdin);
-
-                    if (buffer == EOF)
-                        return -1;
-
-                    bit_num = 7;
-                } else {
-                    bit_num--;
-                }
-            } else {
-                // If end block is reached, DO NOT call fgetc()
-                if (ptr->symbol != 256) {
-                    if (bit_num == 0) {
-                        buffer = fgetc(stdin);
-
-                        if (buffer == EOF)
-                            return -1;
-
-                        bit_num = 7;
-                    } else {
-                        bit_num--;
-                    }
-                }
+
+    if (IS_LEAF(&dec->tree, 0)) {
+        if (dec->tree.symbol[0] != 256)
+            return -1;
+
+        dec->table_bits = 0;
+        return 0;
+    }
+
+    // Index the decode table by the length of the longest code if possible
+    int depth = tree_depth(&dec->tree);
+    if (dec->max_code_length != 0 && depth > dec->max_code_length)
+        return -1;
+
+    dec->max_length = depth;
+    dec->table_bits = (depth <= DECODE_TABLE_MAX_BITS) ? depth : DECODE_TABLE_BITS;
+    build_decode_table(dec);
+
+    return 0;
+}
+
+/**
+ * Decode the symbols of a block held in input, from pos on, with the decode
+ * table of dec into output, storing the number of bytes of input making up
+ * the block in consumed and the number of symbols written in output_len, as
+ * decompress_block() does. The block is split into num_streams streams, which
+ * is given apart from dec since a static table is shared by streams with any
+ * number of them.
+ *
+ * The bitstream is decoded through the decode table with up to 64 bits of
+ * input held in a bit reservoir, most significant bit first. Once the end
+ * block symbol is decoded, the padding and whole bytes left in the reservoir
+ * are not counted as consumed, so the next block starts right after the
+ * padding. A block split into streams has no end block symbol; it must
+ * decode to exactly output_cap symbols and take up all of input.
+ *
+ * Return 0 if the symbols decode without error. Otherwise, return -1.
+ */
+int decode_block(const DECODER* dec, int num_streams, const unsigned char* input, size_t input_len, size_t pos,
+                 size_t* consumed, unsigned char* output, size_t output_cap, size_t* output_len) {
+    size_t len = 0; // Number of symbols written to output
+
+    // A block split into streams decodes to exactly output_cap symbols
+    if (num_streams > 1) {
+        if (decode_streams(dec, num_streams, input + pos, input_len - pos, output, output_cap) == -1)
+            return -1;
+
+        *consumed = input_len;
+        *output_len = output_cap;
+        return 0;
+    }
+
+    BIT_STREAM stream = {.input = input, .len = input_len, .pos = pos};
+
+    while (1) {
+        int symbol = decode_symbol(dec, &stream);
+
+        // Stop at the end block symbol; output any other symbol
+        if (symbol == 256)
+            break;
+
+        if (symbol == -1 || len == output_cap)
+            return -1;
+        output[len++] = symbol;
+    }
+
+    // Skip the padding and give back the whole bytes left in the reservoir
+    *consumed = stream.pos - stream.count / 8;
+    *output_len = len;
+
+    return 0;
+}
+
+/**
+ * Decode the next symbol of stream through the decode table of dec.
+ *
+ * Once fewer than MAX_CODE_BITS bits are left, the reservoir is topped up to
+ * at least 57 bits unless input runs out, so most symbols are decoded without
+ * touching the input. The bits past count always hold the input that
+ * follows, so a partial byte loaded by the fast path is loaded again
+ * unchanged.
+ *
+ * Return the symbol, or -1 if its code runs past the end of the input.
+ */
+static ALWAYS_INLINE int decode_symbol(const DECODER* dec, BIT_STREAM* stream) {
+    const unsigned char* input = stream->input;
+    uint64_t bits = stream->bits;
+    int count = stream->count;
+    size_t pos = stream->pos;
+    int table_bits = dec->table_bits;
+    int symbol;
+
+    if (count < MAX_CODE_BITS) {
+        if (stream->len - pos >= 8) {
+            uint64_t word = load_u64(input + pos);
+
+            bits |= word >> count;
+            pos += (63 - count) >> 3;
+            count |= 56;
+        } else {
+            while (count <= 56 && pos < stream->len) {
+                bits |= (uint64_t) input[pos++] << (56 - count);
+                count += 8;
             }
         }
+    }
 
-        // Output symbol at leaf unless leaf is end block
-        int symbol = ptr->symbol;
-        if (symbol == 256) {
-            end_block = 1;
-        } else {
-            fputc(symbol & 0xFF, stdout);
+    DECODE_ENTRY entry = dec->decode_table[bits >> (64 - table_bits)];
+
+    if (entry.length != 0) {
+        // Return -1 if the code runs past the end of the input
+        if (entry.length > count)
+            return -1;
+
+        bits <<= entry.length;
+        count -= entry.length;
+        symbol = entry.symbol;
+    } else if (dec->canonical) {
+        // Find the length of a long code from the limits of each length
+        int length = table_bits + 1;
+        while (length < dec->max_length && bits >= dec->limit[length])
+            length++;
+
+        if (length > count)
+            return -1;
+
+        uint32_t code = bits >> (64 - length);
+        symbol = dec->sorted_symbols[dec->offset[length] + code - dec->first_code[length]];
+        bits <<= length;
+        count -= length;
+    } else {
+        if (count < table_bits)
+            return -1;
+
+        bits <<= table_bits;
+        count -= table_bits;
+
+        // Finish decoding a long code by traversing the Huffman tree
+        int node = entry.symbol;
+        while (!IS_LEAF(&dec->tree, node)) {
+            if (count == 0) {
+                if (pos == stream->len)
+                    return -1;
+
+                bits = (uint64_t) input[pos++] << 56;
+                count = 8;
+            }
+
+            node = dec->tree.child[node][bits >> 63];
+            bits <<= 1;
+            count--;
         }
+        symbol = dec->tree.symbol[node];
     }
 
-    // Return -1 if error indicator associated with stdout is set
-    if (ferror(stdout))
-        return -1;
+    stream->bits = bits;
+    stream->count = count;
+    stream->pos = pos;
 
-    return 0;
+    return symbol;
+}
+
+/**
+ * Return the eight bytes at ptr as a big-endian integer.
+ */
+static ALWAYS_INLINE uint64_t load_u64(const unsigned char* ptr) {
+    uint64_t word;
+
+    memcpy(&word, ptr, 8);
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap64(word);
+#elif !defined(__GNUC__)
+    word = 0;
+    for (int i = 0; i < 8; i++)
+        word = (word << 8) | ptr[i];
+#endif
+
+    return word;
 }
 
 /**
- * Read a description of a Huffman tree from standard input and reconstruct the
- * tree from the description.
+ * Decode the num_symbols symbols of a block split into num_streams streams
+ * from input, which holds the jump table and the streams, into output with
+ * the decode table of dec. The streams are decoded together, one symbol of
+ * each in turn, so that the decoding of one does not wait on the others.
  *
- * Return 0 if the tree is reconstructed without error or 1 if EOF is
- * encountered at the start of a block. Otherwise, return -1.
+ * Return 0 if every stream decodes to its symbols and ends with its input.
+ * Otherwise, return -1.
  */
-int reconstruct_huffman_tree(void) {
-    // Determine number of nodes from first two bytes read
-    int byte = fgetc(stdin);
-    if (byte == EOF) {
-        // Return -1 if error indicator associated with stdin is set
-        if (ferror(stdin))
+int decode_streams(const DECODER* dec, int num_streams, const unsigned char* input, size_t input_len,
+                   unsigned char* output, size_t num_symbols) {
+    size_t segment = num_symbols / num_streams; // # of symbols of every stream but the last
+    size_t pos = 4 * (num_streams - 1);
+    BIT_STREAM streams[MAX_STREAMS];
+
+    if (input_len < pos)
+        return -1;
+
+    // Locate each stream from the jump table
+    for (int k = 0; k < num_streams; k++) {
+        size_t len = (k < num_streams - 1) ? get_u32(input + 4 * k) : input_len - pos;
+
+        if (len > input_len - pos)
             return -1;
 
-        // Return 1 if there is nothing left to decompress
-        return 1;
+        streams[k] = (BIT_STREAM) {.input = input + pos, .len = len};
+        pos += len;
     }
-    num_nodes = fgetc(stdin);
-    if (num_nodes == EOF)
+
+    size_t i = 0;
+
+    /*
+     * While every code is in the decode table and every stream has eight bytes
+     * left to load, a symbol takes a single lookup and cannot run past the end
+     * of its stream. Symbols are checked once per round; only the end block
+     * symbol can be out of range.
+     */
+    if (dec->max_length <= dec->table_bits) {
+        const DECODE_ENTRY* table = dec->decode_table;
+        int shift = 64 - dec->table_bits;
+
+        for (; i < segment; i++) {
+            int invalid = 0;
+
+            for (int k = 0; k < num_streams; k++)
+                invalid |= streams[k].len - streams[k].pos < 8;
+            if (invalid)
+                break;
+
+            for (int k = 0; k < num_streams; k++) {
+                BIT_STREAM* stream = streams + k;
+
+                if (stream->count < MAX_CODE_BITS) {
+                    stream->bits |= load_u64(stream->input + stream->pos) >> stream->count;
+                    stream->pos += (63 - stream->count) >> 3;
+                    stream->count |= 56;
+                }
+
+                DECODE_ENTRY entry = table[stream->bits >> shift];
+                stream->bits <<= entry.length;
+                stream->count -= entry.length;
+                output[k * segment + i] = entry.symbol;
+                invalid |= entry.symbol;
+            }
+            if (invalid > 255)
+                return -1;
+        }
+    }
+
+    // Decode a symbol of each stream in turn while they all have symbols left
+    for (; i < segment; i++) {
+        for (int k = 0; k < num_streams; k++) {
+            int symbol = decode_symbol(dec, streams + k);
+
+            if (symbol < 0 || symbol > 255)
+                return -1;
+            output[k * segment + i] = symbol;
+        }
+    }
+
+    // Finish the last stream, which holds the symbols left over
+    BIT_STREAM* last = streams + num_streams - 1;
+    for (size_t i = num_streams * segment; i < num_symbols; i++) {
+        int symbol = decode_symbol(dec, last);
+
+        if (symbol < 0 || symbol > 255)
+            return -1;
+        output[i] = symbol;
+    }
+
+    // Return -1 unless each stream ends with its last symbol and padding
+    for (int k = 0; k < num_streams; k++) {
+        if (streams[k].pos - streams[k].count / 8 != streams[k].len)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Return the length of the longest path from the root to a leaf, which is the
+ * length of the longest code of the Huffman tree. The nodes are visited in
+ * order of number, so the depth of every node is known by the time it is
+ * visited, from that of its parent.
+ */
+int tree_depth(const TREE* tree) {
+    uint16_t depths[MAX_NODES];
+    int max_depth = 0;
+
+    depths[0] = 0;
+    for (int node = 0; node < tree->num_nodes; node++) {
+        if (IS_LEAF(tree, node)) {
+            if (depths[node] > max_depth)
+                max_depth = depths[node];
+        } else {
+            depths[tree->child[node][0]] = depths[node] + 1;
+            depths[tree->child[node][1]] = depths[node] + 1;
+        }
+    }
+
+    return max_depth;
+}
+
+/**
+ * Fill the decode table of dec, indexed by dec->table_bits bits, with the
+ * codes of its Huffman tree. As in tree_depth(), the nodes are visited in
+ * order of number, deriving the path to each node from that of its parent.
+ * Paths are only followed as deep as the table bits; the nodes below are
+ * reached through a tree traversal when decoding.
+ */
+void build_decode_table(DECODER* dec) {
+    const TREE* tree = &dec->tree;
+    int table_bits = dec->table_bits;
+    unsigned int codes[MAX_NODES];
+    unsigned char lengths[MAX_NODES]; // Up to table_bits, or table_bits + 1 below
+
+    codes[0] = 0;
+    lengths[0] = 0;
+    for (int node = 0; node < tree->num_nodes; node++) {
+        unsigned int code = codes[node];
+        int length = lengths[node];
+
+        if (IS_LEAF(tree, node)) {
+            if (length > table_bits)
+                continue;
+
+            // Every index that starts with the code of the leaf decodes to it
+            int shift = table_bits - length;
+            DECODE_ENTRY entry = {.symbol = tree->symbol[node], .length = length};
+            for (unsigned int i = code << shift; i < (code + 1) << shift; i++)
+                dec->decode_table[i] = entry;
+            continue;
+        }
+
+        // Codes in this subtree are finished through a tree traversal
+        if (length == table_bits) {
+            DECODE_ENTRY entry = {.symbol = node, .length = 0};
+            dec->decode_table[code] = entry;
+        }
+
+        int child_length = (length < table_bits) ? length + 1 : table_bits + 1;
+        codes[tree->child[node][0]] = code << 1;
+        codes[tree->child[node][1]] = (code << 1) | 1;
+        lengths[tree->child[node][0]] = child_length;
+        lengths[tree->child[node][1]] = child_length;
+    }
+}
+
+/**
+ * Read a description of a Huffman tree from input, starting at *pos, and
+ * reconstruct the tree from the description in dec. *pos is advanced past
+ * the description.
+ *
+ * Return 0 if the tree is reconstructed without error. Otherwise, return -1.
+ */
+int reconstruct_huffman_tree(DECODER* dec, const unsigned char* input, size_t input_len, size_t* pos) {
+    TREE* tree = &dec->tree;
+
+    // Determine number of nodes from first two bytes read
+    if (input_len - *pos < 3)
         return -1;
-    num_nodes |= byte << 8;
+    tree->num_nodes = input[*pos] << 8 | input[*pos + 1];
+    *pos += 2;
 
-    int buffer = fgetc(stdin); // Buffer to hold bytes
-    if (buffer == EOF)
+    // Return -1 if the node count cannot describe a Huffman tree
+    int num_nodes = tree->num_nodes;
+    if (num_nodes % 2 == 0 || num_nodes > MAX_NODES)
         return -1;
+
+    int buffer = input[(*pos)++]; // Buffer to hold bytes
     int bit_num = 7; // Counter to track bit position
     int top = -1; // Top of the stack
 
     // Reconstruct Huffman tree from description
     for (int i = 0, j = num_nodes - 1; i < num_nodes; i++) {
         if (buffer & (1 << bit_num)) {
-            // Pop two nodes and move to high-end of array
-            NODE right = nodes[top];
-            NODE left = nodes[top - 1];
-            nodes[j] = right;
-            nodes[j - 1] = left;
+            // Return -1 if there are fewer than two nodes to pop
+            if (top < 1)
+                return -1;
+
+            // Pop two nodes and move to high-end of tree
+            memcpy(tree->child[j], tree->child[top], sizeof(tree->child[0]));
+            memcpy(tree->child[j - 1], tree->child[top - 1], sizeof(tree->child[0]));
             top--;
 
             // Push the new parent node onto the stack
-            (nodes + top)->left = nodes + j - 1;
-            (nodes + top)->right = nodes + j;
+            tree->child[top][0] = j - 1;
+            tree->child[top][1] = j;
 
             j -= 2;
         } else {
             // Push a new leaf node onto the stack
             top++;
-            (nodes + top)->left = NULL;
-            (nodes + top)->right = NULL;
+            tree->child[top][0] = 0;
+            tree->child[top][1] = 0;
         }
 
         if (bit_num == 0 && i != num_nodes - 1) {
-            buffer = fgetc(stdin);
-
-            if (buffer == EOF)
+            if (*pos == input_len)
                 return -1;
 
+            buffer = input[(*pos)++];
             bit_num = 7;
         } else {
             bit_num--;
         }
     }
 
+    // Return -1 if the description does not end with a single tree
+    if (top != 0)
+        return -1;
+
     // Assign symbol values to leaves from left to right of tree
-    label_leaves(nodes);
-    if (feof(stdin) || ferror(stdin))
+    return label_leaves(tree, input, input_len, pos);
+}
+
+/**
+ * Read the code lengths of a block with a canonical header from input,
+ * starting at *pos, and build the decode table of dec from them, in the
+ * layout written by output_code_lengths(). *pos is advanced past the header.
+ *
+ * Return 0 if the lengths describe a complete code within the code length
+ * limit of dec. Otherwise, return -1.
+ */
+int read_code_lengths(DECODER* dec, const unsigned char* input, size_t input_len, size_t* pos) {
+    unsigned char lengths[MAX_SYMBOLS] = {0};
+
+    if (parse_code_lengths(dec, input, input_len, pos, lengths) == -1)
+        return -1;
+
+    return build_canonical_table(dec, lengths);
+}
+
+/**
+ * Read the code lengths of a canonical header from input, starting at *pos,
+ * into lengths, which must hold zeroes, as read_code_lengths() does, storing
+ * the longest in dec->max_length. *pos is advanced past the header.
+ *
+ * Return 0 if the header is read without error and its longest code is
+ * within the code length limit of dec. Otherwise, return -1.
+ */
+int parse_code_lengths(DECODER* dec, const unsigned char* input, size_t input_len, size_t* pos,
+                       unsigned char* lengths) {
+    uint32_t buffer = 0; // Bits read but not yet used, in the low bits
+    int count = 0; // Number of bits in buffer
+    int width = 0; // Number of bits in each stored length
+
+    if (*pos == input_len)
+        return -1;
+    dec->max_length = input[(*pos)++];
+
+    if (dec->max_length == 0 || dec->max_length > MAX_CODE_BITS ||
+        (dec->max_code_length != 0 && dec->max_length > dec->max_code_length))
+        return -1;
+
+    while ((1 << width) < dec->max_length)
+        width++;
+
+    int length = get_bits(input, input_len, pos, &buffer, &count, width);
+    if (length == -1)
         return -1;
+    lengths[256] = length + 1;
+
+    int group_mask = get_bits(input, input_len, pos, &buffer, &count, 16);
+    for (int group = 0; group < 16 && group_mask != -1; group++) {
+        if (!(group_mask & (0x8000 >> group)))
+            continue;
+
+        int symbol_mask = get_bits(input, input_len, pos, &buffer, &count, 16);
+        if (symbol_mask == -1)
+            return -1;
+
+        for (int i = 0; i < 16; i++) {
+            if (symbol_mask & (0x8000 >> i)) {
+                length = get_bits(input, input_len, pos, &buffer, &count, width);
+                if (length == -1)
+                    return -1;
+                lengths[16 * group + i] = length + 1;
+            }
+        }
+    }
+
+    return (group_mask == -1) ? -1 : 0;
+}
+
+/**
+ * Read the next num_bits bits, at most 16, most significant bit first. Bits
+ * are read from input a byte at a time, starting at *pos, into the low bits
+ * of *buffer, which holds *count bits not yet used.
+ *
+ * Return the value of the bits, or -1 if input ends first.
+ */
+int get_bits(const unsigned char* input, size_t input_len, size_t* pos, uint32_t* buffer, int* count,
+             int num_bits) {
+    while (*count < num_bits) {
+        if (*pos == input_len)
+            return -1;
+
+        *buffer = (*buffer << 8) | input[(*pos)++];
+        *count += 8;
+    }
+
+    *count -= num_bits;
+
+    return (*buffer >> *count) & ((1u << num_bits) - 1);
+}
+
+/**
+ * Build the decode table of dec, and the first codes, limits, and offsets of
+ * each length of the longer codes, for the canonical codes with the given
+ * lengths. dec->max_length holds the length of the longest code.
+ *
+ * Return 0 if the lengths describe a complete code. Otherwise, return -1.
+ */
+int build_canonical_table(DECODER* dec, const unsigned char* lengths) {
+    int max_length = dec->max_length;
+    int count[MAX_CODE_BITS + 1] = {0}; // Number of codes of each length
+
+    for (int i = 0; i < MAX_SYMBOLS; i++)
+        count[lengths[i]]++;
+
+    // Return -1 if a length is longer than the longest
+    for (int length = max_length + 1; length <= MAX_CODE_BITS; length++) {
+        if (count[length] != 0)
+            return -1;
+    }
+
+    // Number the codes of each length after those of the shorter lengths,
+    // returning -1 if the codes of a length overflow or leave a gap at the end
+    uint64_t code = 0;
+    int offset = 0;
+    for (int length = 1; length <= max_length; length++) {
+        dec->first_code[length] = code;
+        dec->offset[length] = offset;
+        code += count[length];
+        offset += count[length];
+
+        if (code > ((uint64_t) 1 << length) || (length == max_length && code != ((uint64_t) 1 << length)))
+            return -1;
+
+        dec->limit[length] = code << (64 - length);
+        code <<= 1;
+    }
+
+    // Sort the symbols by code length, then by symbol value
+    int next[MAX_CODE_BITS + 1];
+    for (int length = 1; length <= max_length; length++)
+        next[length] = dec->offset[length];
+
+    for (int i = 0; i < MAX_SYMBOLS; i++) {
+        if (lengths[i] != 0)
+            dec->sorted_symbols[next[lengths[i]]++] = i;
+    }
+
+    // Fill the decode table with the codes that fit in it, which take up its
+    // first entries since canonical codes grow with their length. The rest of
+    // the table starts codes that are longer.
+    int table_bits = (max_length <= DECODE_TABLE_MAX_BITS) ? max_length : DECODE_TABLE_BITS;
+    unsigned int index = 0;
+
+    dec->table_bits = table_bits;
+
+    for (int i = 0; i < offset; i++) {
+        int symbol = dec->sorted_symbols[i];
+        int length = lengths[symbol];
+
+        if (length > table_bits)
+            break;
+
+        DECODE_ENTRY entry = {.symbol = symbol, .length = length};
+        for (unsigned int end = index + (1u << (table_bits - length)); index < end; index++)
+            dec->decode_table[index] = entry;
+    }
+
+    DECODE_ENTRY entry = {.symbol = 0, .length = 0};
+    while (index < (1u << table_bits))
+        dec->decode_table[index++] = entry;
 
     return 0;
 }
 
 /**
- * Save the symbol values at the leaf nodes from the left to the right of the Huffman tree.
+ * Save the symbol values at the leaf nodes from the left to the right of the
+ * Huffman tree, reading them from input starting at *pos.
+ *
+ * Return 0 if every leaf is labeled. Otherwise, return -1.
  */
-void label_leaves(NODE* root) {
-    int buffer;
+int label_leaves(TREE* tree, const unsigned char* input, size_t input_len, size_t* pos) {
+    uint16_t stack[MAX_SYMBOLS]; // Roots of the subtrees left to visit
+    int top = 0;
+
+    stack[top++] = 0;
+    while (top > 0) {
+        int node = stack[--top];
 
-    if (root->left != NULL)
-        label_leaves(root->left);
+        if (!IS_LEAF(tree, node)) {
+            stack[top++] = tree->child[node][1];
+            stack[top++] = tree->child[node][0];
+            continue;
+        }
 
-    if (root->right != NULL)
-        label_leaves(root->right);
+        // Save symbol values to corresponding leaves
+        if (*pos == input_len)
+            return -1;
 
-    // Save symbol values to corresponding leaves
-    if (root->left == NULL && root->right == NULL) {
-        buffer = fgetc(stdin);
+        int buffer = input[(*pos)++];
 
-        if ((buffer & 0xFF) != 0xFF) {
-            root->symbol = buffer & 0xFF;
+        if (buffer != 0xFF) {
+            tree->symbol[node] = buffer;
         } else {
-            buffer = fgetc(stdin);
-            root->symbol = (buffer == 0) ? 256 : 255;
+            if (*pos == input_len)
+                return -1;
+
+            buffer = input[(*pos)++];
+            tree->symbol[node] = (buffer == 0) ? 256 : 255;
         }
     }
+
+    return 0;
+}
+
+/**
+ * Make at least n bytes of compressed data available in state->data, starting
+ * at state->pos, unless the input ends first. n must not be larger than
+ * state->buffer_size.
+ *
+ * Return the number of bytes available, which is less than n only at the end
+ * of the input or on error.
+ */
+size_t fill_input(DECOMPRESS_STATE* state, size_t n) {
+    if (state->len - state->pos < n && !state->eof) {
+        // Move the unread bytes to the front and read as much as fits
+        state->len -= state->pos;
+        memmove(state->buffer, state->buffer + state->pos, state->len);
+        state->pos = 0;
+
+        state->len += source_read(state->source, state->buffer + state->len, state->buffer_size - state->len);
+        if (state->len < state->buffer_size)
+            state->eof = 1;
+    }
+
+    return state->len - state->pos;
+}
+
+/**
+ * Make the input buffer of state hold at least size bytes, keeping the data
+ * it holds.
+ *
+ * Return 0 if the buffer is large enough. Otherwise, return -1.
+ */
+int reserve_input(DECOMPRESS_STATE* state, size_t size) {
+    if (state->buffer_size < size) {
+        unsigned char* buffer = realloc(state->buffer, size);
+        if (buffer == NULL)
+            return -1;
+
+        state->buffer = buffer;
+        state->data = buffer;
+        state->buffer_size = size;
+    }
+
+    return 0;
+}
+
+/**
+ * Pipeline stage run on the calling thread: read the next frame of a framed
+ * stream into the job and add its lengths to the index. The uncompressed
+ * length of the block is stored in job->output_len for
+ * decompress_block_job() to check. arg points to the DECOMPRESS_STATE of
+ * decompress_stream().
+ *
+ * Every block is numbered in job->table_id with the block whose code it uses.
+ * A repeat block also gets the header of that block in job->table, in case
+ * the worker decoding it does not hold the code.
+ *
+ * Return 0 if a frame is read, 1 at the end of the blocks or of the range, or
+ * -1 if the input is not a valid frame.
+ */
+int read_frame_job(JOB* job, void* arg) {
+    DECOMPRESS_STATE* state = arg;
+
+    if (state->ranged && state->num_blocks == state->end_block)
+        return 1;
+
+    BLOCK_STATS* stats = stats_job(&state->report, job);
+    uint64_t start = TIMER_START(stats);
+
+    if (fill_input(state, 4) < 4)
+        return -1;
+
+    uint32_t compressed_len = get_u32(state->data + state->pos);
+    if (compressed_len == 0) {
+        state->pos += 4;
+        return 1;
+    }
+
+    if (fill_input(state, FRAME_HEADER_SIZE) < FRAME_HEADER_SIZE)
+        return -1;
+    uint32_t uncompressed_len = get_u32(state->data + state->pos + 4);
+
+    // Return -1 if the lengths cannot come from a block of the block size
+    if (compressed_len > COMPRESS_BLOCK_BOUND(state->block_size) || uncompressed_len > (uint32_t) state->block_size)
+        return -1;
+
+    if (fill_input(state, FRAME_HEADER_SIZE + compressed_len) < FRAME_HEADER_SIZE + compressed_len)
+        return -1;
+
+    const unsigned char* input = state->data + state->pos + FRAME_HEADER_SIZE;
+    int type = state->block_types ? input[0] : BLOCK_HUFFMAN;
+
+    // Keep the header of a block with a new code, which takes at most
+    // MAX_HEADER_SIZE bytes after the type
+    if (type == BLOCK_HUFFMAN) {
+        state->table_id = state->num_blocks;
+        state->table_len = (compressed_len - 1 < MAX_HEADER_SIZE) ? compressed_len - 1 : MAX_HEADER_SIZE;
+        if (state->block_types)
+            memcpy(state->table, input + 1, state->table_len);
+    } else if (type == BLOCK_REPEAT) {
+        // Return -1 if there is no code to repeat
+        if (state->table_id == -1)
+            return -1;
+
+        memcpy(job->table, state->table, state->table_len);
+        job->table_len = state->table_len;
+    }
+
+    memcpy(job->input, input, compressed_len);
+    TIMER_STOP(stats, TIMER_IO, start);
+    job->input_len = compressed_len;
+    job->output_len = uncompressed_len;
+    job->table_id = state->table_id;
+    state->pos += FRAME_HEADER_SIZE + compressed_len;
+    state->num_blocks++;
+
+    return index_add(&state->index, compressed_len, uncompressed_len);
+}
+
+/**
+ * Pipeline stage run on a worker thread: decompress the block held by the
+ * job with the worker's own decoder, and check it against its checksum if
+ * blocks have one. The checksum is taken right after decoding, while the
+ * decompressed block is still in cache.
+ *
+ * A block that is not valid or does not match its checksum is marked in
+ * job->corrupt rather than failing the job, so that write_output_job() can
+ * tell which block is the first corrupt one.
+ *
+ * Return 0.
+ */
+int decompress_block_job(JOB* job, void* worker) {
+    DECODER* dec = worker;
+    size_t input_len = job->input_len;
+
+    dec->stats = job->stats;
+    job->corrupt = 0;
+
+    if (dec->checksums) {
+        // The checksum follows the type and contents of the block
+        if (input_len < 1 + CHECKSUM_SIZE) {
+            job->corrupt = 1;
+            return 0;
+        }
+        input_len -= CHECKSUM_SIZE;
+    }
+
+    if (decompress_frame(dec, job, job->input, input_len) == -1 ||
+        (dec->checksums && crc32c(0, job->output, job->output_len) != get_u32(job->input + input_len)))
+        job->corrupt = 1;
+
+    return 0;
+}
+
+/**
+ * Decompress the input_len bytes of the framed block at input into the job
+ * with dec, the number of symbols it holds being job->output_len. A stored
+ * block is copied as it is. A repeat block is decoded with the code the
+ * decoder holds if it is the one the block uses, so that a run of repeat
+ * blocks on one worker skips reading headers and building tables altogether.
+ * A static block is decoded with the decode table of the static table, which
+ * was built when the table was loaded.
+ *
+ * Return 0 if the block decompresses to exactly its recorded length.
+ * Otherwise, return -1.
+ */
+int decompress_frame(DECODER* dec, JOB* job, const unsigned char* input, size_t input_len) {
+    BLOCK_STATS* stats = job->stats;
+    size_t expected_len = job->output_len;
+    size_t consumed;
+
+    if (dec->block_types) {
+        if (input_len == 0)
+            return -1;
+
+        int type = input[0];
+        input++;
+        input_len--;
+
+        if (type == BLOCK_STORED) {
+            if (input_len != expected_len)
+                return -1;
+
+            uint64_t start = TIMER_START(stats);
+            memcpy(job->output, input, expected_len);
+            TIMER_STOP(stats, TIMER_DECODE, start);
+
+            if (stats != NULL) {
+                stats->type = BLOCK_STORED;
+                stats_output(stats, job->output, expected_len);
+            }
+            return 0;
+        }
+
+        if (type == BLOCK_REPEAT || type == BLOCK_STATIC) {
+            const DECODER* code = dec;
+
+            if (type == BLOCK_STATIC) {
+                // Return -1 if the stream was compressed without a table
+                if (dec->static_table == NULL)
+                    return -1;
+                code = &dec->static_table->dec;
+            } else if (dec->table_id != job->table_id) {
+                // Build the code from the header of the block it comes from
+                size_t pos = 0;
+
+                uint64_t start = TIMER_START(stats);
+                dec->table_id = -1;
+                if (read_block_header(dec, job->table, job->table_len, &pos) == -1 || dec->table_bits == 0)
+                    return -1;
+                dec->table_id = job->table_id;
+                TIMER_STOP(stats, TIMER_TREE, start);
+            }
+
+            uint64_t start = TIMER_START(stats);
+            if (decode_block(code, dec->num_streams, input, input_len, 0, &consumed, job->output, expected_len,
+                             &job->output_len) == -1)
+                return -1;
+            TIMER_STOP(stats, TIMER_DECODE, start);
+
+            if (consumed != input_len || job->output_len != expected_len)
+                return -1;
+
+            if (stats != NULL) {
+                stats->type = type;
+                stats->max_length = code->max_length;
+                stats_output(stats, job->output, expected_len);
+            }
+            return 0;
+        }
+
+        if (type != BLOCK_HUFFMAN)
+            return -1;
+    }
+
+    // The decoder holds the code of the block once its header is read
+    dec->table_id = -1;
+    if (decompress_block(dec, input, input_len, &consumed, job->output, expected_len, &job->output_len) == -1)
+        return -1;
+    dec->table_id = job->table_id;
+
+    if (consumed != input_len || job->output_len != expected_len)
+        return -1;
+
+    if (stats != NULL)
+        stats_output(stats, job->output, expected_len);
+
+    return 0;
+}
+
+/**
+ * Allocate the decoder used by one thread, set up for the DECOMPRESS_STATE
+ * that arg points to.
+ */
+void* new_decoder(void* arg) {
+    DECODER* dec = malloc(sizeof(DECODER));
+
+    if (dec != NULL)
+        init_decoder(dec, arg);
+
+    return dec;
+}
+
+/**
+ * Give dec the code length limit, header mode, number of streams, block
+ * types, checksums, and static table of state, holding no code yet.
+ */
+void init_decoder(DECODER* dec, const DECOMPRESS_STATE* state) {
+    dec->max_code_length = state->max_code_length;
+    dec->canonical = state->canonical;
+    dec->num_streams = state->num_streams;
+    dec->block_types = state->block_types;
+    dec->checksums = state->checksums;
+    dec->static_table = state->static_table;
+    dec->table_id = -1;
+    dec->stats = NULL;
+}
+
+/**
+ * Pipeline stage run on the calling thread: write the decompressed block of
+ * the job to the sink, or the part of it in the range of state, unless
+ * decompress_block_job() found it corrupt, which is recorded in
+ * state->bad_block.
+ *
+ * Return 0 if the block is written without error. Otherwise, return -1.
+ */
+int write_output_job(JOB* job, void* arg) {
+    DECOMPRESS_STATE* state = arg;
+    BLOCK_STATS* stats = job->stats;
+
+    if (job->corrupt) {
+        state->bad_block = state->num_written;
+        return -1;
+    }
+
+    uint64_t start = TIMER_START(stats);
+    if (write_range(state, job->output, job->output_len) == -1)
+        return -1;
+    TIMER_STOP(stats, TIMER_IO, start);
+    state->num_written++;
+
+    if (stats != NULL)
+        stats_block(&state->report, stats, job->output_len, job->input_len);
+
+    return 0;
+}
+
+/**
+ * Record in stats the number of distinct symbols of the output_len
+ * decompressed symbols at output and their entropy.
+ */
+void stats_output(BLOCK_STATS* stats, const unsigned char* output, size_t output_len) {
+    uint32_t counts[256];
+
+    histogram(output, output_len, counts);
+    stats_symbols(stats, counts, output_len);
 }
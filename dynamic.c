@@ -0,0 +1,473 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "huff.h"
+
+void put_dynamic_code(DYNAMIC_CODER* coder, int node, unsigned char* output, size_t* len);
+void put_dynamic_bits(DYNAMIC_CODER* coder, uint32_t value, int num_bits, unsigned char* output, size_t* len);
+void align_dynamic_bits(DYNAMIC_CODER* coder);
+int add_dynamic_leaf(DYNAMIC_CODER* coder, int symbol);
+void update_dynamic_tree(DYNAMIC_CODER* coder, int symbol);
+void swap_dynamic_nodes(DYNAMIC_CODER* coder, int a, int b);
+void attach_dynamic_node(DYNAMIC_CODER* coder, int node);
+void rebuild_dynamic_tree(DYNAMIC_CODER* coder);
+
+/**
+ * Read data from source, compress it to the dynamic format, and write it to
+ * sink. The input is coded a chunk at a time as it is read. A chunk read short
+ * from a pipe or terminal means that the input has paused, so the stream is
+ * then flushed and written out, rather than holding the bits of the last byte
+ * until more input arrives.
+ *
+ * Return 0 if compressing succeeds without error. Otherwise, return -1.
+ */
+int compress_dynamic(huff_ctx* ctx, SOURCE* source, SINK* sink) {
+    DYNAMIC_CODER coder;
+    size_t n, len;
+    int ret = 0;
+
+    if (ctx_reserve(ctx, DYNAMIC_CHUNK_SIZE, DYNAMIC_BOUND(DYNAMIC_CHUNK_SIZE)) == -1)
+        return -1;
+
+    init_dynamic(&coder);
+    len = write_dynamic_header(ctx->output);
+    if (sink_write(sink, ctx->output, len) == -1)
+        return -1;
+
+    while (ret == 0 && (n = source_read_some(source, ctx->input, DYNAMIC_CHUNK_SIZE)) > 0) {
+        int paused = (source->type == SOURCE_FD && n < DYNAMIC_CHUNK_SIZE);
+
+        len = dynamic_encode(&coder, ctx->input, n, ctx->output);
+        if (paused)
+            len += dynamic_flush(&coder, 0, ctx->output + len);
+
+        if (sink_write(sink, ctx->output, len) == -1 || (paused && sink_flush(sink) == -1))
+            ret = -1;
+    }
+
+    if (ret == 0 && source_error(source))
+        ret = -1;
+
+    if (ret == 0) {
+        len = dynamic_flush(&coder, 1, ctx->output);
+        ret = sink_write(sink, ctx->output, len);
+    }
+
+    if (sink_flush(sink) == -1)
+        return -1;
+
+    return ret;
+}
+
+/**
+ * Decompress a stream in the dynamic format, whose first byte is at
+ * state->pos, a chunk at a time. Input from a stream is read as it arrives,
+ * and whatever has been decoded is written out before waiting for more.
+ *
+ * Return 0 if decompression succeeds without error. Otherwise, return -1.
+ */
+int decompress_dynamic(huff_ctx* ctx, DECOMPRESS_STATE* state) {
+    DYNAMIC_CODER coder;
+
+    if (fill_input(state, DYNAMIC_HEADER_SIZE) < DYNAMIC_HEADER_SIZE ||
+        read_dynamic_header(state->data + state->pos) == -1 || ctx_reserve(ctx, 0, DYNAMIC_CHUNK_SIZE) == -1)
+        return -1;
+
+    state->pos += DYNAMIC_HEADER_SIZE;
+    init_dynamic(&coder);
+
+    while (1) {
+        size_t consumed, output_len;
+        int ret = dynamic_decode(&coder, state->data + state->pos, state->len - state->pos, &consumed,
+                                 ctx->output, DYNAMIC_CHUNK_SIZE, &output_len);
+
+        state->pos += consumed;
+        if (ret == -1 || write_range(state, ctx->output, output_len) == -1)
+            return -1;
+
+        if (ret == 1)
+            return 0;
+
+        // Read more input once all of it is decoded. Return -1 if the stream
+        // ends without DYNAMIC_END.
+        if (state->pos == state->len) {
+            if (state->eof || sink_flush(state->sink) == -1)
+                return -1;
+
+            state->pos = 0;
+            state->len = source_read_some(state->source, state->buffer, state->buffer_size);
+            state->eof = (state->len == 0);
+        }
+    }
+}
+
+/**
+ * Set up coder for a new stream in the dynamic format, whose tree holds only
+ * the leaf of DYNAMIC_ESCAPE.
+ */
+void init_dynamic(DYNAMIC_CODER* coder) {
+    for (int symbol = 0; symbol < MAX_SYMBOLS; symbol++)
+        coder->leaf_for_symbol[symbol] = -1;
+
+    coder->weight[0] = 1;
+    coder->parent[0] = -1;
+    coder->child[0] = 0;
+    coder->symbol[0] = DYNAMIC_ESCAPE;
+    coder->leaf_for_symbol[DYNAMIC_ESCAPE] = 0;
+    coder->num_nodes = 1;
+    coder->bits = 0;
+    coder->count = 0;
+    coder->node = 0;
+    coder->escaped = 0;
+}
+
+/**
+ * Write the header of the dynamic format to output.
+ *
+ * Return the number of bytes written, DYNAMIC_HEADER_SIZE.
+ */
+size_t write_dynamic_header(unsigned char* output) {
+    memcpy(output, DYNAMIC_MAGIC, DYNAMIC_HEADER_SIZE - 1);
+    output[DYNAMIC_HEADER_SIZE - 1] = DYNAMIC_VERSION;
+
+    return DYNAMIC_HEADER_SIZE;
+}
+
+/**
+ * Return 0 if the DYNAMIC_HEADER_SIZE bytes at input are the header of the
+ * dynamic format. Otherwise, return -1.
+ */
+int read_dynamic_header(const unsigned char* input) {
+    if (memcmp(input, DYNAMIC_MAGIC, DYNAMIC_HEADER_SIZE - 1) != 0 || input[DYNAMIC_HEADER_SIZE - 1] != DYNAMIC_VERSION)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Code the n symbols at input with the tree of coder, updating it after each
+ * of them, and write the whole bytes of the codes to output, which has room
+ * for DYNAMIC_BOUND(n) bytes. The bits of the last byte are kept in coder
+ * until more symbols or a control code complete it.
+ *
+ * Return the number of bytes written to output.
+ */
+size_t dynamic_encode(DYNAMIC_CODER* coder, const unsigned char* input, size_t n, unsigned char* output) {
+    size_t len = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        int symbol = input[i];
+
+        // Escape a symbol seen for the first time, and give it a leaf
+        if (coder->leaf_for_symbol[symbol] == -1) {
+            put_dynamic_code(coder, coder->leaf_for_symbol[DYNAMIC_ESCAPE], output, &len);
+            put_dynamic_bits(coder, symbol, DYNAMIC_VALUE_BITS, output, &len);
+            add_dynamic_leaf(coder, symbol);
+        } else {
+            put_dynamic_code(coder, coder->leaf_for_symbol[symbol], output, &len);
+        }
+
+        update_dynamic_tree(coder, symbol);
+    }
+
+    return len;
+}
+
+/**
+ * Write the bits kept in coder to output, which has room for DYNAMIC_BOUND(0)
+ * bytes, followed by DYNAMIC_END if end is nonzero, or else by DYNAMIC_FLUSH,
+ * and padded to a whole byte. A flush is left out when no bits are kept,
+ * since every code is then in the bytes already written.
+ *
+ * Return the number of bytes written to output.
+ */
+size_t dynamic_flush(DYNAMIC_CODER* coder, int end, unsigned char* output) {
+    size_t len = 0;
+
+    if (!end && coder->count == 0)
+        return 0;
+
+    put_dynamic_code(coder, coder->leaf_for_symbol[DYNAMIC_ESCAPE], output, &len);
+    put_dynamic_bits(coder, end ? DYNAMIC_END : DYNAMIC_FLUSH, DYNAMIC_VALUE_BITS, output, &len);
+
+    if (coder->count > 0)
+        put_dynamic_bits(coder, 0, 8 - coder->count, output, &len);
+
+    return len;
+}
+
+/**
+ * Decode the input_len bytes at input with the tree of coder, updating it
+ * after each symbol, into output, which has room for output_cap bytes.
+ * Decoding stops at the end of the stream, when input runs out, or when
+ * output is full. Bits of input not yet decoded, and the place reached in a
+ * code, are kept in coder, so decoding picks up where it stopped when called
+ * with the input that follows. The number of bytes of input used is stored in
+ * consumed, which leaves out those past the end of the stream, and the number
+ * of bytes decoded in output_len.
+ *
+ * Return 1 at the end of the stream, 0 if more input or room for output is
+ * needed, or -1 if input is not valid.
+ */
+int dynamic_decode(DYNAMIC_CODER* coder, const unsigned char* input, size_t input_len, size_t* consumed,
+                   unsigned char* output, size_t output_cap, size_t* output_len) {
+    size_t pos = 0;
+    size_t len = 0;
+    int ret = 0;
+
+    while (1) {
+        // Load whole bytes into the bits not yet decoded
+        while (coder->count <= 56 && pos < input_len) {
+            coder->bits |= (uint64_t) input[pos++] << (56 - coder->count);
+            coder->count += 8;
+        }
+
+        if (coder->escaped) {
+            if (coder->count < DYNAMIC_VALUE_BITS)
+                break;
+
+            int value = coder->bits >> (64 - DYNAMIC_VALUE_BITS);
+            coder->bits <<= DYNAMIC_VALUE_BITS;
+            coder->count -= DYNAMIC_VALUE_BITS;
+            coder->escaped = 0;
+
+            if (value == DYNAMIC_END) {
+                ret = 1;
+                break;
+            }
+
+            if (value == DYNAMIC_FLUSH) {
+                align_dynamic_bits(coder);
+                continue;
+            }
+
+            // Return -1 for a value that is neither a control code nor a
+            // symbol seen for the first time
+            if (value > 255 || coder->leaf_for_symbol[value] != -1)
+                return -1;
+
+            coder->node = add_dynamic_leaf(coder, value);
+        }
+
+        // Walk down from the node reached to a leaf
+        while (coder->child[coder->node] != 0 && coder->count > 0) {
+            coder->node = coder->child[coder->node] + (int) (coder->bits >> 63);
+            coder->bits <<= 1;
+            coder->count--;
+        }
+
+        if (coder->child[coder->node] != 0)
+            break;
+
+        int symbol = coder->symbol[coder->node];
+
+        if (symbol == DYNAMIC_ESCAPE) {
+            coder->escaped = 1;
+            coder->node = 0;
+            continue;
+        }
+
+        if (len == output_cap)
+            break;
+
+        output[len++] = symbol;
+        update_dynamic_tree(coder, symbol);
+        coder->node = 0;
+    }
+
+    // Give back the bytes loaded past the padding after the end
+    if (ret == 1) {
+        align_dynamic_bits(coder);
+        pos -= coder->count / 8;
+        coder->bits = 0;
+        coder->count = 0;
+    }
+
+    *consumed = pos;
+    *output_len = len;
+
+    return ret;
+}
+
+/**
+ * Write the code of the leaf node of the tree of coder to output, at *len,
+ * and add the number of whole bytes written to *len.
+ */
+void put_dynamic_code(DYNAMIC_CODER* coder, int node, unsigned char* output, size_t* len) {
+    uint32_t code = 0;
+    int length = 0;
+
+    // Collect the code from the leaf up, so that the bit below the root ends
+    // up the most significant
+    for (; node != 0; node = coder->parent[node]) {
+        code |= (uint32_t) (node - coder->child[coder->parent[node]]) << length;
+        length++;
+    }
+
+    put_dynamic_bits(coder, code, length, output, len);
+}
+
+/**
+ * Write the num_bits (at most 32) least significant bits of value to output,
+ * at *len, most significant bit first, after the bits kept in coder, and add
+ * the number of whole bytes written to *len. The bits of an incomplete byte
+ * are kept in coder.
+ */
+void put_dynamic_bits(DYNAMIC_CODER* coder, uint32_t value, int num_bits, unsigned char* output, size_t* len) {
+    coder->bits = (coder->bits << num_bits) | value;
+    coder->count += num_bits;
+
+    while (coder->count >= 8) {
+        coder->count -= 8;
+        output[(*len)++] = coder->bits >> coder->count;
+    }
+}
+
+/**
+ * Drop the bits not yet decoded by coder up to the next whole byte of input,
+ * the padding after a control code.
+ */
+void align_dynamic_bits(DYNAMIC_CODER* coder) {
+    coder->bits <<= coder->count % 8;
+    coder->count -= coder->count % 8;
+}
+
+/**
+ * Give symbol a leaf of weight 0 in the tree of coder. The last node, which
+ * weighs the least and is therefore a leaf, becomes the parent of itself and
+ * the new leaf, which keeps the sibling property.
+ *
+ * Return the node of the new leaf.
+ */
+int add_dynamic_leaf(DYNAMIC_CODER* coder, int symbol) {
+    int parent = coder->num_nodes - 1;
+    int moved = parent + 1;
+    int leaf = parent + 2;
+
+    coder->weight[moved] = coder->weight[parent];
+    coder->child[moved] = 0;
+    coder->symbol[moved] = coder->symbol[parent];
+    coder->parent[moved] = parent;
+    coder->leaf_for_symbol[coder->symbol[moved]] = moved;
+
+    coder->weight[leaf] = 0;
+    coder->child[leaf] = 0;
+    coder->symbol[leaf] = symbol;
+    coder->parent[leaf] = parent;
+    coder->leaf_for_symbol[symbol] = leaf;
+
+    coder->child[parent] = moved;
+    coder->symbol[parent] = -1;
+    coder->num_nodes += 2;
+
+    return leaf;
+}
+
+/**
+ * Count one more occurrence of symbol, which has a leaf, in the tree of
+ * coder. First, if the root has reached DYNAMIC_MAX_WEIGHT, the weights are
+ * halved and the tree rebuilt.
+ */
+void update_dynamic_tree(DYNAMIC_CODER* coder, int symbol) {
+    if (coder->weight[0] >= DYNAMIC_MAX_WEIGHT)
+        rebuild_dynamic_tree(coder);
+
+    // Move each node from the leaf up to the first of the nodes of its weight
+    // before incrementing it, so that the weights still do not increase with
+    // the number of the node. Every weight but that of a new leaf is at least
+    // 1, so a node weighs more than its children, and the node it moves to is
+    // never one of its ancestors.
+    int node = coder->leaf_for_symbol[symbol];
+
+    while (1) {
+        int first = node;
+
+        while (first > 0 && coder->weight[first - 1] == coder->weight[node])
+            first--;
+
+        if (first != node) {
+            swap_dynamic_nodes(coder, first, node);
+            node = first;
+        }
+
+        coder->weight[node]++;
+
+        if (node == 0)
+            break;
+
+        node = coder->parent[node];
+    }
+}
+
+/**
+ * Swap the subtrees at nodes a and b of the tree of coder, which have the same
+ * weight. The parent of each node stays with the node's number.
+ */
+void swap_dynamic_nodes(DYNAMIC_CODER* coder, int a, int b) {
+    uint16_t child = coder->child[a];
+    short symbol = coder->symbol[a];
+
+    coder->child[a] = coder->child[b];
+    coder->symbol[a] = coder->symbol[b];
+    coder->child[b] = child;
+    coder->symbol[b] = symbol;
+
+    attach_dynamic_node(coder, a);
+    attach_dynamic_node(coder, b);
+}
+
+/**
+ * Point the children of node, or the leaf of its symbol if it is a leaf, at
+ * node.
+ */
+void attach_dynamic_node(DYNAMIC_CODER* coder, int node) {
+    if (coder->child[node] == 0) {
+        coder->leaf_for_symbol[coder->symbol[node]] = node;
+    } else {
+        coder->parent[coder->child[node]] = node;
+        coder->parent[coder->child[node] + 1] = node;
+    }
+}
+
+/**
+ * Halve the weights of the leaves of the tree of coder, rounding up so that
+ * none that weighs at least 1 drops to 0, and rebuild the Huffman tree of the
+ * new weights.
+ *
+ * The leaves are moved, in order, to the last nodes. The two lightest nodes
+ * not yet given a parent are always the last two of them, so the internal
+ * nodes are made from the last two up, and each is put before the nodes that
+ * weigh the same as or less than it, which keeps the sibling property.
+ */
+void rebuild_dynamic_tree(DYNAMIC_CODER* coder) {
+    int node = coder->num_nodes - 1;
+
+    for (int i = coder->num_nodes - 1; i >= 0; i--) {
+        if (coder->child[i] == 0) {
+            coder->weight[node] = (coder->weight[i] + 1) / 2;
+            coder->child[node] = 0;
+            coder->symbol[node] = coder->symbol[i];
+            node--;
+        }
+    }
+
+    for (int first = coder->num_nodes - 2; node >= 0; first -= 2, node--) {
+        uint32_t weight = coder->weight[first] + coder->weight[first + 1];
+        int i = node;
+
+        // Shift the heavier nodes up by one to make room
+        for (; coder->weight[i + 1] > weight; i++) {
+            coder->weight[i] = coder->weight[i + 1];
+            coder->child[i] = coder->child[i + 1];
+            coder->symbol[i] = coder->symbol[i + 1];
+        }
+
+        coder->weight[i] = weight;
+        coder->child[i] = first;
+        coder->symbol[i] = -1;
+    }
+
+    for (int i = 0; i < coder->num_nodes; i++)
+        attach_dynamic_node(coder, i);
+}
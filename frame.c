@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <string.h>
+#include "huff.h"
+
+size_t put_varint(unsigned char* ptr, uint32_t value);
+int get_varint(const unsigned char* ptr, size_t len, uint32_t* value);
+
+/**
+ * Store value at ptr as a four-byte big-endian integer.
+ */
+void put_u32(unsigned char* ptr, uint32_t value) {
+    ptr[0] = value >> 24;
+    ptr[1] = value >> 16;
+    ptr[2] = value >> 8;
+    ptr[3] = value;
+}
+
+/**
+ * Return the four-byte big-endian integer stored at ptr.
+ */
+uint32_t get_u32(const unsigned char* ptr) {
+    return (uint32_t) ptr[0] << 24 | (uint32_t) ptr[1] << 16 | (uint32_t) ptr[2] << 8 | ptr[3];
+}
+
+/**
+ * Store value at ptr as a varint of the message format, seven bits at a time,
+ * least significant first.
+ *
+ * Return the number of bytes stored.
+ */
+size_t put_varint(unsigned char* ptr, uint32_t value) {
+    size_t len = 0;
+
+    while (value >= 0x80) {
+        ptr[len++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    ptr[len++] = value;
+
+    return len;
+}
+
+/**
+ * Read the varint of the message format stored in the len bytes at ptr into
+ * value.
+ *
+ * Return the number of bytes of the varint, 0 if it does not end within the
+ * len bytes, or -1 if it is longer than MESSAGE_MAX_VARINT_SIZE bytes.
+ */
+int get_varint(const unsigned char* ptr, size_t len, uint32_t* value) {
+    *value = 0;
+
+    for (int i = 0; i < MESSAGE_MAX_VARINT_SIZE; i++) {
+        if ((size_t) i == len)
+            return 0;
+
+        *value |= (uint32_t) (ptr[i] & 0x7f) << (7 * i);
+        if ((ptr[i] & 0x80) == 0)
+            return i + 1;
+    }
+
+    return -1;
+}
+
+/**
+ * Store the header of a message compressed with the table whose ID is
+ * table_id at output.
+ *
+ * Return the size of the header.
+ */
+size_t put_message_header(unsigned char* output, uint32_t table_id, uint32_t uncompressed_len,
+                          uint32_t compressed_len) {
+    size_t len = 1;
+
+    output[0] = MESSAGE_MAGIC;
+    put_u32(output + len, table_id);
+    len += 4;
+    len += put_varint(output + len, uncompressed_len);
+    len += put_varint(output + len, compressed_len);
+
+    return len;
+}
+
+/**
+ * Read the header of a message from the len bytes at input, storing the ID of
+ * its table and its lengths in header. A header whose uncompressed length is
+ * 0 or more than MAX_BLOCK_SIZE, or whose compressed length is more than
+ * COMPRESS_BLOCK_BOUND() of it, is invalid, so that a corrupt header cannot
+ * make the decompressor allocate or wait for more than a block.
+ *
+ * Return the size of the header, 0 if it does not end within the len bytes,
+ * or -1 if it is invalid.
+ */
+int read_message_header(const unsigned char* input, size_t len, MESSAGE_HEADER* header) {
+    int pos = 1 + 4;
+
+    if (len < (size_t) pos)
+        return 0;
+    if (input[0] != MESSAGE_MAGIC)
+        return -1;
+
+    header->table_id = get_u32(input + 1);
+
+    int n = get_varint(input + pos, len - pos, &header->uncompressed_len);
+    if (n <= 0)
+        return n;
+    pos += n;
+
+    n = get_varint(input + pos, len - pos, &header->compressed_len);
+    if (n <= 0)
+        return n;
+    pos += n;
+
+    if (header->uncompressed_len == 0 || header->uncompressed_len > MAX_BLOCK_SIZE ||
+        header->compressed_len > COMPRESS_BLOCK_BOUND(header->uncompressed_len))
+        return -1;
+
+    return pos;
+}
+
+/**
+ * Append the lengths of a block to the index.
+ *
+ * Return 0 if the lengths are added without error. Otherwise, return -1.
+ */
+int index_add(BLOCK_INDEX* index, uint32_t compressed_len, uint32_t uncompressed_len) {
+    if (index->num_blocks == index->capacity) {
+        size_t capacity = (index->capacity == 0) ? 64 : 2 * index->capacity;
+        uint32_t* lengths = realloc(index->lengths, 2 * capacity * sizeof(uint32_t));
+
+        if (lengths == NULL)
+            return -1;
+
+        index->lengths = lengths;
+        index->capacity = capacity;
+    }
+
+    index->lengths[2 * index->num_blocks] = compressed_len;
+    index->lengths[2 * index->num_blocks + 1] = uncompressed_len;
+    index->num_blocks++;
+
+    return 0;
+}
+
+/**
+ * Write the end of the blocks of a framed stream to sink: the empty frame
+ * header, the index, and the trailer.
+ *
+ * Return 0 if the index is written without error. Otherwise, return -1.
+ */
+int write_index(const BLOCK_INDEX* index, SINK* sink) {
+    unsigned char bytes[TRAILER_SIZE];
+
+    put_u32(bytes, 0);
+    if (sink_write(sink, bytes, 4) == -1)
+        return -1;
+
+    for (size_t i = 0; i < 2 * index->num_blocks; i++) {
+        put_u32(bytes, index->lengths[i]);
+        if (sink_write(sink, bytes, 4) == -1)
+            return -1;
+    }
+
+    put_u32(bytes, index->num_blocks);
+    memcpy(bytes + 4, FRAME_INDEX_MAGIC, 4);
+
+    return sink_write(sink, bytes, TRAILER_SIZE);
+}
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "huff.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2_HISTOGRAM 1
+#else
+#define HAVE_AVX2_HISTOGRAM 0
+#endif
+
+/**
+ * Counting bytes one at a time into a single table serializes on the counter
+ * of a byte that repeats, since each increment has to wait for the previous
+ * one to be stored. The histogram functions spread consecutive bytes over
+ * HISTOGRAM_LANES tables, which are summed at the end.
+ */
+#define HISTOGRAM_LANES 4
+
+void count_lanes(const unsigned char* block, size_t n, uint32_t lanes[][256]);
+void sum_lanes(uint32_t lanes[][256], uint32_t* counts);
+void select_histogram(void);
+
+static HISTOGRAM_FUNC histogram_impl = histogram_scalar;
+static HISTOGRAM_CRC32C_FUNC histogram_crc32c_impl = NULL;
+static pthread_once_t histogram_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Count the occurrences of each byte value in the n bytes of block into
+ * counts, which has 256 entries, with the fastest implementation the CPU
+ * supports.
+ */
+void histogram(const unsigned char* block, size_t n, uint32_t* counts) {
+    pthread_once(&histogram_once, select_histogram);
+    histogram_impl(block, n, counts);
+}
+
+/**
+ * Return the number of bits taken by the n bytes counted in counts when each
+ * byte is coded in -log2(count / n) bits. That is the entropy of the bytes,
+ * which no prefix code of them can beat, so it bounds from below the length
+ * of a Huffman-coded block without building its Huffman tree.
+ */
+double entropy_bits(const uint32_t* counts, size_t n) {
+    double bits = 0;
+
+    for (int symbol = 0; symbol < 256; symbol++) {
+        if (counts[symbol] != 0)
+            bits -= counts[symbol] * log2((double) counts[symbol] / n);
+    }
+
+    return bits;
+}
+
+/**
+ * Count the occurrences of each byte value in the n bytes of block into
+ * counts like histogram(), and return the CRC32C of block. Where the CPU
+ * supports histogram_crc32c_simd(), both come from the same pass over block;
+ * otherwise, the CRC is computed by a second pass while block is in cache.
+ */
+uint32_t histogram_crc32c(const unsigned char* block, size_t n, uint32_t* counts) {
+    pthread_once(&histogram_once, select_histogram);
+
+    if (histogram_crc32c_impl != NULL)
+        return histogram_crc32c_impl(block, n, counts);
+
+    histogram_impl(block, n, counts);
+    return crc32c(0, block, n);
+}
+
+/**
+ * Choose the implementations used by histogram() and histogram_crc32c().
+ */
+void select_histogram(void) {
+    if (histogram_simd_supported())
+        histogram_impl = histogram_simd;
+    if (histogram_simd_supported() && crc32c_hw_supported())
+        histogram_crc32c_impl = histogram_crc32c_simd;
+}
+
+/**
+ * Count the bytes of block into a single table, one byte at a time.
+ */
+void histogram_simple(const unsigned char* block, size_t n, uint32_t* counts) {
+    memset(counts, 0, 256 * sizeof(uint32_t));
+
+    for (size_t i = 0; i < n; i++)
+        counts[block[i]]++;
+}
+
+/**
+ * Count the bytes of block into HISTOGRAM_LANES tables, loading eight bytes
+ * at a time.
+ */
+void histogram_scalar(const unsigned char* block, size_t n, uint32_t* counts) {
+    uint32_t lanes[HISTOGRAM_LANES][256] = {{0}};
+
+    count_lanes(block, n, lanes);
+    sum_lanes(lanes, counts);
+}
+
+/**
+ * Add the counts of the bytes of block to lanes, eight bytes at a time, each
+ * going to the lane of its position modulo HISTOGRAM_LANES.
+ */
+void count_lanes(const unsigned char* block, size_t n, uint32_t lanes[][256]) {
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, block + i, 8);
+
+        lanes[0][word & 0xFF]++;
+        lanes[1][(word >> 8) & 0xFF]++;
+        lanes[2][(word >> 16) & 0xFF]++;
+        lanes[3][(word >> 24) & 0xFF]++;
+        lanes[0][(word >> 32) & 0xFF]++;
+        lanes[1][(word >> 40) & 0xFF]++;
+        lanes[2][(word >> 48) & 0xFF]++;
+        lanes[3][word >> 56]++;
+    }
+
+    for (; i < n; i++)
+        lanes[i % HISTOGRAM_LANES][block[i]]++;
+}
+
+/**
+ * Store the sum of the counts of every lane in counts.
+ */
+void sum_lanes(uint32_t lanes[][256], uint32_t* counts) {
+    for (int symbol = 0; symbol < 256; symbol++)
+        counts[symbol] = lanes[0][symbol] + lanes[1][symbol] + lanes[2][symbol] + lanes[3][symbol];
+}
+
+#if HAVE_AVX2_HISTOGRAM
+
+/**
+ * Return 1 if the CPU supports histogram_simd(). Otherwise, return 0.
+ */
+int histogram_simd_supported(void) {
+    __builtin_cpu_init();
+
+    return __builtin_cpu_supports("avx2") != 0;
+}
+
+/**
+ * Count the bytes of block like histogram_scalar(), 32 bytes at a time. A
+ * run of 32 equal bytes, recognized with a single vector comparison, is
+ * counted with one addition instead of 32 dependent increments.
+ */
+__attribute__((target("avx2")))
+void histogram_simd(const unsigned char* block, size_t n, uint32_t* counts) {
+    uint32_t lanes[HISTOGRAM_LANES][256] = {{0}};
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*) (block + i));
+        __m256i first = _mm256_set1_epi8((char) block[i]);
+
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, first)) == -1)
+            lanes[0][block[i]] += 32;
+        else
+            count_lanes(block + i, 32, lanes);
+    }
+
+    count_lanes(block + i, n - i, lanes);
+    sum_lanes(lanes, counts);
+}
+
+#if defined(__x86_64__)
+
+/**
+ * Count the bytes of block like histogram_simd() and return their CRC32C,
+ * computed with the CRC32 instruction of SSE4.2 on each 32-byte chunk as it
+ * is counted. The CRC instructions of a chunk do not depend on its counts, so
+ * they overlap with the increments.
+ */
+__attribute__((target("avx2,sse4.2")))
+uint32_t histogram_crc32c_simd(const unsigned char* block, size_t n, uint32_t* counts) {
+    uint32_t lanes[HISTOGRAM_LANES][256] = {{0}};
+    uint64_t crc = 0xFFFFFFFF;
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*) (block + i));
+        __m256i first = _mm256_set1_epi8((char) block[i]);
+
+        for (int k = 0; k < 32; k += 8) {
+            uint64_t word;
+            memcpy(&word, block + i + k, 8);
+            crc = _mm_crc32_u64(crc, word);
+        }
+
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, first)) == -1)
+            lanes[0][block[i]] += 32;
+        else
+            count_lanes(block + i, 32, lanes);
+    }
+
+    count_lanes(block + i, n - i, lanes);
+    sum_lanes(lanes, counts);
+
+    return crc32c((uint32_t) ~crc, block + i, n - i);
+}
+
+#else
+
+/**
+ * Without the 64-bit CRC32 instruction, count the bytes of block with
+ * histogram_simd() and return their CRC32C from crc32c().
+ */
+uint32_t histogram_crc32c_simd(const unsigned char* block, size_t n, uint32_t* counts) {
+    histogram_simd(block, n, counts);
+
+    return crc32c(0, block, n);
+}
+
+#endif
+
+#else
+
+/**
+ * Return 1 if the CPU supports histogram_simd(). Otherwise, return 0.
+ */
+int histogram_simd_supported(void) {
+    return 0;
+}
+
+/**
+ * Without a vector implementation for this platform, count the bytes of
+ * block with histogram_scalar().
+ */
+void histogram_simd(const unsigned char* block, size_t n, uint32_t* counts) {
+    histogram_scalar(block, n, counts);
+}
+
+/**
+ * Without a vector implementation for this platform, count the bytes of
+ * block with histogram_scalar() and return their CRC32C from crc32c().
+ */
+uint32_t histogram_crc32c_simd(const unsigned char* block, size_t n, uint32_t* counts) {
+    histogram_scalar(block, n, counts);
+
+    return crc32c(0, block, n);
+}
+
+#endif
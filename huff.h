@@ -1,6 +1,11 @@
 #ifndef HUFF_H
 #define HUFF_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "libhuff.h"
+
 /**
  * Each possible byte value (0-255) from the input data represents a symbol.
  * MAX_SYMBOLS (257) is the maximum number of "symbols" represented in the
@@ -10,64 +15,774 @@
  */
 #define MAX_SYMBOLS (256 + 1)
 
-#define MIN_BLOCK_SIZE 1024 // Smallest possible block size
-#define MAX_BLOCK_SIZE 65536 // Largest possible block size
+#define MIN_BLOCK_SIZE HUFF_MIN_BLOCK_SIZE // Smallest possible block size
+#define MAX_BLOCK_SIZE HUFF_MAX_BLOCK_SIZE // Largest possible block size
+#define MAX_ORIGINAL_BLOCK_SIZE HUFF_MAX_ORIGINAL_BLOCK_SIZE // Largest block size of the original format
+
+#define MAX_THREADS HUFF_MAX_THREADS // Largest possible number of threads
+
+#define MAX_STREAMS HUFF_MAX_STREAMS // Largest possible number of streams per block
+
+#define MIN_CODE_LENGTH HUFF_MIN_CODE_LENGTH // Smallest possible code length limit
+#define MAX_CODE_LENGTH HUFF_MAX_CODE_LENGTH // Largest possible code length limit
+
+/**
+ * MAX_HEADER_SIZE is the size of the longest block header: a tree description
+ * of 2 + 65 + 259 bytes. The code lengths of a canonical header take less.
+ */
+#define MAX_HEADER_SIZE (2 + 65 + 259)
+
+/**
+ * COMPRESS_BLOCK_BOUND(n) is an upper bound on the size of a compressed block
+ * of n symbols. The header takes at most MAX_HEADER_SIZE bytes. A
+ * Huffman code is no longer on average than a fixed 9-bit code for 257
+ * symbols, and the end block code is at most 32 bits long. A block split
+ * into streams has no end block code, but a jump table and the padding of
+ * each stream take at most 5 * MAX_STREAMS bytes. The type of a block of the
+ * framed format takes one more byte, and its checksum four more.
+ */
+#define COMPRESS_BLOCK_BOUND(n) ((size_t) (n) + (n) / 8 + 512)
+
+/**
+ * The framed format (-f) starts with a file header of the bytes "HUF"
+ * FRAME_VERSION, the limit on code lengths the stream was compressed with (0
+ * if there is none), the header mode of the blocks, the number of streams
+ * per block (0 meaning 1), a byte of FRAME_FLAG_* flags, and the block size
+ * as a four-byte big-endian integer. Every block but the last holds block size
+ * symbols. Version 2 of the format had only the first eight bytes and
+ * version 1 only the first four; both had blocks of at most
+ * MAX_ORIGINAL_BLOCK_SIZE symbols. The first byte of a stream in the original
+ * format is the high byte of a node count, which is at most 2, so the two
+ * formats are told apart by the first byte.
+ * Each block is preceded by a frame header holding its compressed and
+ * uncompressed lengths. A frame header with a compressed length of 0 ends the
+ * blocks and is followed by an index of the lengths of every block and by a
+ * trailer holding the number of blocks and the bytes "HUFX". All numbers
+ * other than those of the file header are four-byte big-endian integers.
+ *
+ *   "HUF" FRAME_VERSION max_code_length header_mode num_streams flags
+ *       block_size [table_id]
+ *   (compressed length, uncompressed length, compressed block) * num_blocks
+ *   0
+ *   (compressed length, uncompressed length) * num_blocks
+ *   num_blocks "HUFX"
+ *
+ * Since version 4, each block starts with its type. A BLOCK_HUFFMAN block
+ * continues as described below. A BLOCK_REPEAT block leaves out the header
+ * and uses the code of the last BLOCK_HUFFMAN block before it, which the
+ * compressor chooses when that code is estimated to cost less than a new one
+ * with its header. A BLOCK_STORED block holds its symbols as they are, which
+ * the compressor chooses when Huffman coding would not make the block
+ * smaller.
+ *
+ * Version 5 follows the file header of version 4 with the ID of the
+ * pre-trained table (see STATIC_TABLE) the stream was compressed with, and
+ * adds BLOCK_STATIC blocks, which leave out the header and use the code of the
+ * table. The compressor chooses them like repeat blocks. A stream compressed
+ * without a table is written as version 4, since it needs no ID.
+ *
+ * With FRAME_FLAG_CHECKSUMS, each block ends with the CRC32C of its
+ * uncompressed symbols, counted in its compressed length. Decoders that
+ * predate the flags required the byte to be zero, so they reject a stream
+ * with checksums rather than misread it. Versions 2 and 3 have no flags.
+ *
+ * With HEADER_TREE, each block starts with the description of its Huffman
+ * tree, as in the original format. With HEADER_CANONICAL, each block starts
+ * with the lengths of its codes, and the codes are the canonical ones for
+ * those lengths (see output_code_lengths()).
+ *
+ * A block of n symbols split into k > 1 streams follows its header with a
+ * jump table of the compressed lengths of the first k - 1 streams. The first
+ * k - 1 streams encode n / k symbols each, rounded down, and the last stream
+ * encodes the rest. Each stream is padded to a whole byte and ends without
+ * the end block symbol, since the frame header gives n.
+ */
+#define FRAME_MAGIC "HUF"
+#define FRAME_VERSION 5
+#define FRAME_VERSION_WITHOUT_TABLE 4
+#define FRAME_INDEX_MAGIC "HUFX"
+#define FILE_HEADER_SIZE 16
+#define FILE_HEADER_V4_SIZE 12
+#define FILE_HEADER_V2_SIZE 8
+#define FILE_HEADER_V1_SIZE 4
+#define FRAME_HEADER_SIZE 8
+#define TRAILER_SIZE 8
+
+#define HEADER_TREE 0
+#define HEADER_CANONICAL 1
+
+#define FRAME_FLAG_CHECKSUMS 0x1
+#define CHECKSUM_SIZE 4
+
+#define BLOCK_HUFFMAN 0
+#define BLOCK_STORED 1
+#define BLOCK_REPEAT 2
+#define BLOCK_STATIC 3
+#define NUM_BLOCK_TYPES 4
+
+/**
+ * A message is what data compressed with a table in a single block becomes
+ * when that is smaller than the framed format, whose file header, frame
+ * headers, index, and trailer add 45 bytes to even the shortest stream (see
+ * compress_message()). It starts with the byte MESSAGE_MAGIC and the ID of
+ * the table as a four-byte big-endian integer, followed by its uncompressed
+ * and compressed lengths as varints: seven bits to a byte, least significant
+ * first, with the high bit set in every byte but the last. The symbols follow,
+ * coded with the table and ended by the end block code, and padded to a whole
+ * byte. The first byte tells a message apart from the other formats.
+ *
+ *   MESSAGE_MAGIC table_id uncompressed_length compressed_length symbols
+ */
+#define MESSAGE_MAGIC 'T'
+#define MESSAGE_MAX_VARINT_SIZE 4
+#define MESSAGE_MAX_HEADER_SIZE (1 + 4 + 2 * MESSAGE_MAX_VARINT_SIZE)
+
+typedef struct message_header {
+    uint32_t table_id;
+    uint32_t uncompressed_len;
+    uint32_t compressed_len;
+} MESSAGE_HEADER;
+
+/**
+ * The dynamic format (-D) starts with the bytes DYNAMIC_MAGIC and
+ * DYNAMIC_VERSION, and is followed by a single bitstream with no blocks. Each
+ * byte is coded with a Huffman tree that the compressor and the decompressor
+ * both update after every byte, in the manner of the FGK algorithm (see
+ * DYNAMIC_CODER), so the stream needs no headers, and the code of a byte can
+ * be handed out as soon as the byte is read. The first byte of the stream
+ * tells it apart from the other formats.
+ *
+ * The tree starts out with a single leaf, DYNAMIC_ESCAPE. A byte not seen
+ * before is coded as the code of DYNAMIC_ESCAPE followed by the byte in
+ * DYNAMIC_VALUE_BITS bits, and then gets a leaf of its own. The escape is also
+ * followed by DYNAMIC_FLUSH, after which the stream is padded to a whole byte
+ * so that everything before it can be decoded from the bytes handed out so
+ * far, or by DYNAMIC_END, which is padded the same way and ends the stream.
+ */
+#define DYNAMIC_MAGIC "DHUF"
+#define DYNAMIC_VERSION 1
+#define DYNAMIC_HEADER_SIZE 5
+#define DYNAMIC_ESCAPE 256
+#define DYNAMIC_VALUE_BITS 9
+#define DYNAMIC_END 256
+#define DYNAMIC_FLUSH 257
+
+/**
+ * Once the weight of the root of a dynamic tree reaches DYNAMIC_MAX_WEIGHT,
+ * the weights are halved and the tree rebuilt, which lets the code follow a
+ * distribution that changes. The leaf of DYNAMIC_ESCAPE always weighs 1, and a
+ * new leaf weighs 0 only until the update that follows its creation, before
+ * any code is written. So when a code is written, every leaf weighs at least 1
+ * and the root at most DYNAMIC_MAX_WEIGHT, which is less than the 19th
+ * Fibonacci number: the tree is at most 16 levels deep, a code takes at most
+ * 16 bits, and a code with an escaped value at most 25. At most 256 codes are
+ * escaped, so n bytes and a control code, with up to 7 bits left from before
+ * and 7 bits of padding, take at most 16n + 2343 bits, or 2n + 293 bytes, which
+ * is within DYNAMIC_BOUND(n). The dynamic format is read and written
+ * DYNAMIC_CHUNK_SIZE bytes at a time.
+ */
+#define DYNAMIC_MAX_WEIGHT 4096
+#define DYNAMIC_BOUND(n) (2 * (size_t) (n) + 320)
+#define DYNAMIC_CHUNK_SIZE 65536
+
+/**
+ * The longest code a block can use. A block of MAX_BLOCK_SIZE symbols can
+ * produce a Huffman code of 33 bits, so codes are limited to MAX_CODE_BITS
+ * bits even when no limit is set.
+ */
+#define MAX_CODE_BITS 32
+
+/**
+ * Statistics of each block, collected when a context has a stats stream (see
+ * huff_set_stats()). Each stage of a block is timed with TIMER_START() and
+ * TIMER_STOP(), which read the clock only when the BLOCK_STATS of the block is
+ * not NULL; building with HUFF_NO_TIMERS (make TIMERS=0) compiles them out
+ * altogether.
+ */
+#define TIMER_HISTOGRAM 0 // Counting symbols and choosing block ends and types
+#define TIMER_TREE 1 // Building codes, or reading headers and decode tables
+#define TIMER_ENCODE 2 // Writing headers and encoding symbols
+#define TIMER_DECODE 3 // Decoding symbols
+#define TIMER_IO 4 // Reading input and writing output
+#define NUM_TIMERS 5
+
+#ifdef HUFF_NO_TIMERS
+#define TIMERS_ENABLED 0
+#define TIMER_START(stats) ((void) (stats), (uint64_t) 0)
+#define TIMER_STOP(stats, timer, start) ((void) (start))
+#else
+#define TIMERS_ENABLED 1
+#define TIMER_START(stats) (((stats) != NULL) ? now_ns() : 0)
+#define TIMER_STOP(stats, timer, start) \
+    do { \
+        if ((stats) != NULL) \
+            (stats)->ns[timer] += now_ns() - (start); \
+    } while (0)
+#endif
+
+typedef struct block_stats {
+    int type; // BLOCK_* type of the block
+    size_t header_len; // Number of bytes of the header of the block
+    int num_symbols; // Number of distinct symbols of the block
+    int max_length; // Length of the longest code of the block, or 0
+    double entropy_bits; // Entropy of the symbols of the block, in bits
+    uint64_t ns[NUM_TIMERS]; // Nanoseconds spent in each stage
+} BLOCK_STATS;
+
+/**
+ * The statistics written by one call to compress_stream() or
+ * decompress_stream(): a line for each block as it is written, and the totals
+ * of the blocks once all of them are. Nothing is written if out is NULL.
+ */
+typedef struct stats_report {
+    FILE* out;
+    int format; // HUFF_STATS_TEXT or HUFF_STATS_JSON
+    int compress; // Indicator for whether the blocks are compressed
+    long num_blocks;
+    long type_blocks[NUM_BLOCK_TYPES]; // Number of blocks of each BLOCK_* type
+    uint64_t uncompressed_len;
+    uint64_t compressed_len;
+    uint64_t header_len;
+    double entropy_bits;
+    int max_length;
+    uint64_t ns[NUM_TIMERS];
+    uint64_t start_ns; // Time the call started at
+} STATS_REPORT;
+
+/**
+ * A binary tree with n leaves has exactly 2 * n - 1 nodes, and the number of
+ * leaves of a Huffman tree is the number of unique symbols, so a tree never
+ * has more than MAX_NODES nodes.
+ */
+#define MAX_NODES (2 * MAX_SYMBOLS - 1)
+
+/**
+ * A Huffman tree, stored as arrays indexed by node number instead of nodes
+ * linked by pointers, so that the whole tree takes about 3 KiB rather than
+ * 16 KiB. The root is node 0, and every node comes before its children, so
+ * visiting the nodes in order of number visits every parent before its
+ * children. child holds the left and right children of each internal node;
+ * since the root is no node's child, both are 0 for a leaf. symbol holds the
+ * symbol of each leaf.
+ */
+typedef struct tree {
+    uint16_t child[MAX_NODES][2];
+    short symbol[MAX_NODES];
+    int num_nodes; // # of nodes currently in the Huffman tree
+} TREE;
+
+#define IS_LEAF(tree, node) ((tree)->child[node][0] == 0)
+
+/**
+ * The code of a symbol is held in the length least significant bits of code,
+ * the first bit of the code being the most significant of those. No code is
+ * longer than MAX_CODE_BITS bits.
+ */
+typedef struct code_entry {
+    uint32_t code;
+    int length;
+} CODE_ENTRY;
+
+typedef struct static_table STATIC_TABLE;
 
 /**
- * Bit 0 is 1: -h flag is specified.
- * Bit 1 is 1: -c flag is specified.
- * Bit 2 is 1: -d flag is specified.
+ * An encoder holds the Huffman tree and code table of the block it is
+ * compressing, so that each thread compressing blocks uses its own encoder.
  *
- * The block size minus one is logged in the 16 most significant bits of
- * global_options. The default block size is 65536. Therefore, by default, the
- * 16 most significant bits of global_options is 0xffff. If -b is specified,
- * then the specified block size minus one is logged in the 16 most significant
- * bits of global_options instead.
+ * leaf_for_symbol maps each symbol occurring in the block to its leaf in
+ * tree, and is -1 for the symbols that do not occur.
  */
-int global_options;
+typedef struct encoder {
+    TREE tree;
+    short leaf_for_symbol[MAX_SYMBOLS];
+    CODE_ENTRY code_table[MAX_SYMBOLS];
+    int max_code_length; // Longest code allowed, or 0 if there is no limit
+    int canonical; // Indicator for whether blocks use canonical headers
+    int num_streams; // # of bitstreams per block
+    int encode_threads; // Number of threads encoding each stream
+    int block_types; // Indicator for whether blocks start with their type
+    int checksums; // Indicator for whether blocks end with their checksum
+    long table_id; // Number of the block whose code is held, or -1
+    const STATIC_TABLE* static_table; // Table of BLOCK_STATIC blocks, or NULL
+    BLOCK_STATS* stats; // Statistics of the current block, or NULL
+} ENCODER;
 
-// Huffman tree nodes
-typedef struct node {
-    struct node* left;
-    struct node* right;
-    struct node* parent;
-    int weight;
-    short symbol;
-} NODE;
+/**
+ * The decoder resolves up to DECODE_TABLE_MAX_BITS bits of the bitstream per
+ * table lookup. The decode table of a block is indexed by as many bits as its
+ * longest code, so every code is decoded by a single lookup, unless that is
+ * more than DECODE_TABLE_MAX_BITS. Then the table is indexed by
+ * DECODE_TABLE_BITS bits and longer codes finish with a walk of the Huffman
+ * tree.
+ */
+#define DECODE_TABLE_BITS 11
+#define DECODE_TABLE_MAX_BITS 12
+#define DECODE_TABLE_SIZE (1 << DECODE_TABLE_MAX_BITS)
+
+/**
+ * An entry of the decode table. If length is nonzero, the next length bits of
+ * the bitstream encode symbol. If length is zero, the code is longer than the
+ * table bits and symbol holds the number of the internal node of the Huffman
+ * tree reached after them.
+ */
+typedef struct decode_entry {
+    unsigned short symbol;
+    unsigned char length;
+} DECODE_ENTRY;
 
-int num_nodes; // # of nodes currently in the Huffman tree
+/**
+ * A decoder holds the decode table of the block it is decompressing, so that
+ * each thread decompressing blocks uses its own decoder.
+ *
+ * For a block with a tree header, codes longer than the table bits are
+ * finished by walking the Huffman tree in tree. For a block with a canonical
+ * header, there is no tree: the codes of each length are consecutive numbers
+ * starting at first_code, and decode the symbols of sorted_symbols starting
+ * at offset. limit holds the first code past those of each length, aligned
+ * to the most significant bit, so the length of a code is the first one
+ * whose limit is greater than the bitstream.
+ */
+typedef struct decoder {
+    TREE tree;
+    int table_bits; // # of bits indexing decode_table for the current block
+    int max_code_length; // Longest code allowed, or 0 if there is no limit
+    int canonical; // Indicator for whether blocks use canonical headers
+    int num_streams; // # of bitstreams per block
+    int block_types; // Indicator for whether blocks start with their type
+    int checksums; // Indicator for whether blocks end with their checksum
+    long table_id; // Number of the block whose code is held, or -1
+    int max_length; // Length of the longest code of the current block
+    const STATIC_TABLE* static_table; // Table of BLOCK_STATIC blocks, or NULL
+    BLOCK_STATS* stats; // Statistics of the current block, or NULL
+    uint64_t limit[MAX_CODE_BITS + 1];
+    uint32_t first_code[MAX_CODE_BITS + 1];
+    int offset[MAX_CODE_BITS + 1];
+    unsigned short sorted_symbols[MAX_SYMBOLS];
+    DECODE_ENTRY decode_table[DECODE_TABLE_SIZE];
+} DECODER;
 
 /**
- * current_block is a buffer to hold the symbols of the block currently being
- * compressed.
+ * A table file, written by huff_train_table(), holds the bytes TABLE_MAGIC
+ * followed by code lengths in the layout of a canonical block header. A
+ * context given a table by huff_set_table() keeps it as a STATIC_TABLE, with
+ * the canonical codes of those lengths in code_table and their decode table
+ * in dec, built once and shared by every thread. BLOCK_STATIC blocks are
+ * coded with it, so they need neither a header nor a code built for them. id
+ * is the CRC32C of the table file, which streams compressed with the table
+ * record so that they are not decoded with another.
+ *
+ * A trained table has a code for every symbol, no longer than
+ * DECODE_TABLE_MAX_BITS unless a longer limit is set, so that every symbol is
+ * decoded with a single lookup.
  */
-unsigned char current_block[MAX_BLOCK_SIZE];
+#define TABLE_MAGIC "HUFT"
+#define TABLE_MAGIC_SIZE 4
+#define MAX_TABLE_SIZE HUFF_MAX_TABLE_SIZE
+
+struct static_table {
+    uint32_t id;
+    unsigned char lengths[MAX_SYMBOLS]; // Code length of each symbol, 0 if it has no code
+    CODE_ENTRY code_table[MAX_SYMBOLS];
+    DECODER dec;
+};
 
 /**
- * nodes is the array used to store Huffman tree nodes.
+ * A dynamic coder holds the Huffman tree of a stream in the dynamic format
+ * and the bits of the stream not yet written or decoded.
+ *
+ * As in a TREE, the root is node 0 and every node comes before its children,
+ * and child is 0 for a leaf. The tree also keeps the sibling property of the
+ * FGK algorithm: the weights of the nodes do not increase with their number,
+ * and the two children of a node are consecutive, so child holds the first of
+ * them. The weight of a leaf is the number of times its symbol has been coded;
+ * that of DYNAMIC_ESCAPE stays 1. After a symbol is coded, its leaf and every
+ * node above it are moved, each to the first of the nodes of its weight, and
+ * incremented, which keeps the property. leaf_for_symbol is -1 for the symbols
+ * that have no leaf yet.
  *
- * Since a binary tree with n leaves has exactly 2 * n - 1 nodes, considering
- * the fact that the number of unique symbols is the number of leaves in the
- * Huffman tree, more than 2 * MAX_SYMBOLS - 1 nodes for the tree is not
- * needed.
+ * When compressing, bits holds count bits not yet written in its low bits.
+ * When decompressing, bits holds count bits not yet decoded, aligned to the
+ * most significant bit, and node and escaped tell where decoding stopped in
+ * the middle of a code.
+ */
+typedef struct dynamic_coder {
+    uint32_t weight[MAX_NODES];
+    short parent[MAX_NODES];
+    uint16_t child[MAX_NODES];
+    short symbol[MAX_NODES];
+    short leaf_for_symbol[MAX_SYMBOLS];
+    int num_nodes;
+    uint64_t bits;
+    int count;
+    int node; // Node reached by the bits decoded of the current code
+    int escaped; // Indicator for whether an escaped value is to be decoded next
+} DYNAMIC_CODER;
+
+/**
+ * The context behind the library API: the options set through the huff_set_
+ * functions and the encoder, decoder, and buffers reused by every call that
+ * runs on the calling thread.
+ */
+struct huff_ctx {
+    int block_size;
+    int framed;
+    int num_threads;
+    int max_code_length;
+    int canonical;
+    int num_streams;
+    int adaptive;
+    int checksums;
+    int pipelined;
+    int dynamic;
+    STATIC_TABLE* table; // Table set by huff_set_table(), or NULL
+    int ranged; // Indicator for whether decompression writes only a range
+    uint64_t range_offset; // First decompressed byte of the range
+    uint64_t range_len; // Number of bytes in the range, if ranged
+    long bad_block; // First block the last decompression found corrupt, or -1
+    FILE* stats_out; // Where statistics are written, or NULL
+    int stats_format;
+    ENCODER* enc;
+    DECODER* dec;
+    unsigned char* input; // Buffer of input_size bytes
+    unsigned char* output; // Buffer of output_size bytes
+    size_t input_size;
+    size_t output_size;
+};
+
+/**
+ * Where data to compress or decompress comes from: the stream file, the file
+ * descriptor fd, or the len bytes at data, according to type. A regular file
+ * opened through fd is mapped into memory by source_open() and then read as
+ * memory; map and map_len describe the mapping.
+ */
+#define SOURCE_MEMORY 0
+#define SOURCE_FILE 1
+#define SOURCE_FD 2
+
+typedef struct source {
+    int type;
+    FILE* file;
+    int fd;
+    int error; // Indicator for whether reading from fd failed
+    const unsigned char* data;
+    size_t len;
+    size_t pos; // Position of the next unread byte in data
+    void* map;
+    size_t map_len;
+} SOURCE;
+
+/**
+ * Where compressed or decompressed data goes: the stream file, the file
+ * descriptor fd, or data, which has room for capacity bytes, according to
+ * type. Data for fd is collected in data, which sink_write() allocates, and
+ * written out by sink_flush().
  */
-NODE nodes[2 * MAX_SYMBOLS - 1];
+#define SINK_MEMORY 0
+#define SINK_FILE 1
+#define SINK_FD 2
+
+typedef struct sink {
+    int type;
+    FILE* file;
+    int fd;
+    unsigned char* data;
+    size_t len; // Number of bytes held in data
+    size_t capacity;
+} SINK;
 
 /**
- * Akin to a hash map, node_for_symbol is the array used to map symbols to
- * Huffman tree nodes, or, more specifically, the leaves of the Huffman tree.
- * node_for_symbol is used in compressing blocks of input data.
+ * The index of a framed stream: the compressed and uncompressed lengths of
+ * each block, in the order of the blocks.
+ */
+typedef struct block_index {
+    uint32_t* lengths; // Compressed and uncompressed length of each block
+    size_t num_blocks;
+    size_t capacity;
+} BLOCK_INDEX;
+
+/**
+ * A job is one block passing through a pipeline: its input is filled in by
+ * read_job, turned into output by process_job on a worker thread, and handed
+ * to write_job in the order the jobs were read.
+ *
+ * Blocks may share the code of an earlier block, which need not be processed
+ * by the same worker. read_job therefore gives each job the number of the
+ * block its code comes from in table_id, and a description of that code in
+ * table, so that a worker that does not hold the code can rebuild it.
  */
-NODE* node_for_symbol[MAX_SYMBOLS];
+typedef struct job {
+    unsigned char* input;
+    size_t input_len;
+    unsigned char* output;
+    size_t output_len;
+    int type; // Type of the block, if chosen by read_job
+    long table_id; // Number of the block whose code the block uses
+    unsigned char* table; // Buffer of table_size bytes
+    size_t table_len; // Number of bytes held in table
+    uint32_t checksum; // CRC32C of the uncompressed block, if blocks have one
+    int corrupt; // Indicator for whether process_job found the block corrupt
+    BLOCK_STATS* stats; // Statistics of the block, or NULL if not collected
+    BLOCK_STATS block_stats; // Where stats points to, if anywhere
+    int ret; // Return value of process_job
+    int done; // Indicator for whether process_job has finished
+} JOB;
+
+/**
+ * The stages of a pipeline. read_job and write_job receive arg. write_job runs
+ * on the calling thread, and so does read_job unless reader_thread is
+ * nonzero, in which case it runs on a thread of its own, concurrently with
+ * write_job; the two must then share nothing in arg but what neither
+ * modifies. process_job runs on the worker threads and receives the
+ * state allocated for its thread by new_worker, which also receives arg. The
+ * input, output, and table buffers of each job hold input_size, output_size,
+ * and table_size bytes.
+ *
+ * read_job returns 0 if a job is read, 1 if there is nothing left to read, or
+ * -1 on error. process_job and write_job return 0 on success or -1 on error.
+ */
+typedef struct pipeline {
+    void* arg;
+    int (*read_job)(JOB* job, void* arg);
+    void* (*new_worker)(void* arg);
+    int (*process_job)(JOB* job, void* worker);
+    int (*write_job)(JOB* job, void* arg);
+    size_t input_size;
+    size_t output_size;
+    size_t table_size;
+    int reader_thread; // Indicator for whether read_job has a thread of its own
+} PIPELINE;
+
+/**
+ * State shared by the stages of compress_stream() and push_compress(): where
+ * the data comes from and goes, the block size, whether the framed format is
+ * written, and the index of the blocks written so far. An adaptive block may
+ * end before the bytes read for it do; those bytes are kept in carry for the
+ * next block. Framed blocks may repeat the code of the last block that got a
+ * new one, whose histogram is kept in table_counts, or use the code of a
+ * static table.
+ */
+typedef struct compress_state {
+    SOURCE* source;
+    SINK* sink;
+    int block_size;
+    int framed;
+    int max_code_length;
+    int canonical;
+    int num_streams;
+    int adaptive;
+    int checksums;
+    int encode_threads; // Number of threads encoding each stream
+    const STATIC_TABLE* static_table; // Table of BLOCK_STATIC blocks, or NULL
+    unsigned char* carry; // Buffer of block_size bytes if adaptive
+    int carry_len; // Number of bytes held in carry
+    long num_blocks; // Number of blocks read
+    long table_id; // Number of the last block with a new code, or -1
+    double static_excess; // Bits static blocks took beyond their entropy since then
+    uint32_t table_counts[256];
+    double symbol_bits[256]; // Estimated code length of each symbol of that block
+    BLOCK_INDEX index;
+    STATS_REPORT report;
+} COMPRESS_STATE;
+
+/**
+ * State shared by the stages of decompress_stream() and push_decompress(): the
+ * compressed data, where the decompressed data goes, and the index of the
+ * blocks read so far from a framed stream. Compressed data in memory is used
+ * in place; data from a stream or file descriptor is read into buffer as it is
+ * needed. The header of the last block with a new code is kept in table for
+ * the repeat blocks that follow it. If ranged is nonzero, only the bytes of
+ * the decompressed data past the first skip bytes, and no more than remaining
+ * bytes, are written.
+ */
+typedef struct decompress_state {
+    SOURCE* source;
+    SINK* sink;
+    const unsigned char* data; // Compressed data read so far
+    unsigned char* buffer; // Buffer of buffer_size bytes if not in memory
+    size_t buffer_size;
+    size_t pos; // Position of the next unread byte in data
+    size_t len; // Number of bytes held in data
+    int eof; // Indicator for whether the source is exhausted
+    int block_size; // Largest number of symbols in a block
+    int max_code_length; // Code length limit recorded in a framed stream
+    int canonical; // Indicator for whether blocks have canonical headers
+    int num_streams; // Number of streams per block
+    int block_types; // Indicator for whether blocks start with their type
+    int checksums; // Indicator for whether blocks end with their checksum
+    const STATIC_TABLE* static_table; // Table the stream was compressed with, or NULL
+    long num_blocks; // Number of blocks read
+    long num_written; // Number of blocks written
+    long bad_block; // First block found corrupt, or -1
+    long table_id; // Number of the last block with a new code, or -1
+    unsigned char table[MAX_HEADER_SIZE];
+    size_t table_len; // Number of bytes held in table
+    int ranged; // Indicator for whether only a range is written
+    uint64_t skip; // Number of decompressed bytes left to leave out
+    uint64_t remaining; // Number of decompressed bytes left to write
+    long end_block; // Number of the block where reading stops if ranged, or -1
+    BLOCK_INDEX index;
+    STATS_REPORT report;
+} DECOMPRESS_STATE;
+
+/**
+ * The state behind a huff_stream. The stages of compress_stream() or
+ * decompress_stream() run one block at a time on the calling thread, over
+ * memory views of the input pushed so far, so a push never waits for input:
+ * the part of a block or header that has arrived is collected in buffer until
+ * the rest does. The output of a block is held in pending and handed out as
+ * next_out has room.
+ */
+#define PUSH_START 0 // Decompression: telling the formats apart
+#define PUSH_ORIGINAL 1 // Decompression: blocks of the original format
+#define PUSH_HEADER 2 // Decompression: the file header of the framed format
+#define PUSH_FRAME 3 // Decompression: frames of the framed format
+#define PUSH_INDEX 4 // Decompression: the index of the framed format
+#define PUSH_BLOCKS 5 // Compression: blocks
+#define PUSH_DYNAMIC_HEADER 6 // Decompression: the header of the dynamic format
+#define PUSH_DYNAMIC 7 // Compression or decompression: the dynamic format
+#define PUSH_MESSAGE 8 // Decompression: a message
+#define PUSH_END 9
+#define PUSH_ERROR 10
+
+typedef struct push_state {
+    huff_ctx* ctx;
+    int stage; // PUSH_* stage the stream is in
+    COMPRESS_STATE compress;
+    DECOMPRESS_STATE decompress;
+    SOURCE source; // Memory view of buffer while compressing
+    SINK sink; // Output of compression, which pending points to
+    JOB job;
+    uint32_t table[2 * 256]; // Table buffer of job
+    DYNAMIC_CODER dynamic; // Coder of the dynamic format
+    unsigned char* buffer; // Input collected, of buffer_size bytes
+    size_t buffer_size;
+    size_t buffer_len; // Number of bytes held in buffer
+    const unsigned char* data; // Input of the current step, in place or in buffer
+    size_t retry_len; // Number of bytes the last incomplete block was tried with
+    const unsigned char* pending;
+    size_t pending_len; // Number of bytes held in pending
+    size_t pending_pos; // Number of bytes of pending handed out
+} PUSH_STATE;
 
 // Compression functions
-int compress(void);
-int compress_block(void);
-void output_description(void);
+int compress_stream(huff_ctx* ctx, SOURCE* source, SINK* sink);
+int compress_message(huff_ctx* ctx, SOURCE* source, SINK* sink);
+int compress_begin(huff_ctx* ctx, COMPRESS_STATE* state, SOURCE* source, SINK* sink);
+int init_compress_state(huff_ctx* ctx, COMPRESS_STATE* state);
+int write_file_header(const COMPRESS_STATE* state);
+int compress_finish(COMPRESS_STATE* state);
+void init_encoder(ENCODER* enc, const COMPRESS_STATE* state);
+int read_block_job(JOB* job, void* arg);
+int compress_block_job(JOB* job, void* worker);
+int write_job(JOB* job, void* arg);
+size_t compress_block(ENCODER* enc, const unsigned char* block, int num_symbols, unsigned char* output);
+void build_huffman_tree(ENCODER* enc, const uint32_t* weights, int num_leaves);
+void limit_code_lengths(ENCODER* enc, const uint32_t* leaf_weights, int num_leaves, int max_length);
+size_t output_description(ENCODER* enc, unsigned char* output);
+size_t output_code_lengths(ENCODER* enc, unsigned char* output);
+void build_code(ENCODER* enc, const uint32_t* counts);
+void assign_canonical_codes(ENCODER* enc);
 
 // Decompression functions
-int decompress(void);
-int decompress_block(void);
-int reconstruct_huffman_tree(void);
+int decompress_stream(huff_ctx* ctx, SOURCE* source, SINK* sink);
+size_t file_header_size(const unsigned char* header);
+int decompress_message(huff_ctx* ctx, DECOMPRESS_STATE* state);
+int decode_message(const DECODER* dec, const MESSAGE_HEADER* header, const unsigned char* input,
+                   unsigned char* output);
+int read_file_header(DECOMPRESS_STATE* state);
+int read_index(DECOMPRESS_STATE* state);
+int run_frames(huff_ctx* ctx, DECOMPRESS_STATE* state);
+size_t fill_input(DECOMPRESS_STATE* state, size_t n);
+void init_decoder(DECODER* dec, const DECOMPRESS_STATE* state);
+int read_frame_job(JOB* job, void* arg);
+int decompress_block_job(JOB* job, void* worker);
+int decompress_block(DECODER* dec, const unsigned char* input, size_t input_len, size_t* consumed,
+                     unsigned char* output, size_t output_cap, size_t* output_len);
+int reconstruct_huffman_tree(DECODER* dec, const unsigned char* input, size_t input_len, size_t* pos);
+int read_code_lengths(DECODER* dec, const unsigned char* input, size_t input_len, size_t* pos);
+int parse_code_lengths(DECODER* dec, const unsigned char* input, size_t input_len, size_t* pos,
+                       unsigned char* lengths);
+int build_canonical_table(DECODER* dec, const unsigned char* lengths);
+
+// Range functions
+int decompress_range(huff_ctx* ctx, DECOMPRESS_STATE* state);
+int write_range(DECOMPRESS_STATE* state, const unsigned char* output, size_t n);
+
+// Dynamic functions
+int compress_dynamic(huff_ctx* ctx, SOURCE* source, SINK* sink);
+int decompress_dynamic(huff_ctx* ctx, DECOMPRESS_STATE* state);
+void init_dynamic(DYNAMIC_CODER* coder);
+size_t write_dynamic_header(unsigned char* output);
+int read_dynamic_header(const unsigned char* input);
+size_t dynamic_encode(DYNAMIC_CODER* coder, const unsigned char* input, size_t n, unsigned char* output);
+size_t dynamic_flush(DYNAMIC_CODER* coder, int end, unsigned char* output);
+int dynamic_decode(DYNAMIC_CODER* coder, const unsigned char* input, size_t input_len, size_t* consumed,
+                   unsigned char* output, size_t output_cap, size_t* output_len);
+
+// Table functions
+long train_table(huff_ctx* ctx, const unsigned char* samples, size_t n, unsigned char* output, size_t capacity);
+STATIC_TABLE* load_table(huff_ctx* ctx, const unsigned char* input, size_t input_len);
+
+// Histogram functions
+typedef void (*HISTOGRAM_FUNC)(const unsigned char* block, size_t n, uint32_t* counts);
+typedef uint32_t (*HISTOGRAM_CRC32C_FUNC)(const unsigned char* block, size_t n, uint32_t* counts);
+
+void histogram(const unsigned char* block, size_t n, uint32_t* counts);
+void histogram_simple(const unsigned char* block, size_t n, uint32_t* counts);
+void histogram_scalar(const unsigned char* block, size_t n, uint32_t* counts);
+void histogram_simd(const unsigned char* block, size_t n, uint32_t* counts);
+int histogram_simd_supported(void);
+uint32_t histogram_crc32c(const unsigned char* block, size_t n, uint32_t* counts);
+uint32_t histogram_crc32c_simd(const unsigned char* block, size_t n, uint32_t* counts);
+double entropy_bits(const uint32_t* counts, size_t n);
+
+// Checksum functions
+uint32_t crc32c(uint32_t crc, const void* data, size_t n);
+uint32_t crc32c_sw(uint32_t crc, const unsigned char* data, size_t n);
+uint32_t crc32c_hw(uint32_t crc, const unsigned char* data, size_t n);
+int crc32c_hw_supported(void);
+
+// I/O functions
+int source_open(SOURCE* source);
+void source_close(SOURCE* source);
+size_t source_read(SOURCE* source, void* buffer, size_t n);
+size_t source_read_some(SOURCE* source, void* buffer, size_t n);
+int source_error(const SOURCE* source);
+int sink_write(SINK* sink, const void* buffer, size_t n);
+int sink_flush(SINK* sink);
+void sink_close(SINK* sink);
+
+// Context functions
+int ctx_reserve(huff_ctx* ctx, size_t input_size, size_t output_size);
+int ctx_framed(const huff_ctx* ctx);
+
+// Framed format functions
+void put_u32(unsigned char* ptr, uint32_t value);
+uint32_t get_u32(const unsigned char* ptr);
+int index_add(BLOCK_INDEX* index, uint32_t compressed_len, uint32_t uncompressed_len);
+int write_index(const BLOCK_INDEX* index, SINK* sink);
+size_t put_message_header(unsigned char* output, uint32_t table_id, uint32_t uncompressed_len,
+                          uint32_t compressed_len);
+int read_message_header(const unsigned char* input, size_t len, MESSAGE_HEADER* header);
+
+// Statistics functions
+uint64_t now_ns(void);
+void stats_begin(STATS_REPORT* report, const huff_ctx* ctx, int compress);
+BLOCK_STATS* stats_job(const STATS_REPORT* report, JOB* job);
+void stats_symbols(BLOCK_STATS* stats, const uint32_t* counts, size_t n);
+void stats_block(STATS_REPORT* report, const BLOCK_STATS* stats, size_t uncompressed_len, size_t compressed_len);
+void stats_end(STATS_REPORT* report);
+
+// Streaming functions
+int push_begin(huff_ctx* ctx, huff_stream* strm, int compress);
+int push_compress(huff_stream* strm, int flush);
+int push_decompress(huff_stream* strm, int flush);
+void push_end(huff_stream* strm);
+
+// Parallel processing functions
+int run_pipeline(const PIPELINE* pipeline, int num_threads);
+
+// Batch functions
+int compress_batch(huff_ctx* ctx, huff_buffer* buffers, size_t num_buffers);
 
 #endif
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "huff.h"
+
+/**
+ * Output to a file descriptor is collected in a buffer of SINK_BUFFER_SIZE
+ * bytes and written out with a single write() once the buffer is full.
+ */
+#define SINK_BUFFER_SIZE (1 << 20)
+
+int write_all(int fd, const unsigned char* buffer, size_t n);
+
+/**
+ * Prepare source for reading. If a file descriptor refers to a regular file,
+ * the rest of the file is mapped into memory and source is read in place.
+ * Otherwise, as for pipes and terminals, the file descriptor is read in bulk
+ * with read().
+ *
+ * Return 0.
+ */
+int source_open(SOURCE* source) {
+    struct stat st;
+
+    if (source->type != SOURCE_FD || fstat(source->fd, &st) == -1 || !S_ISREG(st.st_mode))
+        return 0;
+
+    off_t offset = lseek(source->fd, 0, SEEK_CUR);
+    if (offset == -1 || offset >= st.st_size)
+        return 0;
+
+    // The mapping starts at the beginning of the file, since its offset must
+    // be a multiple of the page size
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, source->fd, 0);
+    if (map == MAP_FAILED)
+        return 0;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    source->type = SOURCE_MEMORY;
+    source->map = map;
+    source->map_len = st.st_size;
+    source->data = (const unsigned char*) map + offset;
+    source->len = st.st_size - offset;
+
+    return 0;
+}
+
+/**
+ * Release what source_open() set up. The offset of a mapped file is moved
+ * past the bytes that were read, as if they had been read with read().
+ */
+void source_close(SOURCE* source) {
+    if (source->map == NULL)
+        return;
+
+    lseek(source->fd, source->map_len - source->len + source->pos, SEEK_SET);
+    munmap(source->map, source->map_len);
+    source->map = NULL;
+}
+
+/**
+ * Read up to n bytes from source into buffer. Fewer than n bytes are read
+ * only at the end of the source or on error.
+ *
+ * Return the number of bytes read.
+ */
+size_t source_read(SOURCE* source, void* buffer, size_t n) {
+    if (source->type == SOURCE_FILE)
+        return fread(buffer, 1, n, source->file);
+
+    if (source->type == SOURCE_FD) {
+        size_t len = 0;
+
+        // read() returns less than asked for from pipes, so keep reading
+        while (len < n) {
+            ssize_t ret = read(source->fd, (unsigned char*) buffer + len, n - len);
+
+            if (ret == -1 && errno == EINTR)
+                continue;
+
+            if (ret <= 0) {
+                source->error = (ret == -1);
+                break;
+            }
+
+            len += ret;
+        }
+
+        return len;
+    }
+
+    if (n > source->len - source->pos)
+        n = source->len - source->pos;
+
+    memcpy(buffer, source->data + source->pos, n);
+    source->pos += n;
+
+    return n;
+}
+
+/**
+ * Read up to n bytes from source into buffer, like source_read(), except that
+ * a file descriptor is read with a single read(), so that fewer than n bytes
+ * are read from a pipe or terminal whenever fewer have arrived.
+ *
+ * Return the number of bytes read, which is 0 only at the end of the source
+ * or on error.
+ */
+size_t source_read_some(SOURCE* source, void* buffer, size_t n) {
+    if (source->type != SOURCE_FD)
+        return source_read(source, buffer, n);
+
+    while (1) {
+        ssize_t ret = read(source->fd, buffer, n);
+
+        if (ret == -1 && errno == EINTR)
+            continue;
+
+        source->error = (ret == -1);
+
+        return (ret > 0) ? (size_t) ret : 0;
+    }
+}
+
+/**
+ * Return 1 if reading from source failed. Otherwise, return 0.
+ */
+int source_error(const SOURCE* source) {
+    if (source->type == SOURCE_FILE)
+        return ferror(source->file) != 0;
+
+    return source->error;
+}
+
+/**
+ * Write the n bytes in buffer to sink.
+ *
+ * Return 0 if the bytes are written without error, or -1 if writing fails or
+ * the bytes do not fit in the memory of sink.
+ */
+int sink_write(SINK* sink, const void* buffer, size_t n) {
+    if (sink->type == SINK_FILE)
+        return (fwrite(buffer, 1, n, sink->file) == n) ? 0 : -1;
+
+    if (sink->type == SINK_FD) {
+        if (sink->data == NULL) {
+            sink->data = malloc(SINK_BUFFER_SIZE);
+            sink->capacity = SINK_BUFFER_SIZE;
+            if (sink->data == NULL)
+                return -1;
+        }
+
+        // Write out the buffer once it cannot take the bytes
+        if (n > sink->capacity - sink->len && sink_flush(sink) == -1)
+            return -1;
+
+        // Large writes skip the buffer
+        if (n >= sink->capacity)
+            return write_all(sink->fd, buffer, n);
+    }
+
+    if (n > sink->capacity - sink->len)
+        return -1;
+
+    memcpy(sink->data + sink->len, buffer, n);
+    sink->len += n;
+
+    return 0;
+}
+
+/**
+ * Write any data buffered for sink.
+ *
+ * Return 0 if the data is written without error. Otherwise, return -1.
+ */
+int sink_flush(SINK* sink) {
+    if (sink->type == SINK_FILE)
+        return (fflush(sink->file) == EOF) ? -1 : 0;
+
+    if (sink->type == SINK_FD && sink->len > 0) {
+        if (write_all(sink->fd, sink->data, sink->len) == -1)
+            return -1;
+
+        sink->len = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Free the buffer of a sink writing to a file descriptor. Buffered data that
+ * was not flushed is discarded.
+ */
+void sink_close(SINK* sink) {
+    if (sink->type != SINK_FD)
+        return;
+
+    free(sink->data);
+    sink->data = NULL;
+    sink->len = 0;
+}
+
+/**
+ * Write the n bytes in buffer to the file descriptor fd, retrying after
+ * partial writes.
+ *
+ * Return 0 if every byte is written. Otherwise, return -1.
+ */
+int write_all(int fd, const unsigned char* buffer, size_t n) {
+    while (n > 0) {
+        ssize_t ret = write(fd, buffer, n);
+
+        if (ret == -1 && errno == EINTR)
+            continue;
+
+        if (ret <= 0)
+            return -1;
+
+        buffer += ret;
+        n -= ret;
+    }
+
+    return 0;
+}
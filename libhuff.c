@@ -0,0 +1,451 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "huff.h"
+
+/**
+ * Allocate a context with the default options.
+ *
+ * Return the context, or NULL if out of memory.
+ */
+huff_ctx* huff_ctx_new(void) {
+    huff_ctx* ctx = calloc(1, sizeof(huff_ctx));
+
+    if (ctx == NULL)
+        return NULL;
+
+    ctx->block_size = MAX_ORIGINAL_BLOCK_SIZE;
+    ctx->num_threads = 1;
+    ctx->num_streams = 1;
+    ctx->range_len = HUFF_RANGE_END;
+    ctx->bad_block = -1;
+    ctx->enc = malloc(sizeof(ENCODER));
+    ctx->dec = malloc(sizeof(DECODER));
+
+    if (ctx->enc == NULL || ctx->dec == NULL) {
+        huff_ctx_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+/**
+ * Free a context and everything it owns.
+ */
+void huff_ctx_free(huff_ctx* ctx) {
+    if (ctx == NULL)
+        return;
+
+    free(ctx->enc);
+    free(ctx->dec);
+    free(ctx->table);
+    free(ctx->input);
+    free(ctx->output);
+    free(ctx);
+}
+
+/**
+ * Set the block size used for compression.
+ *
+ * Return 0 if block_size is in the valid range
+ * [MIN_BLOCK_SIZE (1024), MAX_BLOCK_SIZE (16777216)]. Otherwise, return -1.
+ */
+int huff_set_block_size(huff_ctx* ctx, int block_size) {
+    if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE)
+        return -1;
+
+    ctx->block_size = block_size;
+
+    return 0;
+}
+
+/**
+ * Choose whether compression outputs the framed format.
+ *
+ * Return 0.
+ */
+int huff_set_framed(huff_ctx* ctx, int framed) {
+    ctx->framed = (framed != 0);
+
+    return 0;
+}
+
+/**
+ * Choose whether the blocks of the framed format have canonical headers.
+ *
+ * Return 0.
+ */
+int huff_set_canonical(huff_ctx* ctx, int canonical) {
+    ctx->canonical = (canonical != 0);
+
+    return 0;
+}
+
+/**
+ * Set the number of bitstreams each block of the framed format is split into.
+ *
+ * Return 0 if num_streams is in the valid range [1, MAX_STREAMS (8)].
+ * Otherwise, return -1.
+ */
+int huff_set_streams(huff_ctx* ctx, int num_streams) {
+    if (num_streams < 1 || num_streams > MAX_STREAMS)
+        return -1;
+
+    ctx->num_streams = num_streams;
+
+    return 0;
+}
+
+/**
+ * Choose whether compression ends blocks where the distribution of bytes
+ * changes, or always after the block size.
+ *
+ * Return 0.
+ */
+int huff_set_adaptive(huff_ctx* ctx, int adaptive) {
+    ctx->adaptive = (adaptive != 0);
+
+    return 0;
+}
+
+/**
+ * Choose whether the blocks of the framed format end with a checksum.
+ *
+ * Return 0.
+ */
+int huff_set_checksums(huff_ctx* ctx, int checksums) {
+    ctx->checksums = (checksums != 0);
+
+    return 0;
+}
+
+/**
+ * Choose whether compression outputs the dynamic format.
+ *
+ * Return 0.
+ */
+int huff_set_dynamic(huff_ctx* ctx, int dynamic) {
+    ctx->dynamic = (dynamic != 0);
+
+    return 0;
+}
+
+/**
+ * Make decompression output only the len bytes starting at offset, or all of
+ * the data if offset is 0 and len is HUFF_RANGE_END.
+ *
+ * Return 0.
+ */
+int huff_set_range(huff_ctx* ctx, unsigned long long offset, unsigned long long len) {
+    ctx->ranged = (offset != 0 || len != HUFF_RANGE_END);
+    ctx->range_offset = offset;
+    ctx->range_len = len;
+
+    return 0;
+}
+
+/**
+ * Write a table fitted to the n bytes of samples at src to dst, which has room
+ * for capacity bytes.
+ *
+ * Return the size of the table, or -1 if it does not fit.
+ */
+long huff_train_table(huff_ctx* ctx, const void* src, size_t n, void* dst, size_t capacity) {
+    return train_table(ctx, src, n, dst, capacity);
+}
+
+/**
+ * Give ctx the table of len bytes at table, or take its table away if table
+ * is NULL.
+ *
+ * Return 0 if table is NULL or a valid table. Otherwise, return -1.
+ */
+int huff_set_table(huff_ctx* ctx, const void* table, size_t len) {
+    STATIC_TABLE* static_table = NULL;
+
+    if (table != NULL) {
+        static_table = load_table(ctx, table, len);
+        if (static_table == NULL)
+            return -1;
+    }
+
+    free(ctx->table);
+    ctx->table = static_table;
+
+    return 0;
+}
+
+/**
+ * Set the number of threads used to compress and decompress blocks.
+ *
+ * Return 0 if num_threads is in the valid range [1, MAX_THREADS (256)].
+ * Otherwise, return -1.
+ */
+int huff_set_threads(huff_ctx* ctx, int num_threads) {
+    if (num_threads < 1 || num_threads > MAX_THREADS)
+        return -1;
+
+    ctx->num_threads = num_threads;
+
+    return 0;
+}
+
+/**
+ * Choose whether blocks are read on a thread of their own.
+ *
+ * Return 0.
+ */
+int huff_set_pipelined(huff_ctx* ctx, int pipelined) {
+    ctx->pipelined = (pipelined != 0);
+
+    return 0;
+}
+
+/**
+ * Limit the codes used for compression to max_length bits, or remove the
+ * limit if max_length is 0.
+ *
+ * Return 0 if max_length is 0 or in the valid range
+ * [MIN_CODE_LENGTH (11), MAX_CODE_LENGTH (24)]. Otherwise, return -1.
+ */
+int huff_set_max_code_length(huff_ctx* ctx, int max_length) {
+    if (max_length != 0 && (max_length < MIN_CODE_LENGTH || max_length > MAX_CODE_LENGTH))
+        return -1;
+
+    ctx->max_code_length = max_length;
+
+    return 0;
+}
+
+/**
+ * Write statistics of the blocks compressed or decompressed with ctx to out,
+ * or stop writing them if out is NULL.
+ *
+ * Return 0 if format is HUFF_STATS_TEXT or HUFF_STATS_JSON. Otherwise, return
+ * -1.
+ */
+int huff_set_stats(huff_ctx* ctx, FILE* out, int format) {
+    if (format != HUFF_STATS_TEXT && format != HUFF_STATS_JSON)
+        return -1;
+
+    ctx->stats_out = out;
+    ctx->stats_format = format;
+
+    return 0;
+}
+
+/**
+ * Return the number of the first block the last decompression with ctx found
+ * corrupt, or -1 if there was none.
+ */
+long huff_bad_block(const huff_ctx* ctx) {
+    return ctx->bad_block;
+}
+
+/**
+ * Return the largest size the compressed form of n bytes can take. Each block
+ * takes at most COMPRESS_BLOCK_BOUND() bytes, plus its frame header and index
+ * entry in the framed format. The dynamic format takes at most its header and
+ * DYNAMIC_BOUND(n) bytes.
+ */
+size_t huff_compress_bound(const huff_ctx* ctx, size_t n) {
+    if (ctx->dynamic)
+        return DYNAMIC_HEADER_SIZE + DYNAMIC_BOUND(n);
+
+    size_t num_blocks = (n + ctx->block_size - 1) / ctx->block_size;
+    size_t bound = n + n / 8 + num_blocks * COMPRESS_BLOCK_BOUND(0);
+
+    if (ctx_framed(ctx))
+        bound += FILE_HEADER_SIZE + num_blocks * 2 * FRAME_HEADER_SIZE + 4 + TRAILER_SIZE;
+
+    return bound;
+}
+
+/**
+ * Compress the n bytes at src into dst, which has room for capacity bytes.
+ *
+ * Return the size of the compressed data, or -1 if it does not fit.
+ */
+long huff_compress(huff_ctx* ctx, const void* src, size_t n, void* dst, size_t capacity) {
+    SOURCE source = {.data = src, .len = n};
+    SINK sink = {.data = dst, .capacity = capacity};
+
+    if (compress_stream(ctx, &source, &sink) == -1)
+        return -1;
+
+    return sink.len;
+}
+
+/**
+ * Compress each of the num_buffers buffers at buffers on its own.
+ *
+ * Return 0 if every buffer is compressed without error. Otherwise, return -1.
+ */
+int huff_compress_batch(huff_ctx* ctx, huff_buffer* buffers, size_t num_buffers) {
+    return compress_batch(ctx, buffers, num_buffers);
+}
+
+/**
+ * Decompress the n bytes at src into dst, which has room for capacity bytes.
+ *
+ * Return the size of the decompressed data, or -1 if src is not valid
+ * compressed data or the decompressed data does not fit.
+ */
+long huff_decompress(huff_ctx* ctx, const void* src, size_t n, void* dst, size_t capacity) {
+    SOURCE source = {.data = src, .len = n};
+    SINK sink = {.data = dst, .capacity = capacity};
+
+    if (decompress_stream(ctx, &source, &sink) == -1)
+        return -1;
+
+    return sink.len;
+}
+
+/**
+ * Compress everything that can be read from in and write it to out.
+ *
+ * Return 0 if compressing succeeds without error. Otherwise, return -1.
+ */
+int huff_compress_file(huff_ctx* ctx, FILE* in, FILE* out) {
+    SOURCE source = {.type = SOURCE_FILE, .file = in};
+    SINK sink = {.type = SINK_FILE, .file = out};
+
+    return compress_stream(ctx, &source, &sink);
+}
+
+/**
+ * Decompress everything that can be read from in and write it to out.
+ *
+ * Return 0 if decompression succeeds without error. Otherwise, return -1.
+ */
+int huff_decompress_file(huff_ctx* ctx, FILE* in, FILE* out) {
+    SOURCE source = {.type = SOURCE_FILE, .file = in};
+    SINK sink = {.type = SINK_FILE, .file = out};
+
+    return decompress_stream(ctx, &source, &sink);
+}
+
+/**
+ * Compress everything that can be read from the file descriptor in_fd and
+ * write it to the file descriptor out_fd.
+ *
+ * Return 0 if compressing succeeds without error. Otherwise, return -1.
+ */
+int huff_compress_fd(huff_ctx* ctx, int in_fd, int out_fd) {
+    SOURCE source = {.type = SOURCE_FD, .fd = in_fd};
+    SINK sink = {.type = SINK_FD, .fd = out_fd};
+
+    source_open(&source);
+    int ret = compress_stream(ctx, &source, &sink);
+    source_close(&source);
+    sink_close(&sink);
+
+    return ret;
+}
+
+/**
+ * Decompress everything that can be read from the file descriptor in_fd and
+ * write it to the file descriptor out_fd.
+ *
+ * Return 0 if decompression succeeds without error. Otherwise, return -1.
+ */
+int huff_decompress_fd(huff_ctx* ctx, int in_fd, int out_fd) {
+    SOURCE source = {.type = SOURCE_FD, .fd = in_fd};
+    SINK sink = {.type = SINK_FD, .fd = out_fd};
+
+    source_open(&source);
+    int ret = decompress_stream(ctx, &source, &sink);
+    source_close(&source);
+    sink_close(&sink);
+
+    return ret;
+}
+
+/**
+ * Start compressing strm with the options of ctx.
+ *
+ * Return 0 if the stream is set up without error. Otherwise, return -1.
+ */
+int huff_compress_begin(huff_ctx* ctx, huff_stream* strm) {
+    return push_begin(ctx, strm, 1);
+}
+
+/**
+ * Compress the input of strm into its output as far as both allow.
+ *
+ * Return 1 once the compressed data has ended and been handed out, 0 if more
+ * input or room for output is needed, or -1 on error.
+ */
+int huff_compress_push(huff_stream* strm, int flush) {
+    if (strm->state == NULL || flush < HUFF_RUN || flush > HUFF_FINISH)
+        return -1;
+
+    return push_compress(strm, flush);
+}
+
+/**
+ * Start decompressing strm with ctx.
+ *
+ * Return 0 if the stream is set up without error. Otherwise, return -1.
+ */
+int huff_decompress_begin(huff_ctx* ctx, huff_stream* strm) {
+    return push_begin(ctx, strm, 0);
+}
+
+/**
+ * Decompress the input of strm into its output as far as both allow.
+ *
+ * Return 1 once the compressed data has ended and all of the decompressed
+ * data has been handed out, 0 if more input or room for output is needed,
+ * or -1 if the input is not valid compressed data.
+ */
+int huff_decompress_push(huff_stream* strm, int flush) {
+    if (strm->state == NULL || flush < HUFF_RUN || flush > HUFF_FINISH)
+        return -1;
+
+    return push_decompress(strm, flush);
+}
+
+/**
+ * Free the state of strm.
+ */
+void huff_stream_end(huff_stream* strm) {
+    push_end(strm);
+}
+
+/**
+ * Make the input and output buffers of ctx hold at least input_size and
+ * output_size bytes.
+ *
+ * Return 0 if the buffers are large enough. Otherwise, return -1.
+ */
+int ctx_reserve(huff_ctx* ctx, size_t input_size, size_t output_size) {
+    if (ctx->input_size < input_size) {
+        unsigned char* input = realloc(ctx->input, input_size);
+        if (input == NULL)
+            return -1;
+
+        ctx->input = input;
+        ctx->input_size = input_size;
+    }
+
+    if (ctx->output_size < output_size) {
+        unsigned char* output = realloc(ctx->output, output_size);
+        if (output == NULL)
+            return -1;
+
+        ctx->output = output;
+        ctx->output_size = output_size;
+    }
+
+    return 0;
+}
+
+/**
+ * Return 1 if compressing with the options of ctx outputs the framed format,
+ * which is either chosen or needed for blocks too large for the original
+ * format or coded with a static table. Otherwise, return 0.
+ */
+int ctx_framed(const huff_ctx* ctx) {
+    return ctx->framed || ctx->block_size > MAX_ORIGINAL_BLOCK_SIZE || ctx->table != NULL;
+}
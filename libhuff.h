@@ -0,0 +1,343 @@
+#ifndef LIBHUFF_H
+#define LIBHUFF_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * libhuff compresses and decompresses data through Huffman coding, either
+ * from buffer to buffer or from stream to stream.
+ *
+ * All state lives in a context. A context must not be used by two threads at
+ * the same time, but any number of contexts can be used concurrently from
+ * different threads. Functions returning int return 0 on success and -1 on
+ * error; functions returning long return a byte count or -1 on error.
+ */
+
+#if defined(__GNUC__)
+#define HUFF_API __attribute__((visibility("default")))
+#else
+#define HUFF_API
+#endif
+
+#define HUFF_MIN_BLOCK_SIZE 1024 // Smallest possible block size
+#define HUFF_MAX_BLOCK_SIZE 16777216 // Largest possible block size
+#define HUFF_MAX_ORIGINAL_BLOCK_SIZE 65536 // Largest block size of the original format
+#define HUFF_MAX_THREADS 256 // Largest possible number of threads
+#define HUFF_MAX_STREAMS 8 // Largest possible number of streams per block
+#define HUFF_MIN_CODE_LENGTH 11 // Smallest possible limit on code lengths
+#define HUFF_MAX_CODE_LENGTH 24 // Largest possible limit on code lengths
+
+typedef struct huff_ctx huff_ctx;
+
+/**
+ * A stream compressed or decompressed in pieces of any size, in the manner
+ * of zlib. The caller points next_in at the input it has and next_out at room
+ * for output, and each push consumes input and produces output as far as
+ * both allow, advancing them and counting them in total_in and total_out. A
+ * push never waits for input: a block or header that has only partly arrived
+ * is kept in the stream until the rest is pushed, so streams suit event loops
+ * that receive data in arbitrary chunks. Pushes run on the calling thread,
+ * whatever the number of threads of the context.
+ */
+typedef struct huff_stream {
+    const unsigned char* next_in;
+    size_t avail_in;
+    unsigned char* next_out;
+    size_t avail_out;
+    size_t total_in;
+    size_t total_out;
+    void* state; // Owned by the library
+} huff_stream;
+
+#define HUFF_RUN 0 // Compress whole blocks as their input arrives
+#define HUFF_FLUSH 1 // Also compress the input held back, ending a block
+#define HUFF_FINISH 2 // No input follows
+
+/**
+ * One buffer of a batch compressed with huff_compress_batch(): the n bytes at
+ * src are compressed into dst, which has room for capacity bytes, and len
+ * receives the size of the compressed data, or -1 if it does not fit.
+ */
+typedef struct huff_buffer {
+    const void* src;
+    size_t n;
+    void* dst;
+    size_t capacity;
+    long len;
+} huff_buffer;
+
+/**
+ * Allocate a context with the default options: fixed blocks of 65536 bytes,
+ * the original (unframed) format, tree headers, one stream per block, one
+ * thread, and no limit on code lengths. Return NULL if out of memory.
+ */
+HUFF_API huff_ctx* huff_ctx_new(void);
+
+/**
+ * Free a context and everything it owns. ctx may be NULL.
+ */
+HUFF_API void huff_ctx_free(huff_ctx* ctx);
+
+/**
+ * Set the block size used for compression, in bytes ([1024, 16777216]). The
+ * original format only holds blocks of up to 65536 bytes, so larger blocks
+ * are always compressed to the framed format, which records the block size.
+ */
+HUFF_API int huff_set_block_size(huff_ctx* ctx, int block_size);
+
+/**
+ * Choose whether compression outputs the framed format (nonzero) or the
+ * original format (zero). Decompression accepts either format.
+ */
+HUFF_API int huff_set_framed(huff_ctx* ctx, int framed);
+
+/**
+ * Set the number of threads used to compress blocks, and to decompress the
+ * blocks of the framed format ([1, 256]).
+ */
+HUFF_API int huff_set_threads(huff_ctx* ctx, int num_threads);
+
+/**
+ * Choose whether compression and decompression of the framed format read
+ * blocks on a thread of their own (nonzero), overlapping reading with the
+ * threads that code blocks and with the calling thread, which writes them,
+ * or read them on the calling thread between writes (zero). This applies
+ * with any number of threads, one included, and pays off when reads are
+ * slow, such as from a pipe or network storage. Data in the original format
+ * is always decompressed on the calling thread.
+ */
+HUFF_API int huff_set_pipelined(huff_ctx* ctx, int pipelined);
+
+/**
+ * Limit the codes used for compression to max_length bits ([11, 24]), or
+ * remove the limit if max_length is 0. Blocks whose Huffman codes would be
+ * longer get the optimal codes within the limit instead. The framed format
+ * records the limit.
+ */
+HUFF_API int huff_set_max_code_length(huff_ctx* ctx, int max_length);
+
+/**
+ * Choose whether the blocks of the framed format describe their codes by
+ * code lengths alone (nonzero), or by the shape of their Huffman tree and the
+ * symbols at its leaves (zero). Code lengths take less room and are faster to
+ * decode.
+ */
+HUFF_API int huff_set_canonical(huff_ctx* ctx, int canonical);
+
+/**
+ * Set the number of bitstreams each block of the framed format is split
+ * into ([1, 8]). The streams of a block are independent, so they are decoded
+ * together, one symbol of each in turn, overlapping the work of decoding
+ * consecutive symbols.
+ */
+HUFF_API int huff_set_streams(huff_ctx* ctx, int num_streams);
+
+/**
+ * Choose whether compression ends each block where the distribution of the
+ * bytes that follow differs enough from that of the block to be worth a new
+ * Huffman code (nonzero), or always after the block size (zero). With
+ * adaptive blocks, the block size is the largest size of a block.
+ */
+HUFF_API int huff_set_adaptive(huff_ctx* ctx, int adaptive);
+
+/**
+ * Choose whether each block of the framed format ends with the CRC32C of its
+ * uncompressed data (nonzero) or not (zero). Decompression checks every block
+ * against its checksum. The CRC is taken with the CRC instructions of SSE4.2
+ * or ARMv8 where available, during the same pass over each block as its
+ * histogram, and the framed format records whether blocks have checksums.
+ */
+HUFF_API int huff_set_checksums(huff_ctx* ctx, int checksums);
+
+/**
+ * Choose whether compression outputs the dynamic format (nonzero) instead of
+ * blocks. The dynamic format codes each byte with a Huffman code that the
+ * compressor and the decompressor both update after every byte, in the
+ * manner of the FGK algorithm, so it needs no headers and nothing waits for a
+ * block to fill: a stream compressed with huff_compress_push() hands out the
+ * code of every byte as soon as it is pushed, but for the bits of an
+ * incomplete byte, and HUFF_FLUSH pads those out with a few bytes instead of
+ * ending a block. Coding a byte at a time is several times slower than coding
+ * blocks, so the format suits data that trickles in and must be passed on at
+ * once. The options for blocks and tables do not apply to it. Decompression
+ * recognizes the format on its own, and collects no statistics of it.
+ */
+HUFF_API int huff_set_dynamic(huff_ctx* ctx, int dynamic);
+
+#define HUFF_RANGE_END ((unsigned long long) -1) // Length of a range running to the end
+
+/**
+ * Make decompression with ctx output only the len bytes of decompressed data
+ * starting at offset, or the part of them before the end of the data. The
+ * whole data is output again with offset 0 and len HUFF_RANGE_END, which is
+ * the default. The blocks of the framed format that hold the range are found
+ * through the index at the end of the data, so when the compressed data is in
+ * memory or in a regular file, only those blocks are read and decompressed.
+ * Other compressed data, such as from a pipe or in the original format, is
+ * decompressed from the start and the range cut out of it. Streams started
+ * with huff_decompress_begin() ignore the range.
+ */
+HUFF_API int huff_set_range(huff_ctx* ctx, unsigned long long offset, unsigned long long len);
+
+#define HUFF_MAX_TABLE_SIZE 330 // Largest possible size of a table
+
+/**
+ * Derive a pre-trained table from the n bytes of samples at src, such as a
+ * collection of typical messages, and write it to dst, which has room for
+ * capacity bytes (HUFF_MAX_TABLE_SIZE always suffices). The table holds a
+ * Huffman code for every byte value, fitted to the samples, whose codes are
+ * no longer than the limit set by huff_set_max_code_length(), or 12 bits if
+ * there is none, so that each is decoded with a single lookup. Return the
+ * size of the table, or -1 if it does not fit.
+ */
+HUFF_API long huff_train_table(huff_ctx* ctx, const void* src, size_t n, void* dst, size_t capacity);
+
+/**
+ * Give ctx the len bytes of a table written by huff_train_table(), or take
+ * its table away if table is NULL. The table is read and its code built once,
+ * here. Compression with a table outputs the framed format, and codes each
+ * block with the table instead of a code of its own when that is estimated to
+ * take less room, leaving out the block's header and the work of building its
+ * code; this suits small messages, whose headers cost more than a code fitted
+ * to them saves. Data in memory that makes a single block coded with the
+ * table is output as a message instead when that is smaller, since its
+ * header takes 7 to 13 bytes where the framed format adds 45, unless
+ * checksums or streams are asked for. Decompression needs the same table
+ * for data compressed with one, and rejects data compressed with another.
+ * Return -1 if table is not a valid table, leaving ctx with the table it had.
+ */
+HUFF_API int huff_set_table(huff_ctx* ctx, const void* table, size_t len);
+
+#define HUFF_STATS_TEXT 0 // Statistics as a table
+#define HUFF_STATS_JSON 1 // Statistics as one JSON object per line
+
+/**
+ * Write statistics of the blocks compressed or decompressed with ctx to out,
+ * or stop writing them if out is NULL. For each block, they give its type,
+ * its uncompressed and compressed sizes, the size of its header, the number
+ * of distinct symbols, the longest code, the entropy of the symbols and the
+ * bits actually taken per symbol, and the time spent counting symbols,
+ * building the code, encoding, decoding, and on I/O. Each call ends with the
+ * totals of its blocks. The times of blocks processed on different threads
+ * overlap, so their totals can exceed the time the call took, which is given
+ * too. Streams started with huff_compress_begin() or huff_decompress_begin()
+ * and batches compressed with huff_compress_batch() collect no statistics.
+ */
+HUFF_API int huff_set_stats(huff_ctx* ctx, FILE* out, int format);
+
+/**
+ * Return the largest size the compressed form of n bytes can take with the
+ * options of ctx.
+ */
+HUFF_API size_t huff_compress_bound(const huff_ctx* ctx, size_t n);
+
+/**
+ * Compress the n bytes at src into dst, which has room for capacity bytes.
+ * Return the size of the compressed data, or -1 if it does not fit.
+ */
+HUFF_API long huff_compress(huff_ctx* ctx, const void* src, size_t n, void* dst, size_t capacity);
+
+/**
+ * Compress each of the num_buffers buffers at buffers on its own, as
+ * huff_compress() would, so that each can be decompressed by itself. The
+ * buffers are spread over the threads of ctx, each of which keeps one
+ * encoder, one set of block buffers, and the state of its last buffer for
+ * the next one, so that many small buffers cost little more than their
+ * coding. A table given to ctx with huff_set_table() is shared by the whole
+ * batch, its code built only once, which spares small buffers from building
+ * a code of their own. Return 0 if every buffer is compressed, or -1 if any
+ * is not, as its len tells.
+ */
+HUFF_API int huff_compress_batch(huff_ctx* ctx, huff_buffer* buffers, size_t num_buffers);
+
+/**
+ * Decompress the n bytes at src into dst, which has room for capacity bytes.
+ * Return the size of the decompressed data, or -1 if src is not valid
+ * compressed data or the decompressed data does not fit.
+ */
+HUFF_API long huff_decompress(huff_ctx* ctx, const void* src, size_t n, void* dst, size_t capacity);
+
+/**
+ * After decompression with ctx fails, return the number of the first block,
+ * counting from 0, that is corrupt: one that does not decode to its recorded
+ * length or does not match its checksum. Return -1 if no block was found
+ * corrupt, such as when the data is cut short or decompression succeeds.
+ */
+HUFF_API long huff_bad_block(const huff_ctx* ctx);
+
+/**
+ * Start compressing strm with the options of ctx. ctx is used by the stream
+ * until huff_stream_end() and must not be used for anything else meanwhile.
+ */
+HUFF_API int huff_compress_begin(huff_ctx* ctx, huff_stream* strm);
+
+/**
+ * Compress the input of strm into its output as far as both allow. With
+ * HUFF_RUN, input is held back until it fills a block, or in the dynamic
+ * format only the bits of an incomplete byte are. HUFF_FLUSH compresses all
+ * input pushed so far, so that it can be decompressed from the output handed
+ * out, at the cost of ending a block early. HUFF_FINISH also ends the
+ * compressed data, after which no input may be pushed.
+ *
+ * Return 1 once all of the compressed data has been handed out after
+ * HUFF_FINISH, 0 if more input or room for output is needed, or -1 on error.
+ * Output is pending while a push leaves avail_out at 0.
+ */
+HUFF_API int huff_compress_push(huff_stream* strm, int flush);
+
+/**
+ * Start decompressing strm with ctx, which is used by the stream until
+ * huff_stream_end() and must not be used for anything else meanwhile. Every
+ * format is accepted.
+ */
+HUFF_API int huff_decompress_begin(huff_ctx* ctx, huff_stream* strm);
+
+/**
+ * Decompress the input of strm into its output as far as both allow. A block
+ * of the framed format is decompressed as soon as all of it is pushed, while
+ * the end of a block of the original format is only found by decoding it,
+ * and the dynamic format is decoded as far as each push reaches. A message
+ * is decompressed once all of it is pushed, like a block. flush is
+ * HUFF_FINISH once no more input follows, which ends data in the original
+ * format; the framed format and a message end by themselves, and input past
+ * their end is left in strm.
+ *
+ * Return 1 once the end of the compressed data is reached and all of the
+ * decompressed data has been handed out, 0 if more input or room for output
+ * is needed, or -1 if the input is not valid compressed data.
+ */
+HUFF_API int huff_decompress_push(huff_stream* strm, int flush);
+
+/**
+ * Free the state of strm, compressing or decompressing, whether or not it has
+ * ended.
+ */
+HUFF_API void huff_stream_end(huff_stream* strm);
+
+/**
+ * Compress everything that can be read from in and write it to out. The
+ * streams are accessed through stdio.
+ */
+HUFF_API int huff_compress_file(huff_ctx* ctx, FILE* in, FILE* out);
+
+/**
+ * Decompress everything that can be read from in and write it to out.
+ */
+HUFF_API int huff_decompress_file(huff_ctx* ctx, FILE* in, FILE* out);
+
+/**
+ * Compress everything that can be read from the file descriptor in_fd and
+ * write it to the file descriptor out_fd. If in_fd refers to a regular file,
+ * the rest of it is mapped into memory; otherwise it is read with large
+ * read() calls. Output is buffered and written with large write() calls.
+ */
+HUFF_API int huff_compress_fd(huff_ctx* ctx, int in_fd, int out_fd);
+
+/**
+ * Decompress everything that can be read from the file descriptor in_fd and
+ * write it to the file descriptor out_fd, in the manner of huff_compress_fd().
+ */
+HUFF_API int huff_decompress_fd(huff_ctx* ctx, int in_fd, int out_fd);
+
+#endif
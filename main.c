@@ -1,39 +1,71 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "huff.h"
+#include <unistd.h>
+#include "libhuff.h"
 
-int valid_options(int argc, char **argv);
+/**
+ * Bit 0 is 1: -h flag is specified.
+ * Bit 1 is 1: -c flag is specified.
+ * Bit 2 is 1: -d flag is specified.
+ * Bit 3 is 1: -T flag is specified.
+ */
+#define OPTION_HELP 0x1
+#define OPTION_COMPRESS 0x2
+#define OPTION_DECOMPRESS 0x4
+#define OPTION_TRAIN 0x8
+
+int valid_options(int argc, char **argv, int* options, huff_ctx* ctx);
 void print_menu(void);
 int is_valid_block_size(const char* str);
+int is_valid_thread_count(const char* str);
+int is_valid_code_length(const char* str);
+int is_valid_stream_count(const char* str);
+int is_valid_number(const char* str, int min, int max);
+int parse_range(const char* str, unsigned long long* offset, unsigned long long* len);
+int parse_whole_number(const char* str, const char* end, unsigned long long* num);
+int load_table_file(huff_ctx* ctx, const char* path);
+int write_table(huff_ctx* ctx, FILE* in, FILE* out);
 
 int main(int argc, char** argv) {
-    int ret;
+    int options = 0;
+    int ret = 0;
+    huff_ctx* ctx = huff_ctx_new();
+
+    if (ctx == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
 
     // Check if argument is valid
-    if (valid_options(argc, argv) == -1) {
+    if (valid_options(argc, argv, &options, ctx) == -1) {
         fprintf(stderr, "Invalid options.\n");
         print_menu();
+        huff_ctx_free(ctx);
         return EXIT_FAILURE;
     }
 
-    // Check if bit 0 is set
-    if (global_options & 1) {
+    // Check if bit 0, 1, or 2 is set
+    if (options & OPTION_HELP) {
         print_menu();
-        return EXIT_SUCCESS;
-    }
-
-    // Check if bit 1 or 2 is set
-    if (global_options & 0x2) {
-        ret = compress();
+    } else if (options & OPTION_COMPRESS) {
+        ret = huff_compress_fd(ctx, STDIN_FILENO, STDOUT_FILENO);
         if (ret == -1)
             fprintf(stderr, "Compression error\n");
-    } else if (global_options & 0x4) {
-        ret = decompress();
-        if (ret == -1)
+    } else if (options & OPTION_DECOMPRESS) {
+        ret = huff_decompress_fd(ctx, STDIN_FILENO, STDOUT_FILENO);
+        if (ret == -1 && huff_bad_block(ctx) != -1)
+            fprintf(stderr, "Decompression error: block %ld is corrupt\n", huff_bad_block(ctx));
+        else if (ret == -1)
             fprintf(stderr, "Decompression error\n");
+    } else if (options & OPTION_TRAIN) {
+        ret = write_table(ctx, stdin, stdout);
+        if (ret == -1)
+            fprintf(stderr, "Training error\n");
     }
 
+    huff_ctx_free(ctx);
+
     if (ret == 0)
         return EXIT_SUCCESS;
     else
@@ -42,50 +74,95 @@ int main(int argc, char** argv) {
 
 /**
  * valid_options() check to see if the specified command line arguments are
- * valid or not. If they are valid, the bits in the global_options variable
- * will be set to indicate what action to take as well as other information.
+ * valid or not. If they are valid, the bits in options will be set to
+ * indicate what action to take, and the remaining options are set in ctx.
  *
  * Return 0 if the specified command line arguments are valid. Otherwise,
  * return -1.
  */
-int valid_options(int argc, char **argv) {
+int valid_options(int argc, char **argv, int* options, huff_ctx* ctx) {
     // Failure if no flags are provided
     if (argc == 1)
         return -1;
 
     // Success if -h is the first option on the command line
     if (strcmp(argv[1], "-h") == 0) {
-        global_options |= 1;
+        *options |= OPTION_HELP;
         return 0;
     }
 
-    // Success if -d is the first and only option on the command line
-    if (argc == 2 && strcmp(argv[1], "-d") == 0) {
-        global_options |= 0xffff0004;
-        return 0;
-    }
+    int compress = strcmp(argv[1], "-c") == 0;
+    int decompress = strcmp(argv[1], "-d") == 0;
+    int train = strcmp(argv[1], "-T") == 0;
 
-    if (strcmp(argv[1], "-c") == 0) {
-        // Success if -c is the first and only option on the command line
-        if (argc == 2) {
-            global_options |= 0xffff0002;
-            return 0;
-        }
+    // Failure if none of -c, -d, and -T is the first option on the command line
+    if (!compress && !decompress && !train)
+        return -1;
 
-        // Success if command line format is "./huff -c -b BLOCKSIZE", where
-        // BLOCKSIZE is in the valid range
-        // [MIN_BLOCK_SIZE (1024), MAX_BLOCK_SIZE (65536)]
-        if (argc == 4 && strcmp(argv[2], "-b") == 0 &&
-            is_valid_block_size(argv[3])) {
-            // Store the specified block size minus one in the 16 most
-            // significant bits of global_options
-            int block_size = atoi(argv[3]);
-            global_options |= ((block_size - 1) << 16) | 0x2;
-            return 0;
+    // Success if command line format is
+    // "./huff -c [-a] [-b BLOCKSIZE] [-f] [-C] [-D] [-k] [-j THREADS]
+    // [-L MAXLEN] [-p] [-s STREAMS] [-t TABLEFILE] [--stats[=json]]",
+    // "./huff -d [-j THREADS] [-p] [-t TABLEFILE] [--range OFFSET:LEN]
+    // [--stats[=json]]", or "./huff -T [-L MAXLEN]", where BLOCKSIZE is in
+    // the valid range [HUFF_MIN_BLOCK_SIZE (1024), HUFF_MAX_BLOCK_SIZE
+    // (16777216)], THREADS is in the valid range [1, HUFF_MAX_THREADS (256)],
+    // MAXLEN is in the valid range [HUFF_MIN_CODE_LENGTH (11),
+    // HUFF_MAX_CODE_LENGTH (24)], and STREAMS is in the valid range
+    // [1, HUFF_MAX_STREAMS (8)]
+    unsigned long long offset, len;
+    for (int i = 2; i < argc; i++) {
+        if (compress && strcmp(argv[i], "-a") == 0) {
+            huff_set_adaptive(ctx, 1);
+        } else if (compress && strcmp(argv[i], "-f") == 0) {
+            huff_set_framed(ctx, 1);
+        } else if (compress && strcmp(argv[i], "-C") == 0) {
+            // Canonical headers exist only in the framed format
+            huff_set_canonical(ctx, 1);
+            huff_set_framed(ctx, 1);
+        } else if (compress && strcmp(argv[i], "-D") == 0) {
+            huff_set_dynamic(ctx, 1);
+        } else if (compress && strcmp(argv[i], "-k") == 0) {
+            // Checksums exist only in the framed format
+            huff_set_checksums(ctx, 1);
+            huff_set_framed(ctx, 1);
+        } else if (train) {
+            // Only a limit on code lengths applies to training
+            if (i + 1 == argc || strcmp(argv[i], "-L") != 0 || !is_valid_code_length(argv[i + 1]))
+                return -1;
+            huff_set_max_code_length(ctx, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-p") == 0) {
+            huff_set_pipelined(ctx, 1);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            huff_set_stats(ctx, stderr, HUFF_STATS_TEXT);
+        } else if (strcmp(argv[i], "--stats=json") == 0) {
+            huff_set_stats(ctx, stderr, HUFF_STATS_JSON);
+        } else if (i + 1 == argc) {
+            return -1;
+        } else if (compress && strcmp(argv[i], "-b") == 0 && is_valid_block_size(argv[i + 1])) {
+            huff_set_block_size(ctx, atoi(argv[++i]));
+        } else if (decompress && strcmp(argv[i], "--range") == 0 && parse_range(argv[i + 1], &offset, &len)) {
+            huff_set_range(ctx, offset, len);
+            i++;
+        } else if (strcmp(argv[i], "-j") == 0 && is_valid_thread_count(argv[i + 1])) {
+            huff_set_threads(ctx, atoi(argv[++i]));
+        } else if (compress && strcmp(argv[i], "-L") == 0 && is_valid_code_length(argv[i + 1])) {
+            // The limit is recorded in the framed format
+            huff_set_max_code_length(ctx, atoi(argv[++i]));
+            huff_set_framed(ctx, 1);
+        } else if (compress && strcmp(argv[i], "-s") == 0 && is_valid_stream_count(argv[i + 1])) {
+            // Streams exist only in the framed format
+            huff_set_streams(ctx, atoi(argv[++i]));
+            huff_set_framed(ctx, 1);
+        } else if (strcmp(argv[i], "-t") == 0 && load_table_file(ctx, argv[i + 1]) == 0) {
+            // Tables are used only in the framed format
+            i++;
+        } else {
+            return -1;
         }
     }
 
-    return -1;
+    *options |= compress ? OPTION_COMPRESS : decompress ? OPTION_DECOMPRESS : OPTION_TRAIN;
+    return 0;
 }
 
 /**
@@ -94,20 +171,70 @@ int valid_options(int argc, char **argv) {
 void print_menu(void) {
     fprintf(stderr,
         "Menu:\n"
-        "./huff [-h] [-c|-d] [-b BLOCKSIZE]\n"
+        "./huff [-h] [-c|-d|-T] [-a] [-b BLOCKSIZE] [-f] [-C] [-D] [-k] [-j THREADS] [-L MAXLEN]\n"
+        "       [-p] [-s STREAMS] [-t TABLEFILE] [--range OFFSET:LEN] [--stats[=json]]\n"
         "-h   Help: Display this help menu.\n"
         "-c   Compress: Read the original data and output compressed data.\n"
-        "-b   Block Size: (Use only if -c is specified). Specify the block size in bytes ([1024, 65536]).\n"
-        "-d   Decompress: Read the compressed data and output original data.\n");
+        "-a   Adaptive: (Use only if -c is specified). End blocks where the byte distribution changes.\n"
+        "-b   Block Size: (Use only if -c is specified). Specify the block size in bytes ([1024, 16777216]). Above 65536, implies -f.\n"
+        "-f   Framed: (Use only if -c is specified). Output the framed format, which records the length of every block.\n"
+        "-C   Canonical: (Use only if -c is specified). Describe the codes of each block by their lengths alone. Implies -f.\n"
+        "-D   Dynamic: (Use only if -c is specified). Code each byte with a Huffman code updated after every byte.\n"
+        "-k   Checksums: (Use only if -c is specified). End each block with a CRC32C of its data, which -d checks. Implies -f.\n"
+        "-j   Threads: Compress or decompress blocks on the specified number of threads ([1, 256]).\n"
+        "-L   Max Code Length: (Use only if -c is specified). Limit codes to the specified number of bits ([11, 24]). Implies -f.\n"
+        "-p   Pipelined: Read blocks on a separate thread.\n"
+        "-s   Streams: (Use only if -c is specified). Split each block into the specified number of bitstreams ([1, 8]). Implies -f.\n"
+        "-t   Table: (Use only if -c or -d is specified). Code blocks with the table in TABLEFILE, written by -T.\n"
+        "-d   Decompress: Read the compressed data and output original data.\n"
+        "-T   Train: Read sample data and output a table for -t fitted to it.\n"
+        "--range   Range: (Use only if -d is specified). Output only the LEN bytes of original data starting at byte OFFSET.\n"
+        "--stats   Statistics: Write per-block and total statistics to stderr (=json for JSON lines).\n");
 }
 
 /**
  * Check if the string is a valid block size. If the string is a whole number
  * and the whole number is in the valid range
- * [MIN_BLOCK_SIZE (1024), MAX_BLOCK_SIZE (65536)], return 1. Otherwise,
- * return 0.
+ * [HUFF_MIN_BLOCK_SIZE (1024), HUFF_MAX_BLOCK_SIZE (16777216)], return 1.
+ * Otherwise, return 0.
 */
 int is_valid_block_size(const char* str) {
+    return is_valid_number(str, HUFF_MIN_BLOCK_SIZE, HUFF_MAX_BLOCK_SIZE);
+}
+
+/**
+ * Check if the string is a valid number of threads. If the string is a whole
+ * number and the whole number is in the valid range
+ * [1, HUFF_MAX_THREADS (256)], return 1. Otherwise, return 0.
+ */
+int is_valid_thread_count(const char* str) {
+    return is_valid_number(str, 1, HUFF_MAX_THREADS);
+}
+
+/**
+ * Check if the string is a valid limit on code lengths. If the string is a
+ * whole number and the whole number is in the valid range
+ * [HUFF_MIN_CODE_LENGTH (11), HUFF_MAX_CODE_LENGTH (24)], return 1.
+ * Otherwise, return 0.
+ */
+int is_valid_code_length(const char* str) {
+    return is_valid_number(str, HUFF_MIN_CODE_LENGTH, HUFF_MAX_CODE_LENGTH);
+}
+
+/**
+ * Check if the string is a valid number of streams. If the string is a whole
+ * number and the whole number is in the valid range
+ * [1, HUFF_MAX_STREAMS (8)], return 1. Otherwise, return 0.
+ */
+int is_valid_stream_count(const char* str) {
+    return is_valid_number(str, 1, HUFF_MAX_STREAMS);
+}
+
+/**
+ * Check if the string is a whole number in the range [min, max]. If so,
+ * return 1. Otherwise, return 0.
+ */
+int is_valid_number(const char* str, int min, int max) {
     int num_digits = 0;
     const char* ptr = str;
 
@@ -124,14 +251,110 @@ int is_valid_block_size(const char* str) {
         num_digits++;
 
         // Return false if there are too many digits (excluding leading zeroes)
-        if (num_digits >= 6)
+        if (num_digits >= 9)
             return 0;
     }
 
-    // Return true if the block size specified by str is valid
-    int block_size = atoi(str);
-    if (block_size >= MIN_BLOCK_SIZE && block_size <= MAX_BLOCK_SIZE)
+    // Return true if the number specified by str is in range
+    int num = atoi(str);
+    if (num >= min && num <= max)
         return 1;
 
     return 0;
 }
+
+/**
+ * Check if the string is a range of the form OFFSET:LEN, where OFFSET and LEN
+ * are whole numbers. If so, store them in offset and len and return 1.
+ * Otherwise, return 0.
+ */
+int parse_range(const char* str, unsigned long long* offset, unsigned long long* len) {
+    const char* colon = strchr(str, ':');
+
+    if (colon == NULL)
+        return 0;
+
+    return parse_whole_number(str, colon, offset) && parse_whole_number(colon + 1, colon + strlen(colon), len);
+}
+
+/**
+ * Check if the characters from str up to end are a whole number that fits in
+ * an unsigned long long. If so, store it in num and return 1. Otherwise,
+ * return 0.
+ */
+int parse_whole_number(const char* str, const char* end, unsigned long long* num) {
+    *num = 0;
+
+    if (str == end)
+        return 0;
+
+    for (const char* ptr = str; ptr < end; ptr++) {
+        // Return false if the character is not a digit or the number overflows
+        if (!(*ptr >= '0' && *ptr <= '9') || *num > (HUFF_RANGE_END - (*ptr - '0')) / 10)
+            return 0;
+
+        *num = 10 * *num + (*ptr - '0');
+    }
+
+    return 1;
+}
+
+/**
+ * Give ctx the table held by the file at path.
+ *
+ * Return 0 if the file holds a valid table. Otherwise, return -1.
+ */
+int load_table_file(huff_ctx* ctx, const char* path) {
+    unsigned char table[HUFF_MAX_TABLE_SIZE + 1];
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL)
+        return -1;
+
+    size_t len = fread(table, 1, sizeof(table), file);
+    int error = ferror(file);
+    fclose(file);
+
+    if (error || len > HUFF_MAX_TABLE_SIZE)
+        return -1;
+
+    return huff_set_table(ctx, table, len);
+}
+
+/**
+ * Read all sample data from in and write a table fitted to it to out.
+ *
+ * Return 0 if the table is written without error. Otherwise, return -1.
+ */
+int write_table(huff_ctx* ctx, FILE* in, FILE* out) {
+    size_t capacity = 65536;
+    size_t len = 0;
+    unsigned char* samples = malloc(capacity);
+
+    if (samples == NULL)
+        return -1;
+
+    // Read the samples, doubling the buffer whenever it fills up
+    while (1) {
+        len += fread(samples + len, 1, capacity - len, in);
+        if (len < capacity)
+            break;
+
+        unsigned char* larger = realloc(samples, 2 * capacity);
+        if (larger == NULL) {
+            free(samples);
+            return -1;
+        }
+        samples = larger;
+        capacity *= 2;
+    }
+
+    unsigned char table[HUFF_MAX_TABLE_SIZE];
+    long table_len = ferror(in) ? -1 : huff_train_table(ctx, samples, len, table, sizeof(table));
+    free(samples);
+
+    if (table_len == -1 || fwrite(table, 1, table_len, out) != (size_t) table_len || fflush(out) != 0)
+        return -1;
+
+    return 0;
+}
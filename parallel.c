@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "huff.h"
+
+/**
+ * Shared state of a running pipeline. Jobs live in a ring of num_slots slots.
+ * Jobs [next_write, next_read) have been read and not yet written; of those,
+ * jobs [next_process, next_read) are waiting for a worker thread.
+ */
+typedef struct pipeline_state {
+    const PIPELINE* pipeline;
+    JOB* slots;
+    int num_slots;
+    long next_read;
+    long next_process;
+    long next_write;
+    int end_of_input; // Indicator for whether read_job has returned nonzero
+    int read_error; // Indicator for whether read_job has returned -1
+    int stop; // Indicator for whether the worker and reader threads should exit
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready; // Signaled when a job is read or stop is set
+    pthread_cond_t job_done; // Signaled when a worker finishes a job, or the reader reads one or ends
+    pthread_cond_t slot_free; // Signaled when a job is written or stop is set
+} PIPELINE_STATE;
+
+void* worker_main(void* arg);
+void* reader_main(void* arg);
+int read_jobs(PIPELINE_STATE* state);
+int write_jobs(PIPELINE_STATE* state);
+
+/**
+ * Run a pipeline on num_threads worker threads. Finished jobs are written in
+ * the order they were read, so the output does not depend on the number of
+ * threads.
+ *
+ * If pipeline->reader_thread is zero, the calling thread reads jobs ahead
+ * into free slots between writing finished ones. Otherwise, jobs are read on
+ * a thread of their own and the calling thread only writes, so that reading,
+ * processing, and writing overlap even with one worker; the ring then has
+ * two more slots, one being read into and one being written out while the
+ * workers keep theirs.
+ *
+ * Return 0 if every stage succeeds. Otherwise, return -1.
+ */
+int run_pipeline(const PIPELINE* pipeline, int num_threads) {
+    PIPELINE_STATE state = {.pipeline = pipeline, .num_slots = 2 * num_threads};
+    pthread_t* threads = calloc(num_threads, sizeof(pthread_t));
+    pthread_t reader;
+    int reader_started = 0;
+    int num_started = 0;
+    int ret = 0;
+
+    if (pipeline->reader_thread)
+        state.num_slots += 2;
+
+    state.slots = calloc(state.num_slots, sizeof(JOB));
+    if (threads == NULL || state.slots == NULL)
+        ret = -1;
+
+    // Allocate the buffers of every slot
+    for (int i = 0; ret == 0 && i < state.num_slots; i++) {
+        state.slots[i].input = malloc(pipeline->input_size);
+        state.slots[i].output = malloc(pipeline->output_size);
+        state.slots[i].table = malloc(pipeline->table_size);
+        if (state.slots[i].input == NULL || state.slots[i].output == NULL || state.slots[i].table == NULL)
+            ret = -1;
+    }
+
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.job_ready, NULL);
+    pthread_cond_init(&state.job_done, NULL);
+    pthread_cond_init(&state.slot_free, NULL);
+
+    for (; ret == 0 && num_started < num_threads; num_started++) {
+        if (pthread_create(threads + num_started, NULL, worker_main, &state) != 0)
+            ret = -1;
+    }
+
+    if (ret == 0 && pipeline->reader_thread) {
+        if (pthread_create(&reader, NULL, reader_main, &state) != 0)
+            ret = -1;
+        else
+            reader_started = 1;
+    }
+
+    if (ret == 0)
+        ret = pipeline->reader_thread ? write_jobs(&state) : read_jobs(&state);
+
+    // Let the worker and reader threads finish their current jobs and exit
+    pthread_mutex_lock(&state.lock);
+    state.stop = 1;
+    pthread_cond_broadcast(&state.job_ready);
+    pthread_cond_broadcast(&state.slot_free);
+    pthread_mutex_unlock(&state.lock);
+
+    if (reader_started)
+        pthread_join(reader, NULL);
+    for (int i = 0; i < num_started; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_cond_destroy(&state.slot_free);
+    pthread_cond_destroy(&state.job_done);
+    pthread_cond_destroy(&state.job_ready);
+    pthread_mutex_destroy(&state.lock);
+
+    for (int i = 0; state.slots != NULL && i < state.num_slots; i++) {
+        free(state.slots[i].input);
+        free(state.slots[i].output);
+        free(state.slots[i].table);
+    }
+    free(state.slots);
+    free(threads);
+
+    return ret;
+}
+
+/**
+ * Run the stages of state on the calling thread: read jobs ahead into free
+ * slots, then write the oldest job once it is finished, until every job is
+ * written.
+ *
+ * Return 0 if every stage succeeds. Otherwise, return -1.
+ */
+int read_jobs(PIPELINE_STATE* state) {
+    const PIPELINE* pipeline = state->pipeline;
+    int end_of_input = 0;
+
+    while (1) {
+        // Read jobs ahead until every slot is in use
+        while (!end_of_input && state->next_read - state->next_write < state->num_slots) {
+            JOB* job = state->slots + state->next_read % state->num_slots;
+            int read_ret = pipeline->read_job(job, pipeline->arg);
+
+            if (read_ret != 0) {
+                end_of_input = 1;
+                if (read_ret == -1)
+                    return -1;
+                break;
+            }
+
+            pthread_mutex_lock(&state->lock);
+            job->done = 0;
+            state->next_read++;
+            pthread_cond_signal(&state->job_ready);
+            pthread_mutex_unlock(&state->lock);
+        }
+
+        // Stop once every job that was read has been written
+        if (state->next_write == state->next_read)
+            return 0;
+
+        // Wait for the oldest job and write it
+        JOB* job = state->slots + state->next_write % state->num_slots;
+        pthread_mutex_lock(&state->lock);
+        while (!job->done)
+            pthread_cond_wait(&state->job_done, &state->lock);
+        pthread_mutex_unlock(&state->lock);
+
+        if (job->ret == -1 || pipeline->write_job(job, pipeline->arg) == -1)
+            return -1;
+
+        state->next_write++;
+    }
+}
+
+/**
+ * Write the jobs of state on the calling thread in the order the reader
+ * thread reads them, each once it is finished, until the reader reaches the
+ * end of the input and every job is written.
+ *
+ * Return 0 if every stage succeeds. Otherwise, return -1.
+ */
+int write_jobs(PIPELINE_STATE* state) {
+    const PIPELINE* pipeline = state->pipeline;
+
+    while (1) {
+        // Wait for the oldest job to be read and finished
+        pthread_mutex_lock(&state->lock);
+        JOB* job = state->slots + state->next_write % state->num_slots;
+        while (!state->read_error && (state->next_write == state->next_read ? !state->end_of_input : !job->done))
+            pthread_cond_wait(&state->job_done, &state->lock);
+
+        int read_error = state->read_error;
+        int finished = (state->next_write == state->next_read);
+        pthread_mutex_unlock(&state->lock);
+
+        if (read_error)
+            return -1;
+        if (finished)
+            return 0;
+
+        if (job->ret == -1 || pipeline->write_job(job, pipeline->arg) == -1)
+            return -1;
+
+        // Hand the slot back to the reader
+        pthread_mutex_lock(&state->lock);
+        state->next_write++;
+        pthread_cond_signal(&state->slot_free);
+        pthread_mutex_unlock(&state->lock);
+    }
+}
+
+/**
+ * Body of the reader thread: read jobs into free slots, in order, until the
+ * end of the input, an error, or the pipeline stops.
+ */
+void* reader_main(void* arg) {
+    PIPELINE_STATE* state = arg;
+    const PIPELINE* pipeline = state->pipeline;
+
+    pthread_mutex_lock(&state->lock);
+    while (1) {
+        while (state->next_read - state->next_write == state->num_slots && !state->stop)
+            pthread_cond_wait(&state->slot_free, &state->lock);
+
+        if (state->stop)
+            break;
+
+        JOB* job = state->slots + state->next_read % state->num_slots;
+        pthread_mutex_unlock(&state->lock);
+
+        int read_ret = pipeline->read_job(job, pipeline->arg);
+
+        pthread_mutex_lock(&state->lock);
+        if (read_ret != 0) {
+            state->end_of_input = 1;
+            state->read_error = (read_ret == -1);
+            pthread_cond_broadcast(&state->job_done);
+            break;
+        }
+
+        job->done = 0;
+        state->next_read++;
+        pthread_cond_signal(&state->job_ready);
+        pthread_cond_broadcast(&state->job_done);
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    return NULL;
+}
+
+/**
+ * Body of a worker thread: process jobs in the order they were read until the
+ * pipeline stops. Jobs still waiting when the pipeline stops are abandoned.
+ */
+void* worker_main(void* arg) {
+    PIPELINE_STATE* state = arg;
+    void* worker = state->pipeline->new_worker(state->pipeline->arg);
+
+    pthread_mutex_lock(&state->lock);
+    while (1) {
+        while (state->next_process == state->next_read && !state->stop)
+            pthread_cond_wait(&state->job_ready, &state->lock);
+
+        if (state->stop)
+            break;
+
+        JOB* job = state->slots + state->next_process % state->num_slots;
+        state->next_process++;
+        pthread_mutex_unlock(&state->lock);
+
+        job->ret = (worker != NULL) ? state->pipeline->process_job(job, worker) : -1;
+
+        pthread_mutex_lock(&state->lock);
+        job->done = 1;
+        pthread_cond_broadcast(&state->job_done);
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    free(worker);
+
+    return NULL;
+}
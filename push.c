@@ -0,0 +1,619 @@
+#include <stdlib.h>
+#include <string.h>
+#include "huff.h"
+
+int push_compress_block(PUSH_STATE* state);
+int push_compress_dynamic(PUSH_STATE* state, huff_stream* strm, int flush);
+int push_frame(PUSH_STATE* state, huff_stream* strm);
+int push_dynamic(PUSH_STATE* state, huff_stream* strm);
+int push_message(PUSH_STATE* state, huff_stream* strm);
+int push_original(PUSH_STATE* state, huff_stream* strm, int flush);
+int gather(PUSH_STATE* state, huff_stream* strm, size_t n);
+void consume(PUSH_STATE* state, huff_stream* strm, size_t n);
+void view_input(PUSH_STATE* state, size_t n);
+int drain(PUSH_STATE* state, huff_stream* strm);
+
+/**
+ * Set up strm to compress (if compress is nonzero) or decompress with the
+ * options and the encoder, decoder, and buffers of ctx. Compression starts by
+ * holding the file header of the framed or dynamic format as output.
+ *
+ * Return 0 if the stream is set up without error. Otherwise, return -1.
+ */
+int push_begin(huff_ctx* ctx, huff_stream* strm, int compress) {
+    PUSH_STATE* state = calloc(1, sizeof(PUSH_STATE));
+
+    strm->total_in = 0;
+    strm->total_out = 0;
+    strm->state = state;
+    if (state == NULL)
+        return -1;
+
+    state->ctx = ctx;
+    state->stage = compress ? PUSH_BLOCKS : PUSH_START;
+    ctx->bad_block = -1;
+    state->job.table = (unsigned char*) state->table;
+
+    if (!compress)
+        return 0;
+
+    // The dynamic format is coded a chunk of input at a time into the output
+    // buffer of ctx
+    if (ctx->dynamic) {
+        if (ctx_reserve(ctx, 0, DYNAMIC_BOUND(DYNAMIC_CHUNK_SIZE)) == -1) {
+            push_end(strm);
+            return -1;
+        }
+
+        init_dynamic(&state->dynamic);
+        state->stage = PUSH_DYNAMIC;
+        state->pending = ctx->output;
+        state->pending_len = write_dynamic_header(ctx->output);
+        return 0;
+    }
+
+    // The output of a block, with its frame header and the file header before
+    // the first block, is written to the sink
+    size_t input_size = ctx->block_size;
+    state->sink.capacity = FILE_HEADER_SIZE + FRAME_HEADER_SIZE + COMPRESS_BLOCK_BOUND(input_size);
+    state->sink.data = malloc(state->sink.capacity);
+    state->buffer = malloc(input_size);
+    state->buffer_size = input_size;
+
+    if (state->sink.data == NULL || state->buffer == NULL ||
+        ctx_reserve(ctx, input_size, COMPRESS_BLOCK_BOUND(input_size)) == -1 ||
+        compress_begin(ctx, &state->compress, &state->source, &state->sink) == -1) {
+        push_end(strm);
+        return -1;
+    }
+
+    init_encoder(ctx->enc, &state->compress);
+    state->job.input = ctx->input;
+    state->job.output = ctx->output;
+    state->pending = state->sink.data;
+    state->pending_len = state->sink.len;
+
+    return 0;
+}
+
+/**
+ * Compress the input of strm into its output as far as both allow. A block is
+ * compressed once the block size has been pushed. With HUFF_FLUSH or
+ * HUFF_FINISH, the input held back is compressed too, ending a block early,
+ * and with HUFF_FINISH the end of the compressed data follows.
+ *
+ * Return 1 once the end of the compressed data has been handed out, 0 if more
+ * input or room for output is needed, or -1 on error.
+ */
+int push_compress(huff_stream* strm, int flush) {
+    PUSH_STATE* state = strm->state;
+    COMPRESS_STATE* compress = &state->compress;
+
+    if (state->stage == PUSH_DYNAMIC)
+        return push_compress_dynamic(state, strm, flush);
+
+    while (state->stage != PUSH_ERROR) {
+        // Hand out the output of the last block before compressing another
+        if (drain(state, strm) == 0)
+            return 0;
+        state->sink.len = 0;
+
+        if (state->stage == PUSH_END)
+            return 1;
+
+        // Collect the input a block is read from, the block size less the
+        // bytes carried over from the last adaptive block
+        size_t n = compress->block_size - compress->carry_len;
+        size_t take = (strm->avail_in < n - state->buffer_len) ? strm->avail_in : n - state->buffer_len;
+
+        if (take > 0)
+            memcpy(state->buffer + state->buffer_len, strm->next_in, take);
+        state->buffer_len += take;
+        strm->next_in += take;
+        strm->avail_in -= take;
+        strm->total_in += take;
+
+        if (state->buffer_len == n || (flush != HUFF_RUN && (state->buffer_len > 0 || compress->carry_len > 0))) {
+            if (push_compress_block(state) == -1)
+                state->stage = PUSH_ERROR;
+        } else if (flush == HUFF_FINISH) {
+            // Make room for the index of the framed format
+            size_t index_size = 4 + 2 * 4 * compress->index.num_blocks + TRAILER_SIZE;
+
+            if (state->sink.capacity < index_size) {
+                unsigned char* data = realloc(state->sink.data, index_size);
+                if (data == NULL) {
+                    state->stage = PUSH_ERROR;
+                    break;
+                }
+
+                state->sink.data = data;
+                state->sink.capacity = index_size;
+            }
+
+            state->stage = (compress_finish(compress) == -1) ? PUSH_ERROR : PUSH_END;
+            state->pending = state->sink.data;
+            state->pending_len = state->sink.len;
+        } else {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Compress the next block from the input collected in the buffer of state,
+ * through the stages of compress_stream(), into the sink of state.
+ *
+ * Return 0 if the block is compressed without error. Otherwise, return -1.
+ */
+int push_compress_block(PUSH_STATE* state) {
+    state->source = (SOURCE) {.data = state->buffer, .len = state->buffer_len};
+
+    if (read_block_job(&state->job, &state->compress) != 0 ||
+        compress_block_job(&state->job, state->ctx->enc) == -1 ||
+        write_job(&state->job, &state->compress) == -1)
+        return -1;
+
+    state->buffer_len = 0;
+    state->pending = state->sink.data;
+    state->pending_len = state->sink.len;
+
+    return 0;
+}
+
+/**
+ * Compress the input of strm to the dynamic format, a chunk at a time, as
+ * far as the output of strm allows. Only the bits of an incomplete byte are
+ * held back, until HUFF_FLUSH pads them out or HUFF_FINISH ends the stream.
+ *
+ * Return 1 once the end of the stream has been handed out. Otherwise, return
+ * 0.
+ */
+int push_compress_dynamic(PUSH_STATE* state, huff_stream* strm, int flush) {
+    unsigned char* output = state->ctx->output;
+
+    // Hand out the output of the last chunk before coding another
+    while (drain(state, strm)) {
+        size_t n = (strm->avail_in < DYNAMIC_CHUNK_SIZE) ? strm->avail_in : DYNAMIC_CHUNK_SIZE;
+
+        if (state->stage == PUSH_END)
+            return 1;
+
+        if (n > 0) {
+            state->pending_len = dynamic_encode(&state->dynamic, strm->next_in, n, output);
+            strm->next_in += n;
+            strm->avail_in -= n;
+            strm->total_in += n;
+        } else if (flush == HUFF_FINISH) {
+            state->pending_len = dynamic_flush(&state->dynamic, 1, output);
+            state->stage = PUSH_END;
+        } else if (flush == HUFF_FLUSH && state->dynamic.count > 0) {
+            state->pending_len = dynamic_flush(&state->dynamic, 0, output);
+        } else {
+            return 0;
+        }
+
+        state->pending = output;
+    }
+
+    return 0;
+}
+
+/**
+ * Decompress the input of strm into its output as far as both allow. A block
+ * of the framed format is decompressed as soon as all of it has been pushed.
+ * The end of a block of the original format is only known by decoding it, so
+ * its decoding is retried as its input grows. The dynamic format is decoded
+ * as it arrives. HUFF_FINISH tells that no more input follows, which ends a
+ * stream in the original format. Input past the end of a framed or dynamic
+ * stream is left in strm.
+ *
+ * Return 1 once the end of the compressed data is reached and all output has
+ * been handed out, 0 if more input or room for output is needed, or -1 if the
+ * input is not valid compressed data.
+ */
+int push_decompress(huff_stream* strm, int flush) {
+    PUSH_STATE* state = strm->state;
+    DECOMPRESS_STATE* decompress = &state->decompress;
+    huff_ctx* ctx = state->ctx;
+    int ret = 1;
+
+    while (ret == 1) {
+        // Hand out the last decompressed block before decompressing another
+        if (drain(state, strm) == 0)
+            return 0;
+
+        switch (state->stage) {
+        case PUSH_START:
+            // Tell the formats apart by the first byte; empty input is left empty
+            ret = gather(state, strm, 1);
+            if (ret == 1 && state->data[0] == DYNAMIC_MAGIC[0]) {
+                state->stage = PUSH_DYNAMIC_HEADER;
+            } else if (ret == 1 && state->data[0] == MESSAGE_MAGIC) {
+                state->stage = PUSH_MESSAGE;
+            } else if (ret == 1 && state->data[0] != FRAME_MAGIC[0]) {
+                decompress->num_streams = 1;
+                init_decoder(ctx->dec, decompress);
+                if (ctx_reserve(ctx, 0, MAX_ORIGINAL_BLOCK_SIZE) == -1)
+                    ret = -1;
+                state->stage = PUSH_ORIGINAL;
+            } else if (ret == 1) {
+                state->stage = PUSH_HEADER;
+            } else if (ret == 0 && flush == HUFF_FINISH) {
+                state->stage = PUSH_END;
+                ret = 1;
+            }
+            break;
+
+        case PUSH_ORIGINAL:
+            ret = push_original(state, strm, flush);
+            break;
+
+        case PUSH_HEADER: {
+            size_t header_size = 0;
+
+            ret = gather(state, strm, FILE_HEADER_V1_SIZE);
+            if (ret == 1) {
+                header_size = file_header_size(state->data);
+                ret = (header_size == 0) ? -1 : gather(state, strm, header_size);
+            }
+
+            if (ret == 1) {
+                view_input(state, header_size);
+                decompress->static_table = ctx->table;
+                if (read_file_header(decompress) == -1 ||
+                    ctx_reserve(ctx, COMPRESS_BLOCK_BOUND(decompress->block_size), decompress->block_size) == -1) {
+                    ret = -1;
+                    break;
+                }
+
+                init_decoder(ctx->dec, decompress);
+                state->job.input = ctx->input;
+                state->job.output = ctx->output;
+                consume(state, strm, header_size);
+                state->stage = PUSH_FRAME;
+            }
+            break;
+        }
+
+        case PUSH_FRAME:
+            ret = push_frame(state, strm);
+            break;
+
+        case PUSH_DYNAMIC_HEADER:
+            ret = gather(state, strm, DYNAMIC_HEADER_SIZE);
+            if (ret == 1) {
+                if (read_dynamic_header(state->data) == -1 || ctx_reserve(ctx, 0, DYNAMIC_CHUNK_SIZE) == -1) {
+                    ret = -1;
+                    break;
+                }
+
+                init_dynamic(&state->dynamic);
+                consume(state, strm, DYNAMIC_HEADER_SIZE);
+                state->stage = PUSH_DYNAMIC;
+            }
+            break;
+
+        case PUSH_DYNAMIC:
+            ret = push_dynamic(state, strm);
+            break;
+
+        case PUSH_MESSAGE:
+            ret = push_message(state, strm);
+            break;
+
+        case PUSH_INDEX: {
+            size_t index_size = 2 * 4 * decompress->index.num_blocks + TRAILER_SIZE;
+
+            ret = gather(state, strm, index_size);
+            if (ret == 1) {
+                view_input(state, index_size);
+                if (read_index(decompress) == -1) {
+                    ret = -1;
+                    break;
+                }
+
+                consume(state, strm, index_size);
+                state->stage = PUSH_END;
+            }
+            break;
+        }
+
+        case PUSH_END:
+            return 1;
+
+        default:
+            return -1;
+        }
+    }
+
+    // Input that ends in the middle of the data cannot be finished
+    if (ret == -1 || flush == HUFF_FINISH)
+        state->stage = PUSH_ERROR;
+
+    return (state->stage == PUSH_ERROR) ? -1 : 0;
+}
+
+/**
+ * Decompress the next frame of a framed stream once all of it has been
+ * pushed, or move on to the index after the last frame.
+ *
+ * Return 1 if the frame is decompressed, 0 if more input is needed, or -1 if
+ * the frame is not valid.
+ */
+int push_frame(PUSH_STATE* state, huff_stream* strm) {
+    DECOMPRESS_STATE* decompress = &state->decompress;
+
+    int ret = gather(state, strm, 4);
+    if (ret != 1)
+        return ret;
+
+    // Return -1 before collecting a frame longer than a block can take
+    uint32_t compressed_len = get_u32(state->data);
+    size_t frame_len = (compressed_len == 0) ? 4 : FRAME_HEADER_SIZE + (size_t) compressed_len;
+
+    if (compressed_len > COMPRESS_BLOCK_BOUND(decompress->block_size))
+        return -1;
+
+    ret = gather(state, strm, frame_len);
+    if (ret != 1)
+        return ret;
+
+    view_input(state, frame_len);
+    ret = read_frame_job(&state->job, decompress);
+
+    if (ret == 1) {
+        state->stage = PUSH_INDEX;
+    } else if (ret == 0 && decompress_block_job(&state->job, state->ctx->dec) == 0 && !state->job.corrupt) {
+        state->pending = state->job.output;
+        state->pending_len = state->job.output_len;
+    } else {
+        if (ret == 0)
+            state->ctx->bad_block = decompress->num_blocks - 1;
+        return -1;
+    }
+
+    consume(state, strm, frame_len);
+
+    return 1;
+}
+
+/**
+ * Decode the input of strm in the dynamic format, starting with any collected
+ * in the buffer of state, until it runs out, the output buffer of the context
+ * fills up, or the stream ends. The decoder keeps the bits of an incomplete
+ * code, so all of the input it is given is used unless the stream ends.
+ *
+ * Return 1 if any input is used or the stream ends, 0 if more input is
+ * needed, or -1 if the input is not valid.
+ */
+int push_dynamic(PUSH_STATE* state, huff_stream* strm) {
+    huff_ctx* ctx = state->ctx;
+    size_t consumed;
+
+    state->data = (state->buffer_len > 0) ? state->buffer : strm->next_in;
+    size_t len = (state->buffer_len > 0) ? state->buffer_len : strm->avail_in;
+
+    int ret = dynamic_decode(&state->dynamic, state->data, len, &consumed, ctx->output, DYNAMIC_CHUNK_SIZE,
+                             &state->pending_len);
+    if (ret == -1)
+        return -1;
+
+    consume(state, strm, consumed);
+    state->pending = ctx->output;
+
+    if (ret == 1)
+        state->stage = PUSH_END;
+
+    return (ret == 1 || consumed > 0 || state->pending_len > 0) ? 1 : 0;
+}
+
+/**
+ * Decompress the next block of a stream in the original format. A block takes
+ * at most COMPRESS_BLOCK_BOUND(MAX_ORIGINAL_BLOCK_SIZE) bytes, so it is tried
+ * with fewer only if the input has doubled since the last try, which keeps
+ * the work of retrying within twice that of decoding the block once. A block
+ * that fails to decode is only invalid once it has all the input it could
+ * need.
+ *
+ * Return 1 if a block is decompressed or the stream ends, 0 if more input is
+ * needed, or -1 if the block is not valid.
+ */
+int push_original(PUSH_STATE* state, huff_stream* strm, int flush) {
+    huff_ctx* ctx = state->ctx;
+    size_t bound = COMPRESS_BLOCK_BOUND(MAX_ORIGINAL_BLOCK_SIZE);
+
+    int ret = gather(state, strm, bound);
+    if (ret == -1)
+        return -1;
+
+    size_t len = (ret == 1) ? bound : state->buffer_len;
+    int complete = (ret == 1 || flush == HUFF_FINISH);
+
+    // Stop if there is nothing left to decompress
+    if (len == 0 && complete) {
+        state->stage = PUSH_END;
+        return 1;
+    }
+
+    if (len == 0 || (!complete && len < 2 * state->retry_len))
+        return 0;
+
+    size_t consumed, output_len;
+    if (decompress_block(ctx->dec, state->data, len, &consumed, ctx->output, MAX_ORIGINAL_BLOCK_SIZE,
+                         &output_len) == -1) {
+        state->retry_len = len;
+        if (complete)
+            ctx->bad_block = state->decompress.num_blocks;
+        return complete ? -1 : 0;
+    }
+
+    consume(state, strm, consumed);
+    state->decompress.num_blocks++;
+    state->retry_len = 0;
+    state->pending = ctx->output;
+    state->pending_len = output_len;
+
+    return 1;
+}
+
+/**
+ * Decompress a message once all of it has been pushed, with the table of the
+ * context, which must be the table the message was compressed with.
+ *
+ * Return 1 if the message is decompressed, 0 if more input is needed, or -1
+ * if the message is not valid.
+ */
+int push_message(PUSH_STATE* state, huff_stream* strm) {
+    huff_ctx* ctx = state->ctx;
+    MESSAGE_HEADER header;
+    int header_len = 0;
+    int ret;
+
+    // The lengths take as many bytes as their values need, so the header is
+    // collected a byte at a time once it is at its shortest
+    for (size_t n = 1 + 4 + 2; header_len == 0; n++) {
+        ret = gather(state, strm, n);
+        if (ret != 1)
+            return ret;
+
+        header_len = read_message_header(state->data, n, &header);
+    }
+
+    // Return -1 before collecting a message that cannot be decoded
+    if (header_len == -1 || ctx->table == NULL || header.table_id != ctx->table->id)
+        return -1;
+
+    size_t len = header_len + header.compressed_len;
+    ret = gather(state, strm, len);
+    if (ret != 1)
+        return ret;
+
+    if (ctx_reserve(ctx, 0, header.uncompressed_len) == -1)
+        return -1;
+
+    if (decode_message(&ctx->table->dec, &header, state->data + header_len, ctx->output) == -1) {
+        ctx->bad_block = 0;
+        return -1;
+    }
+
+    state->pending = ctx->output;
+    state->pending_len = header.uncompressed_len;
+    consume(state, strm, len);
+    state->stage = PUSH_END;
+
+    return 1;
+}
+
+/**
+ * Make the next n bytes of input available at state->data: in place if
+ * next_in holds all of them and none are collected in the buffer, or else
+ * collected in the buffer from next_in.
+ *
+ * Return 1 if the n bytes are available, 0 if more input is needed, or -1 if
+ * out of memory.
+ */
+int gather(PUSH_STATE* state, huff_stream* strm, size_t n) {
+    if (state->buffer_len == 0 && strm->avail_in >= n) {
+        state->data = strm->next_in;
+        return 1;
+    }
+
+    if (state->buffer_size < n) {
+        unsigned char* buffer = realloc(state->buffer, n);
+        if (buffer == NULL)
+            return -1;
+
+        state->buffer = buffer;
+        state->buffer_size = n;
+    }
+
+    if (state->buffer_len < n) {
+        size_t take = (strm->avail_in < n - state->buffer_len) ? strm->avail_in : n - state->buffer_len;
+
+        if (take > 0)
+            memcpy(state->buffer + state->buffer_len, strm->next_in, take);
+        state->buffer_len += take;
+        strm->next_in += take;
+        strm->avail_in -= take;
+        strm->total_in += take;
+    }
+
+    state->data = state->buffer;
+
+    return state->buffer_len >= n;
+}
+
+/**
+ * Count the first n bytes made available by gather() as used.
+ */
+void consume(PUSH_STATE* state, huff_stream* strm, size_t n) {
+    if (state->data == state->buffer) {
+        state->buffer_len -= n;
+        memmove(state->buffer, state->buffer + n, state->buffer_len);
+    } else {
+        strm->next_in += n;
+        strm->avail_in -= n;
+        strm->total_in += n;
+    }
+}
+
+/**
+ * Point the compressed data of the DECOMPRESS_STATE of state at the n bytes
+ * made available by gather(), as if they were all the input there is.
+ */
+void view_input(PUSH_STATE* state, size_t n) {
+    DECOMPRESS_STATE* decompress = &state->decompress;
+
+    decompress->data = state->data;
+    decompress->len = n;
+    decompress->pos = 0;
+    decompress->eof = 1;
+}
+
+/**
+ * Copy as much of the pending output of state as fits to the output of strm.
+ *
+ * Return 1 if no output is left pending. Otherwise, return 0.
+ */
+int drain(PUSH_STATE* state, huff_stream* strm) {
+    size_t n = state->pending_len - state->pending_pos;
+
+    if (n > strm->avail_out)
+        n = strm->avail_out;
+
+    if (n > 0)
+        memcpy(strm->next_out, state->pending + state->pending_pos, n);
+    state->pending_pos += n;
+    strm->next_out += n;
+    strm->avail_out -= n;
+    strm->total_out += n;
+
+    if (state->pending_pos < state->pending_len)
+        return 0;
+
+    state->pending_pos = 0;
+    state->pending_len = 0;
+
+    return 1;
+}
+
+/**
+ * Free the state of strm. strm->state may be NULL.
+ */
+void push_end(huff_stream* strm) {
+    PUSH_STATE* state = strm->state;
+
+    if (state == NULL)
+        return;
+
+    free(state->buffer);
+    free(state->sink.data);
+    free(state->compress.carry);
+    free(state->compress.index.lengths);
+    free(state->decompress.index.lengths);
+    free(state);
+    strm->state = NULL;
+}
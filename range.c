@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "huff.h"
+
+/**
+ * Each entry of the index of a framed stream holds the compressed and
+ * uncompressed lengths of a block, as its frame header does.
+ */
+#define INDEX_ENTRY_SIZE FRAME_HEADER_SIZE
+
+int find_code_block(DECOMPRESS_STATE* state, const unsigned char* index, size_t blocks_end, long first, long end,
+                    size_t frame_pos);
+int frame_type(const DECOMPRESS_STATE* state, const unsigned char* entry, size_t blocks_end, size_t frame_pos);
+
+/**
+ * Decompress the range of the decompressed data given by state from a framed
+ * stream held in memory, which must end with its index and trailer.
+ *
+ * The index gives the compressed and uncompressed length of every block, so
+ * the blocks that hold the range are found by adding up the lengths in the
+ * index, without reading any block before them. Only those blocks are
+ * decompressed, along with the header of the block whose code the first of
+ * them repeats, if any. The time taken therefore depends on the size of the
+ * range rather than on where it lies in the data. The blocks of the range are
+ * numbered as in the whole stream, so that a corrupt block is reported by the
+ * same number either way.
+ *
+ * Return 0 if the range is decompressed without error, including a range
+ * that extends past the end of the data, whose part within the data is
+ * written. Otherwise, return -1.
+ */
+int decompress_range(huff_ctx* ctx, DECOMPRESS_STATE* state) {
+    if (read_file_header(state) == -1)
+        return -1;
+
+    // Find the index from the trailer. It follows the frame header that ends
+    // the blocks, and every block takes at least a frame header and an entry.
+    if (state->len - state->pos < 4 + TRAILER_SIZE)
+        return -1;
+
+    const unsigned char* trailer = state->data + state->len - TRAILER_SIZE;
+    uint32_t num_blocks = get_u32(trailer);
+    size_t max_blocks = (state->len - state->pos - 4 - TRAILER_SIZE) / (FRAME_HEADER_SIZE + INDEX_ENTRY_SIZE);
+
+    if (memcmp(trailer + 4, FRAME_INDEX_MAGIC, 4) != 0 || num_blocks > max_blocks)
+        return -1;
+
+    const unsigned char* index = trailer - (size_t) num_blocks * INDEX_ENTRY_SIZE;
+    size_t blocks_end = index - 4 - state->data; // Position of the frame header ending the blocks
+
+    if (get_u32(state->data + blocks_end) != 0)
+        return -1;
+
+    // Skip the blocks that end before the range
+    uint64_t block_start = 0; // Offset of the first decompressed byte of the block
+    size_t frame_pos = state->pos; // Position of the frame header of the block
+    long first = 0;
+
+    for (; first < (long) num_blocks; first++) {
+        const unsigned char* entry = index + first * INDEX_ENTRY_SIZE;
+
+        if (block_start + get_u32(entry + 4) > state->skip)
+            break;
+
+        block_start += get_u32(entry + 4);
+        frame_pos += FRAME_HEADER_SIZE + get_u32(entry);
+
+        // Return -1 if the blocks would run into the index
+        if (frame_pos > blocks_end)
+            return -1;
+    }
+
+    // Find the block after the last one the range reaches into
+    uint64_t range_end = state->skip;
+    range_end += (state->remaining < UINT64_MAX - range_end) ? state->remaining : UINT64_MAX - range_end;
+
+    long end = first;
+    for (uint64_t offset = block_start; end < (long) num_blocks && offset < range_end; end++)
+        offset += get_u32(index + end * INDEX_ENTRY_SIZE + 4);
+
+    state->skip -= block_start;
+    state->end_block = end;
+    state->num_blocks = first;
+    state->num_written = first;
+    state->pos = frame_pos;
+
+    if (first < end) {
+        if (frame_type(state, index + first * INDEX_ENTRY_SIZE, blocks_end, frame_pos) == -1)
+            return -1;
+
+        if (state->block_types && find_code_block(state, index, blocks_end, first, end, frame_pos) == -1)
+            return -1;
+
+        if (run_frames(ctx, state) == -1)
+            return -1;
+    }
+
+    // Count the stream as read up to its end, like a whole decompression
+    state->pos = state->len;
+
+    return 0;
+}
+
+/**
+ * If the first block of the range from the block numbered first to the one
+ * before end that is neither stored nor static repeats the code of an
+ * earlier block, walk back from first, whose frame header is at frame_pos in
+ * state->data, to the last block with a new code, using the lengths in index,
+ * and keep its header in state as read_frame_job() would have. The blocks end
+ * at blocks_end.
+ *
+ * Return 0 if the range needs no earlier code or the block with the code is
+ * found. Otherwise, return -1.
+ */
+int find_code_block(DECOMPRESS_STATE* state, const unsigned char* index, size_t blocks_end, long first, long end,
+                    size_t frame_pos) {
+    size_t pos = frame_pos;
+    long block = first;
+    int type;
+
+    // Stored and static blocks leave the code to repeat as it is, so a repeat
+    // block after them repeats the same code as one in their place would
+    while ((type = frame_type(state, index + block * INDEX_ENTRY_SIZE, blocks_end, pos)) == BLOCK_STORED ||
+           type == BLOCK_STATIC) {
+        pos += FRAME_HEADER_SIZE + get_u32(index + block * INDEX_ENTRY_SIZE);
+        if (++block == end)
+            return 0;
+    }
+
+    if (type != BLOCK_REPEAT)
+        return (type == -1) ? -1 : 0;
+
+    // The lengths that lead back were added up to reach frame_pos, so the
+    // walk stays within the blocks
+    pos = frame_pos;
+    for (block = first - 1; block >= 0; block--) {
+        const unsigned char* entry = index + block * INDEX_ENTRY_SIZE;
+
+        pos -= FRAME_HEADER_SIZE + get_u32(entry);
+
+        type = frame_type(state, entry, blocks_end, pos);
+        if (type == -1)
+            return -1;
+
+        if (type == BLOCK_HUFFMAN) {
+            uint32_t compressed_len = get_u32(entry);
+
+            state->table_id = block;
+            state->table_len = (compressed_len - 1 < MAX_HEADER_SIZE) ? compressed_len - 1 : MAX_HEADER_SIZE;
+            memcpy(state->table, state->data + pos + FRAME_HEADER_SIZE + 1, state->table_len);
+            return 0;
+        }
+    }
+
+    // Return -1 if there is no code to repeat
+    return -1;
+}
+
+/**
+ * Return the type of the block whose frame header is at frame_pos in
+ * state->data, or -1 if the frame header does not match the index entry at
+ * entry, or the block does not end by blocks_end.
+ */
+int frame_type(const DECOMPRESS_STATE* state, const unsigned char* entry, size_t blocks_end, size_t frame_pos) {
+    uint32_t compressed_len = get_u32(entry);
+
+    if (compressed_len == 0 || blocks_end - frame_pos < FRAME_HEADER_SIZE + (size_t) compressed_len ||
+        memcmp(state->data + frame_pos, entry, FRAME_HEADER_SIZE) != 0)
+        return -1;
+
+    return state->data[frame_pos + FRAME_HEADER_SIZE];
+}
+
+/**
+ * Write the n decompressed bytes at output to the sink of state, or if state
+ * has a range, only those of them that lie in the range.
+ *
+ * Return 0 if the bytes are written without error. Otherwise, return -1.
+ */
+int write_range(DECOMPRESS_STATE* state, const unsigned char* output, size_t n) {
+    if (!state->ranged)
+        return sink_write(state->sink, output, n);
+
+    size_t skip = (state->skip < n) ? state->skip : n;
+    state->skip -= skip;
+    output += skip;
+    n -= skip;
+
+    if (n > state->remaining)
+        n = state->remaining;
+    state->remaining -= n;
+
+    return (n > 0) ? sink_write(state->sink, output, n) : 0;
+}
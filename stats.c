@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "huff.h"
+
+static const char* const type_names[] = {"huffman", "stored", "repeat", "static"};
+static const char* const timer_names[NUM_TIMERS] = {"histogram", "tree", "encode", "decode", "io"};
+
+int timer_reported(const STATS_REPORT* report, int timer);
+double bits_per_symbol(double bits, uint64_t num_symbols);
+
+/**
+ * Return the time of a monotonic clock, in nanoseconds.
+ */
+uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Set up report to write the statistics of a call compressing (if compress is
+ * nonzero) or decompressing with ctx, and write the column headings of the
+ * table if ctx asks for one.
+ */
+void stats_begin(STATS_REPORT* report, const huff_ctx* ctx, int compress) {
+    *report = (STATS_REPORT) {
+        .out = ctx->stats_out,
+        .format = ctx->stats_format,
+        .compress = compress
+    };
+
+    if (report->out == NULL)
+        return;
+
+    report->start_ns = now_ns();
+
+    if (report->format == HUFF_STATS_TEXT) {
+        fprintf(report->out, "%6s %-8s %12s %12s %7s %7s %7s %8s %8s", "block", "type", "uncompressed",
+                "compressed", "header", "symbols", "max_len", "entropy", "bits/sym");
+        for (int timer = 0; timer < NUM_TIMERS; timer++) {
+            if (timer_reported(report, timer))
+                fprintf(report->out, " %9s_us", timer_names[timer]);
+        }
+        fputc('\n', report->out);
+    }
+}
+
+/**
+ * Point job->stats at cleared statistics held by the job if report is
+ * written, or at nothing otherwise.
+ *
+ * Return job->stats.
+ */
+BLOCK_STATS* stats_job(const STATS_REPORT* report, JOB* job) {
+    if (report->out == NULL) {
+        job->stats = NULL;
+    } else {
+        job->block_stats = (BLOCK_STATS) {0};
+        job->stats = &job->block_stats;
+    }
+
+    return job->stats;
+}
+
+/**
+ * Record in stats the number of distinct symbols of a block of n symbols
+ * counted in counts and their entropy.
+ */
+void stats_symbols(BLOCK_STATS* stats, const uint32_t* counts, size_t n) {
+    stats->num_symbols = 0;
+    for (int symbol = 0; symbol < 256; symbol++)
+        stats->num_symbols += (counts[symbol] != 0);
+
+    stats->entropy_bits = entropy_bits(counts, n);
+}
+
+/**
+ * Write the statistics of the next block to report and add them to its
+ * totals. The block holds uncompressed_len symbols and takes compressed_len
+ * bytes, not counting its frame header.
+ */
+void stats_block(STATS_REPORT* report, const BLOCK_STATS* stats, size_t uncompressed_len, size_t compressed_len) {
+    double entropy = bits_per_symbol(stats->entropy_bits, uncompressed_len);
+    double achieved = bits_per_symbol(8.0 * compressed_len, uncompressed_len);
+
+    if (report->format == HUFF_STATS_TEXT) {
+        fprintf(report->out, "%6ld %-8s %12zu %12zu %7zu %7d %7d %8.3f %8.3f", report->num_blocks,
+                type_names[stats->type], uncompressed_len, compressed_len, stats->header_len, stats->num_symbols,
+                stats->max_length, entropy, achieved);
+        for (int timer = 0; timer < NUM_TIMERS; timer++) {
+            if (timer_reported(report, timer))
+                fprintf(report->out, " %12.1f", stats->ns[timer] / 1000.0);
+        }
+    } else {
+        fprintf(report->out,
+                "{\"record\":\"block\",\"block\":%ld,\"type\":\"%s\",\"uncompressed\":%zu,\"compressed\":%zu,"
+                "\"header\":%zu,\"symbols\":%d,\"max_code_length\":%d,\"entropy\":%.4f,\"bits_per_symbol\":%.4f",
+                report->num_blocks, type_names[stats->type], uncompressed_len, compressed_len, stats->header_len,
+                stats->num_symbols, stats->max_length, entropy, achieved);
+        for (int timer = 0; timer < NUM_TIMERS; timer++) {
+            if (timer_reported(report, timer))
+                fprintf(report->out, ",\"%s_ns\":%llu", timer_names[timer], (unsigned long long) stats->ns[timer]);
+        }
+        fputc('}', report->out);
+    }
+    fputc('\n', report->out);
+
+    report->num_blocks++;
+    report->type_blocks[stats->type]++;
+    report->uncompressed_len += uncompressed_len;
+    report->compressed_len += compressed_len;
+    report->header_len += stats->header_len;
+    report->entropy_bits += stats->entropy_bits;
+    if (stats->max_length > report->max_length)
+        report->max_length = stats->max_length;
+    for (int timer = 0; timer < NUM_TIMERS; timer++)
+        report->ns[timer] += stats->ns[timer];
+}
+
+/**
+ * Write the totals of the blocks of report and the time the call took.
+ */
+void stats_end(STATS_REPORT* report) {
+    if (report->out == NULL)
+        return;
+
+    uint64_t wall_ns = now_ns() - report->start_ns;
+    double entropy = bits_per_symbol(report->entropy_bits, report->uncompressed_len);
+    double achieved = bits_per_symbol(8.0 * report->compressed_len, report->uncompressed_len);
+
+    if (report->format == HUFF_STATS_TEXT) {
+        double ratio = (report->uncompressed_len > 0) ? 100.0 * report->compressed_len / report->uncompressed_len : 0;
+
+        fprintf(report->out,
+                "total: %ld blocks (%ld huffman, %ld stored, %ld repeat, %ld static), %llu -> %llu bytes (%.2f%%), "
+                "%llu header bytes\n",
+                report->num_blocks, report->type_blocks[BLOCK_HUFFMAN], report->type_blocks[BLOCK_STORED],
+                report->type_blocks[BLOCK_REPEAT], report->type_blocks[BLOCK_STATIC],
+                (unsigned long long) report->uncompressed_len,
+                (unsigned long long) report->compressed_len, ratio, (unsigned long long) report->header_len);
+        fprintf(report->out, "total: entropy %.3f bits/symbol, achieved %.3f bits/symbol, longest code %d bits\n",
+                entropy, achieved, report->max_length);
+        fprintf(report->out, "total:");
+        for (int timer = 0; timer < NUM_TIMERS; timer++) {
+            if (timer_reported(report, timer))
+                fprintf(report->out, " %s %.3f ms,", timer_names[timer], report->ns[timer] / 1e6);
+        }
+        fprintf(report->out, " wall %.3f ms\n", wall_ns / 1e6);
+    } else {
+        fprintf(report->out,
+                "{\"record\":\"total\",\"operation\":\"%s\",\"blocks\":%ld,\"huffman_blocks\":%ld,"
+                "\"stored_blocks\":%ld,\"repeat_blocks\":%ld,\"static_blocks\":%ld,\"uncompressed\":%llu,"
+                "\"compressed\":%llu,\"header\":%llu,\"max_code_length\":%d,\"entropy\":%.4f,"
+                "\"bits_per_symbol\":%.4f",
+                report->compress ? "compress" : "decompress", report->num_blocks,
+                report->type_blocks[BLOCK_HUFFMAN], report->type_blocks[BLOCK_STORED],
+                report->type_blocks[BLOCK_REPEAT], report->type_blocks[BLOCK_STATIC],
+                (unsigned long long) report->uncompressed_len,
+                (unsigned long long) report->compressed_len, (unsigned long long) report->header_len,
+                report->max_length, entropy, achieved);
+        for (int timer = 0; timer < NUM_TIMERS; timer++) {
+            if (timer_reported(report, timer))
+                fprintf(report->out, ",\"%s_ns\":%llu", timer_names[timer], (unsigned long long) report->ns[timer]);
+        }
+        fprintf(report->out, ",\"wall_ns\":%llu}\n", (unsigned long long) wall_ns);
+    }
+
+    fflush(report->out);
+}
+
+/**
+ * Check if report gives the times of timer: none if the timers are compiled
+ * out, and otherwise those of the stages that compression or decompression
+ * goes through. If so, return 1. Otherwise, return 0.
+ */
+int timer_reported(const STATS_REPORT* report, int timer) {
+    if (!TIMERS_ENABLED)
+        return 0;
+
+    if (report->compress)
+        return timer != TIMER_DECODE;
+
+    return timer == TIMER_TREE || timer == TIMER_DECODE || timer == TIMER_IO;
+}
+
+/**
+ * Return bits divided by num_symbols, or 0 if there are no symbols.
+ */
+double bits_per_symbol(double bits, uint64_t num_symbols) {
+    return (num_symbols > 0) ? bits / num_symbols : 0;
+}
@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "huff.h"
+
+/**
+ * A trained table limits its codes to TRAINED_CODE_BITS bits, the most the
+ * decode table resolves with a single lookup, unless the context has a limit
+ * of its own.
+ */
+#define TRAINED_CODE_BITS DECODE_TABLE_MAX_BITS
+
+void count_samples(const unsigned char* samples, size_t n, uint32_t* counts);
+
+/**
+ * Write to output, which has room for capacity bytes, a table fitted to the n
+ * bytes at samples: TABLE_MAGIC and the code lengths of a Huffman code for
+ * every symbol, built with the encoder of ctx and limited to
+ * ctx->max_code_length bits, or TRAINED_CODE_BITS if there is no limit.
+ *
+ * Return the number of bytes written to output, or -1 if the table does not
+ * fit.
+ */
+long train_table(huff_ctx* ctx, const unsigned char* samples, size_t n, unsigned char* output, size_t capacity) {
+    ENCODER* enc = ctx->enc;
+    unsigned char table[MAX_TABLE_SIZE];
+    uint32_t counts[256];
+
+    count_samples(samples, n, counts);
+
+    enc->max_code_length = (ctx->max_code_length != 0) ? ctx->max_code_length : TRAINED_CODE_BITS;
+    enc->canonical = 1;
+    build_code(enc, counts);
+
+    memcpy(table, TABLE_MAGIC, TABLE_MAGIC_SIZE);
+    size_t len = TABLE_MAGIC_SIZE + output_code_lengths(enc, table + TABLE_MAGIC_SIZE);
+
+    if (len > capacity)
+        return -1;
+
+    memcpy(output, table, len);
+
+    return len;
+}
+
+/**
+ * Count the number of times each symbol occurs in the n bytes at samples into
+ * counts, scaled down if need be to no more than a block of MAX_BLOCK_SIZE
+ * symbols can count, and plus one, so that every symbol gets a code even if
+ * the samples lack it.
+ */
+void count_samples(const unsigned char* samples, size_t n, uint32_t* counts) {
+    uint64_t totals[256] = {0};
+    uint64_t max_total = 0;
+    int shift = 0;
+
+    // Count a block at a time, since histogram() counts in 32 bits
+    for (size_t i = 0; i < n; i += MAX_BLOCK_SIZE) {
+        histogram(samples + i, (n - i < MAX_BLOCK_SIZE) ? n - i : MAX_BLOCK_SIZE, counts);
+
+        for (int symbol = 0; symbol < 256; symbol++)
+            totals[symbol] += counts[symbol];
+    }
+
+    for (int symbol = 0; symbol < 256; symbol++) {
+        if (totals[symbol] > max_total)
+            max_total = totals[symbol];
+    }
+
+    while ((max_total >> shift) >= MAX_BLOCK_SIZE)
+        shift++;
+
+    for (int symbol = 0; symbol < 256; symbol++)
+        counts[symbol] = (totals[symbol] >> shift) + 1;
+}
+
+/**
+ * Read the input_len bytes of a table file at input and build the static
+ * table they describe: the canonical codes of its code lengths, built with
+ * the encoder of ctx, and their decode table.
+ *
+ * Return the table, which the caller frees, or NULL if input is not a valid
+ * table or out of memory.
+ */
+STATIC_TABLE* load_table(huff_ctx* ctx, const unsigned char* input, size_t input_len) {
+    ENCODER* enc = ctx->enc;
+    size_t pos = TABLE_MAGIC_SIZE;
+
+    if (input_len < TABLE_MAGIC_SIZE || memcmp(input, TABLE_MAGIC, TABLE_MAGIC_SIZE) != 0)
+        return NULL;
+
+    STATIC_TABLE* table = calloc(1, sizeof(STATIC_TABLE));
+    if (table == NULL)
+        return NULL;
+
+    // Build the decode table, which checks that the lengths make a complete
+    // code, and return NULL if anything follows them
+    DECODER* dec = &table->dec;
+    dec->canonical = 1;
+    dec->num_streams = 1;
+    dec->table_id = -1;
+
+    if (parse_code_lengths(dec, input, input_len, &pos, table->lengths) == -1 || pos != input_len ||
+        build_canonical_table(dec, table->lengths) == -1) {
+        free(table);
+        return NULL;
+    }
+
+    // Number the codes of the encoder the same way
+    for (int symbol = 0; symbol < MAX_SYMBOLS; symbol++) {
+        enc->leaf_for_symbol[symbol] = (table->lengths[symbol] != 0) ? 0 : -1;
+        enc->code_table[symbol] = (CODE_ENTRY) {.code = 0, .length = table->lengths[symbol]};
+    }
+    assign_canonical_codes(enc);
+    memcpy(table->code_table, enc->code_table, sizeof(table->code_table));
+
+    table->id = crc32c(0, input, input_len);
+
+    return table;
+}